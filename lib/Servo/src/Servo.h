@@ -91,7 +91,9 @@
 #define REFRESH_INTERVAL    20000     // minimum time to refresh servos in microseconds
 
 #define SERVOS_PER_TIMER       12     // the maximum number of servos controlled by one timer
+#ifndef MAX_SERVOS                    // may be lowered with -D to save SRAM on unused channels
 #define MAX_SERVOS   (_Nbr_16timers  * SERVOS_PER_TIMER)
+#endif
 
 #define INVALID_SERVO         255     // flag indicating an invalid servo index
 
@@ -105,6 +107,12 @@ typedef struct  {
 typedef struct {
   ServoPin_t Pin;
   volatile unsigned int ticks;
+#if defined(ARDUINO_ARCH_AVR)
+  volatile unsigned int target;       // profile end point in ticks
+  unsigned int speed;                 // current profile speed, ticks per refresh
+  unsigned int maxSpeed;              // ticks per refresh
+  unsigned int accel;                 // ticks per refresh per refresh, 0 = no profile
+#endif
 } servo_t;
 
 class Servo
@@ -119,10 +127,19 @@ public:
   int read();                        // returns current pulse width as an angle between 0 and 180 degrees
   int readMicroseconds();            // returns current pulse width in microseconds for this servo (was read_us() in first release)
   bool attached();                   // return true if this servo is attached, otherwise false
+#if defined(ARDUINO_ARCH_AVR)
+  // Trapezoidal move to value (as write()) stepped from the timer ISR once per refresh interval.
+  // maxSpeed is in microseconds per refresh, accel in microseconds per refresh per refresh.
+  void moveTo(int value, unsigned int maxSpeed, unsigned int accel);
+  bool moving();                     // true until a moveTo() has reached its target
+#endif
 private:
    uint8_t servoIndex;               // index into the channel data for this servo
    int8_t min;                       // minimum is this value times 4 added to MIN_PULSE_WIDTH
    int8_t max;                       // maximum is this value times 4 added to MAX_PULSE_WIDTH
+#if defined(ARDUINO_ARCH_AVR)
+   unsigned int toTicks(int value);  // clamped pulse width in us to channel ticks
+#endif
 };
 
 #endif
@@ -49,10 +49,40 @@ uint8_t ServoCount = 0;                                     // the total number
 
 /************ static functions common to all instances ***********************/
 
+// advance one servo's motion profile by one refresh interval
+static inline void step_profile(servo_t &servo)
+{
+  unsigned int ticks = servo.ticks;
+  unsigned int target = servo.target;
+  if( ticks == target ) {
+    servo.speed = 0;
+    return;
+  }
+
+  unsigned int remaining = ticks < target ? target - ticks : ticks - target;
+  unsigned int speed = servo.speed;
+  unsigned int faster = speed + servo.accel < servo.maxSpeed ? speed + servo.accel : servo.maxSpeed;
+  // v * (v + a) / 2a is the distance needed to brake from v in steps of a
+  if( (unsigned long)faster * (faster + servo.accel) <= 2UL * servo.accel * remaining )
+    speed = faster;
+  else if( (unsigned long)speed * (speed + servo.accel) > 2UL * servo.accel * remaining )
+    speed = speed > servo.accel ? speed - servo.accel : servo.accel;
+  if( speed > remaining )
+    speed = remaining;
+
+  servo.speed = speed;
+  servo.ticks = ticks < target ? ticks + speed : ticks - speed;
+}
+
 static inline void handle_interrupts(timer16_Sequence_t timer, volatile uint16_t *TCNTn, volatile uint16_t* OCRnA)
 {
-  if( Channel[timer] < 0 )
+  if( Channel[timer] < 0 ) {
     *TCNTn = 0; // channel set to -1 indicated that refresh interval completed so reset the timer
+    for( uint8_t channel = 0; channel < SERVOS_PER_TIMER && SERVO_INDEX(timer,channel) < ServoCount; channel++ ) {
+      if( SERVO(timer,channel).Pin.isActive == true )
+        step_profile(SERVO(timer,channel));
+    }
+  }
   else{
     if( SERVO_INDEX(timer,Channel[timer]) < ServoCount && SERVO(timer,Channel[timer]).Pin.isActive == true )
       digitalWrite( SERVO(timer,Channel[timer]).Pin.nbr,LOW); // pulse this channel low if activated
@@ -202,7 +232,28 @@ static void finISR(timer16_Sequence_t timer)
     timerDetach(TIMER3OUTCOMPAREA_INT);
   }
 #else
-  //For Arduino - in future: call here to a currently undefined function to reset the timer
+  // stop the compare interrupt so an all-detached timer costs no ISR time; initISR() re-enables it
+#if defined(_useTimer1)
+  if(timer == _timer1) {
+  #if defined(__AVR_ATmega8__)|| defined(__AVR_ATmega128__)
+    TIMSK &= ~_BV(OCIE1A);
+  #else
+    TIMSK1 &= ~_BV(OCIE1A);
+  #endif
+  }
+#endif
+#if defined(_useTimer3) && !defined(__AVR_ATmega128__)
+  if(timer == _timer3)
+    TIMSK3 &= ~_BV(OCIE3A);
+#endif
+#if defined(_useTimer4)
+  if(timer == _timer4)
+    TIMSK4 &= ~_BV(OCIE4A);
+#endif
+#if defined(_useTimer5)
+  if(timer == _timer5)
+    TIMSK5 &= ~_BV(OCIE5A);
+#endif
   (void) timer;  // squash "unused parameter 'timer' [-Wunused-parameter]" warning
 #endif
 }
@@ -225,6 +276,7 @@ Servo::Servo()
   if( ServoCount < MAX_SERVOS) {
     this->servoIndex = ServoCount++;                    // assign a servo index to this instance
 	servos[this->servoIndex].ticks = usToTicks(DEFAULT_PULSE_WIDTH);   // store default values  - 12 Aug 2009
+    servos[this->servoIndex].target = servos[this->servoIndex].ticks;
   }
   else
     this->servoIndex = INVALID_SERVO ;  // too many servos
@@ -272,27 +324,71 @@ void Servo::write(int value)
   this->writeMicroseconds(value);
 }
 
+unsigned int Servo::toTicks(int value)
+{
+  if( value < SERVO_MIN() )          // ensure pulse width is valid
+    value = SERVO_MIN();
+  else if( value > SERVO_MAX() )
+    value = SERVO_MAX();
+
+  value = value - TRIM_DURATION;
+  return usToTicks(value);  // convert to ticks after compensating for interrupt overhead - 12 Aug 2009
+}
+
 void Servo::writeMicroseconds(int value)
 {
   // calculate and store the values for the given channel
   byte channel = this->servoIndex;
   if( (channel < MAX_SERVOS) )   // ensure channel is valid
   {
-    if( value < SERVO_MIN() )          // ensure pulse width is valid
-      value = SERVO_MIN();
-    else if( value > SERVO_MAX() )
-      value = SERVO_MAX();
-
-    value = value - TRIM_DURATION;
-    value = usToTicks(value);  // convert to ticks after compensating for interrupt overhead - 12 Aug 2009
+    unsigned int ticks = toTicks(value);
 
     uint8_t oldSREG = SREG;
     cli();
-    servos[channel].ticks = value;
+    servos[channel].ticks = ticks;
+    servos[channel].target = ticks;  // cancels any running profile
+    servos[channel].speed = 0;
     SREG = oldSREG;
   }
 }
 
+void Servo::moveTo(int value, unsigned int maxSpeed, unsigned int accel)
+{
+  byte channel = this->servoIndex;
+  if( channel >= MAX_SERVOS )
+    return;
+  if( accel == 0 || maxSpeed == 0 ) {
+    this->write(value);
+    return;
+  }
+
+  if(value < MIN_PULSE_WIDTH)
+  {  // angle, as in write()
+    if(value < 0) value = 0;
+    if(value > 180) value = 180;
+    value = map(value, 0, 180, SERVO_MIN(),  SERVO_MAX());
+  }
+  unsigned int ticks = toTicks(value);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  servos[channel].target = ticks;
+  servos[channel].maxSpeed = usToTicks(maxSpeed);
+  servos[channel].accel = usToTicks(accel);
+  SREG = oldSREG;
+}
+
+bool Servo::moving()
+{
+  if( this->servoIndex >= MAX_SERVOS )
+    return false;
+  uint8_t oldSREG = SREG;
+  cli();
+  bool busy = servos[this->servoIndex].ticks != servos[this->servoIndex].target;
+  SREG = oldSREG;
+  return busy;
+}
+
 int Servo::read() // return the value as degrees
 {
   return  map( this->readMicroseconds()+1, SERVO_MIN(), SERVO_MAX(), 0, 180);
@@ -0,0 +1,96 @@
+"""Static RAM report, run by PlatformIO after linking firmware.elf.
+
+Splits .data + .bss by subsystem (symbol name patterns below) and shows
+what is left of the 8 KB for the stack, plus the cost of one more entry in
+each schedule table. The runtime side, the painted-stack high-water mark,
+is reported by the firmware in the "mem" line of #STATS#.
+"""
+import re
+import subprocess
+
+Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+
+RAM_SIZE = 8192
+
+# First match wins; anything else counts as "core/libs".
+SUBSYSTEMS = [
+    ("schedule", r"^(schedules|scheduleCount|groupedSchedules|groupedCount|slotHeader\w*|scheduleSlotFiles|"
+                 r"scheduleVersion|scheduleBaseLoaded|ungroupedCount|patchJournal|lastPatchReply|filestat|stringPool\w*|cacheWriter)$"),
+    ("upload", r"^(sectorBuffer|sectorFill|frameParser|framedUpload|uploadResume|uploadStats|lzDecoder|"
+               r"streaming\w*|receiv\w*|lastByteTime|startMarker|endMarker|statsMarker)$"),
+    ("display", r"^(tft|glyphCanvas|drawnUi|uploadSpinner|dispenseBar|notificationMessage|notificationStartTime|"
+                r"setupInstructions|currentMenuPage|lastMenuUpdate|uiRefreshPending|showNotification|"
+                r"serviceUi\(\)::lastUpdate|uiHoldSince)$"),
+    ("dispense", r"^(dispenseJob|servo\d|tubeMappings|fsr\w*|motorStates|waitingForDropButton|notifiedGroup|snooze\w*|doseHandledMinute)$"),
+    ("tube setup", r"^(setup\w*|currentTubeSetup|totalTubesNeeded|triggerSetupAfterBT)$"),
+    ("rtc", r"^(rtc|rtctime|rtcAlarmFlag|rtcReady|lastRtcRead|doseAlarmStale)$"),
+    ("sd", r"^(SD|file|sdSession|bootState)$"),
+    ("scheduler", r"^(task\w*|dropButton|button\w*|resetFlags)$"),
+    ("inventory", r"^inventory\w*$"),
+    ("event log", r"^(eventLog\w*|logMarker)$"),
+    ("profiler", r"^(profile\w*|statsReportLine|memoryStats|serviceMemory\(\)::\w+)$"),
+    ("log", r"^logOut$"),
+]
+
+# macro -> table symbol whose size scales with it
+RAISABLE = [("MAX_SCHEDULES", "schedules"), ("MAX_GROUPED", "groupedSchedules")]
+
+
+def tool(name):
+    return env.subst("$SIZETOOL").replace("size", name)  # noqa: F821
+
+
+def read_symbols(elf):
+    """{name: (section, size)} for .data/.bss objects"""
+    out = subprocess.run([tool("nm"), "-C", "-S", elf], capture_output=True, text=True, check=True).stdout
+    marks, objects = {}, []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) == 3:
+            marks[parts[2]] = int(parts[0], 16)
+        elif len(parts) == 4:
+            objects.append((int(parts[0], 16), int(parts[1], 16), parts[3]))
+
+    symbols = {}
+    for addr, size, name in objects:
+        if marks["__data_start"] <= addr < marks["__data_end"]:
+            symbols[name] = (".data", size)
+        elif marks["__bss_start"] <= addr < marks["__bss_end"]:
+            symbols[name] = (".bss", size)
+    return symbols
+
+
+def define_value(name):
+    for define in env.get("CPPDEFINES", []):  # noqa: F821
+        if isinstance(define, (list, tuple)) and define[0] == name:
+            return int(define[1])
+    source = open(env.subst("$PROJECT_SRC_DIR/main.cpp")).read()  # noqa: F821
+    match = re.search(rf"#define {name} (\d+)", source)
+    return int(match.group(1)) if match else None
+
+
+def memory_report(source, target, env):
+    symbols = read_symbols(str(target[0]))
+    groups = {}
+    for name, (section, size) in symbols.items():
+        group = next((g for g, pattern in SUBSYSTEMS if re.match(pattern, name)), "core/libs")
+        data, bss, members = groups.get(group, (0, 0, []))
+        groups[group] = (data + size, bss, members) if section == ".data" else (data, bss + size, members)
+        members.append((size, name))
+
+    total = sum(data + bss for data, bss, _ in groups.values())
+    print("\nStatic RAM by subsystem (.data + .bss):")
+    print(f"  {'subsystem':<12}{'.data':>7}{'.bss':>7}  largest")
+    for group, (data, bss, members) in sorted(groups.items(), key=lambda g: -(g[1][0] + g[1][1])):
+        largest = ", ".join(f"{name} {size}" for size, name in sorted(members, reverse=True)[:3])
+        print(f"  {group:<12}{data:>7}{bss:>7}  {largest}")
+    print(f"  {'total':<12}{total:>14}  of {RAM_SIZE}, {RAM_SIZE - total} left for stack and heap")
+
+    for macro, name in RAISABLE:
+        count = define_value(macro)
+        if name in symbols and count:
+            print(f"  {macro}={count}: {symbols[name][1] // count} bytes per entry")
+    print("  Runtime stack peak: send #STATS# and read the mem line.\n")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", memory_report)  # noqa: F821
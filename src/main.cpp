@@ -5,8 +5,11 @@
 #include <Adafruit_ST7789.h>
 #include <Servo.h>
 #include <RTClib.h>
-#include <ArduinoJson.h>
 #include <StreamUtils.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include <EEPROM.h>
 
 #define SD_CS 11
 #define TFT_CS 10
@@ -18,13 +21,348 @@
 #define MOTOR_4 28
 #define DROP_BTN 30
 #define FSR_PIN A4
-
-#define MAX_SCHEDULES 12 
-#define MAX_GROUPED 12  
+#define RTC_INT_PIN 2  // DS3231 INT/SQW, open drain, active low
+
+// Table sizes only; the streaming JSON parser itself has no document cap.
+#ifndef MAX_SCHEDULES
+#define MAX_SCHEDULES 32
+#endif
+#ifndef MAX_GROUPED
+#define MAX_GROUPED 24
+#endif
+#ifndef MAX_MEDS_PER_TIME
 #define MAX_MEDS_PER_TIME 3 
-#define TEMP_BUFFER_SIZE 64 
+#endif
+#ifndef STRING_POOL_SIZE
+#define STRING_POOL_SIZE 256  // medication and dosage text, see internString()
+#endif
+
+#define RTC_FALLBACK_POLL_MS 61000UL  // re-read the RTC if no alarm arrived
+#define UI_ACTIVE_REFRESH_MS 250UL    // notification/setup screens animate
+#define SNOOZE_MS 600000UL            // long press brings a reminder back this much later
+
+#define JSON_KEY_SIZE 16
+#define JSON_VALUE_SIZE 24
+#define SD_SECTOR_SIZE 512
+
+// Framed upload protocol (see handleFrame()). Frames are
+//   FRAME_SOF, type, seq, len, payload[len], crc16 (LE) over type..payload
+// The window is sized so FRAME_WINDOW full frames fit in the Serial1 RX
+// ring, so a sender that respects it can never overrun the receiver.
+#define FRAME_SOF 0xA5
+#define FRAME_MAX_PAYLOAD 48
+#define FRAME_WINDOW 4
+#define FRAME_BEGIN 0x01      // host: u32 length, u16 content crc, [u8 UploadEncoding]
+#define FRAME_DATA 0x02       // host: payload bytes, in seq order
+#define FRAME_END 0x03        // host: no payload
+#define FRAME_PATCH 0x04      // host: one schedule edit, see decodeSchedulePatch()
+#define FRAME_BEGIN_ACK 0x81  // device: u32 resume offset, u8 window, u8 max payload
+#define FRAME_ACK 0x82        // device: seq = next expected, u32 bytes received
+#define FRAME_END_ACK 0x83    // device: u8 UploadStatus
+#define FRAME_PATCH_ACK 0x84  // device: seq echoed, u8 UploadStatus
+#define FRAME_LOG_DATA 0x85   // device: whole DoseEvent records, oldest first
+#define FRAME_LOG_END 0x86    // device: u16 records sent, u32 next event seq
+#define FRAME_GAP_MS 250     // a pause this long inside a frame drops it
+#define UPLOAD_IDLE_TIMEOUT_MS 5000
+#define LZ_MIN_MATCH 3
+#define LZ_DISTANCE_BITS 9  // window = SD_SECTOR_SIZE, see LzDecoder
+#define UPLOAD_LEGACY_TIMEOUT_MS 20000  // #START#/#END# uploads only
+
+#define SCHEDULE_SLOT_FILE "data.slot"
+#define SCHEDULE_LEGACY_FILE "data.json"
+#define SCHEDULE_SLOT_MAGIC 0x4C53444DUL  // "MDSL"
+#define SCHEDULE_IMAGE_FILE "data.bin"
+#define SCHEDULE_IMAGE_MAGIC 0x4253444DUL  // "MDSB"
+#define SCHEDULE_IMAGE_VERSION 2
+#define SCHEDULE_PATCH_FILE "data.pat"
+#define SCHEDULE_PATCH_MAGIC 0x5053444DUL  // "MDSP"
+#define SCHEDULE_PATCH_MAX 16  // journalled edits before a full upload is required
+
+// Dose event log, a ring of DoseEvent records in a file that is allocated
+// once and then only overwritten in place (see flushEventLog()).
+#define EVENT_LOG_FILE "events.log"
+#ifndef EVENT_LOG_SECTORS
+#define EVENT_LOG_SECTORS 64  // 2048 events, months at four doses a day
+#endif
+#ifndef EVENT_LOG_BUFFERED
+#define EVENT_LOG_BUFFERED 8  // events held in RAM between card writes
+#endif
+#define EVENT_LOG_FLUSH_MS 600000UL  // longest an event waits in RAM
+
+// Log levels. Messages above LOG_LEVEL are compiled out completely,
+// arguments and flash strings included. Build with -D LOG_LEVEL=... to
+// change; LOG_LEVEL_TRACE also echoes every received Serial1 byte.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Default servo positions; the per-tube values live in EEPROM (see
+// loadCalibration()). Standby differs per unit, so it is per tube too.
+#define SERVO_STANDBY_POS 91
+#define SERVO_OPEN_POS 45
+#define SERVO_CLOSE_POS 135
+#define SERVO_MOVE_MS 600       // minimum time at the open/close position
+#define SERVO_MAX_SPEED_US 50   // profile cruise speed, us per 20 ms refresh
+#define SERVO_ACCEL_US 10       // profile acceleration, us per refresh per refresh
+#define SERVO_DETACH_MS 1000    // idle time before a servo stops being pulsed
+
+#define CALIBRATION_EEPROM_ADDR 0
+#define CALIBRATION_MAGIC 0x4C43  // "CL"
+#define CALIBRATION_VERSION 1
+#define DISPENSE_SETTLE_MS 500
+#define DISPENSE_TIMEOUT_MS 10000
+
+// Tubes in a dose group run as parallel channels. Servo swings overlap
+// freely, but only one channel at a time holds the drop window (motor on,
+// FSR armed) so every weight step belongs to exactly one tube. Loads are in
+// arbitrary current units against a shared supply budget.
+#ifndef DISPENSE_MAX_ACTIVE
+#define DISPENSE_MAX_ACTIVE MAX_MEDS_PER_TIME  // 1 = one tube at a time
+#endif
+#define DISPENSE_SERVO_LOAD 1
+#define DISPENSE_MOTOR_LOAD 2
+#ifndef DISPENSE_LOAD_BUDGET
+#define DISPENSE_LOAD_BUDGET 3
+#endif
+#define FSR_SAMPLE_MS 100            // weight trace interval (LOG_LEVEL_DEBUG)
+#define DISPENSE_TARGET_GRAMS 5.0
+
+// FSR sampler: the ADC free-runs on FSR_PIN at 125 kHz / 13 (~9.6 kHz).
+// FSR_OVERSAMPLE conversions are summed into one ring entry (~1.7 ms) and
+// the last FSR_RING_SIZE entries form the moving average, so the filtered
+// value is raw counts * FSR_FILTER_SCALE over a ~13 ms window.
+#define FSR_ADC_CHANNEL 4      // A4
+#define FSR_OVERSAMPLE 16
+#define FSR_RING_SIZE 8        // power of two
+#define FSR_FILTER_SCALE (FSR_OVERSAMPLE * FSR_RING_SIZE)
+#define FSR_CONFIRM_SAMPLES 3  // ring entries over threshold before tripping
+#define FSR_DEFAULT_CAL_Q8 385 // ADC counts per gram in Q8 (1.5048)
 
 Adafruit_ST7789 tft = Adafruit_ST7789(TFT_CS, TFT_DC, TFT_RST);
+
+// Log sink over the core Serial TX ring. Bytes that do not fit are dropped
+// and counted instead of blocking the caller until the 9600 baud UART
+// drains; the count is reported at the start of the next line with room.
+class LogStream : public Print {
+public:
+  unsigned long dropped = 0;
+
+  size_t write(uint8_t c) override {
+    if (Serial.availableForWrite() == 0) {
+      dropped++;
+      return 0;
+    }
+    return Serial.write(c);
+  }
+};
+
+LogStream logOut;
+
+struct LogHex {
+  unsigned long value;
+};
+
+inline void logArg(const LogHex &hex) { logOut.print(hex.value, HEX); }
+template <typename T>
+inline void logArg(const T &value) { logOut.print(value); }
+
+inline void logArgs() {}
+template <typename T, typename... Rest>
+inline void logArgs(const T &value, const Rest &... rest) {
+  logArg(value);
+  logArgs(rest...);
+}
+
+template <typename... Args>
+void logLine(const Args &... args) {
+  if (logOut.dropped && Serial.availableForWrite() >= 24) {
+    unsigned long dropped = logOut.dropped;
+    logOut.dropped = 0;
+    logArgs(F("(log dropped "), dropped, F(" bytes)\r\n"));
+  }
+  logArgs(args...);
+  logOut.println();
+}
+
+#define LOG_OFF(...) do {} while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logLine(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_OFF()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logLine(__VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_OFF()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logLine(__VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_OFF()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logLine(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_OFF()
+#endif
+// Loop and hot-path profiler, read back with #STATS# over Serial1 (see
+// serviceStatsReport()). Each section keeps a log2 histogram of its run
+// time: bucket 0 is < 32 us, bucket k is < 32 << k us and the last one is
+// open ended. A bucket about to saturate halves the whole histogram, so the
+// percentiles follow recent behaviour. Build with -D PROFILE_ENABLED=0 to
+// compile it out.
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+#define PROFILE_BUCKETS 12
+#define PROFILE_BUCKET0_SHIFT 5  // bucket 0 = [0, 32) us
+#define STATS_LINE_MAX 62        // fits the 64 byte Serial1 TX ring
+
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64  // AVR core default
+#endif
+
+enum ProfileSectionId : uint8_t {
+  PROFILE_LOOP,      // loop() minus sleepUntilEvent()
+  PROFILE_RTC,       // serviceRtc()
+  PROFILE_INGEST,    // handleSerialIngest()
+  PROFILE_DISPENSE,  // updateDispensing()
+  PROFILE_UI,        // showMainMenu()
+  PROFILE_SD_WRITE,  // writeStreamingChunk()
+  PROFILE_SECTIONS
+};
+
+#if PROFILE_ENABLED
+struct ProfileSection {
+  uint32_t count;
+  uint32_t maxUs;
+  uint16_t buckets[PROFILE_BUCKETS];
+};
+
+struct ProfileCounters {
+  uint16_t rxPeak;       // most bytes found waiting in the Serial1 RX ring
+  uint16_t rxOverruns;   // drains that found the ring full, bytes may be lost
+  uint32_t framesDrawn;  // showMainMenu() passes
+};
+
+ProfileSection profileSections[PROFILE_SECTIONS];
+ProfileCounters profileCounters = {0, 0, 0};
+
+void profileRecord(uint8_t id, uint32_t us) {
+  ProfileSection &s = profileSections[id];
+  s.count++;
+  if (us > s.maxUs) s.maxUs = us;
+
+  uint8_t b = 0;
+  for (uint32_t v = us >> PROFILE_BUCKET0_SHIFT; v && b < PROFILE_BUCKETS - 1; v >>= 1) b++;
+  if (s.buckets[b] == 0xFFFF) {
+    for (uint8_t i = 0; i < PROFILE_BUCKETS; i++) s.buckets[i] >>= 1;
+  }
+  s.buckets[b]++;
+}
+
+void profileRxLevel(int pending) {
+  if (pending > (int)profileCounters.rxPeak) profileCounters.rxPeak = pending;
+  if (pending >= SERIAL_RX_BUFFER_SIZE - 1 && profileCounters.rxOverruns < 0xFFFF) {
+    profileCounters.rxOverruns++;
+  }
+}
+
+inline void profileFrameDrawn() { profileCounters.framesDrawn++; }
+
+// Times the enclosing block, early returns included.
+struct ProfileScope {
+  uint8_t id;
+  unsigned long start;
+  explicit ProfileScope(uint8_t section) : id(section), start(micros()) {}
+  ~ProfileScope() { profileRecord(id, micros() - start); }
+};
+
+#define PROFILE_SCOPE(id) ProfileScope profileScope(id)
+#else
+inline void profileRecord(uint8_t, uint32_t) {}
+inline void profileRxLevel(int) {}
+inline void profileFrameDrawn() {}
+#define PROFILE_SCOPE(id) LOG_OFF()
+#endif
+
+// Stack watermark. Before the C runtime copies .data, everything from the
+// end of .bss to RAMEND is painted with STACK_PAINT; the lowest byte that
+// lost the pattern is the deepest the stack has been. serviceMemory()
+// rescans the still-painted gap (about 1 ms per 4 KB) every MEMORY_CHECK_MS.
+#define STACK_PAINT 0xC5
+#define MEMORY_CHECK_MS 1000UL
+#define MEMORY_LOW_HEADROOM 256  // warn when the stack gets this close to the heap
+
+struct MemoryStats {
+  uint16_t staticBytes;  // .data + .bss
+  uint16_t heapBytes;    // malloc() high mark, normally 0
+  uint16_t stackPeak;    // deepest stack use since boot
+  uint16_t freeBytes;    // heap top to the stack pointer at the last check
+  uint16_t headroom;     // heap top to the stack low water, never touched
+};
+
+MemoryStats memoryStats = {0, 0, 0, 0, 0};
+
+#if defined(__AVR__)
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+void paintStack() __attribute__((naked, used, section(".init3")));
+void paintStack() {
+  for (uint8_t *p = &__heap_start; p <= (uint8_t *)RAMEND; p++) *p = STACK_PAINT;
+}
+
+// The watchdog stays armed across its own reset, so it is turned off before
+// setup() can overrun it; MCUSR says why the board restarted.
+uint8_t resetFlags __attribute__((section(".noinit")));
+
+void disableWatchdog() __attribute__((naked, used, section(".init3")));
+void disableWatchdog() {
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+bool watchdogReset() {
+  return resetFlags & _BV(WDRF);
+}
+
+// Runs every MEMORY_CHECK_MS from the task table.
+void serviceMemory() {
+  static uint8_t *stackLowWater = (uint8_t *)RAMEND + 1;
+
+  uint8_t *heapTop = __brkval ? (uint8_t *)__brkval : &__heap_start;
+  uint8_t *p = heapTop;
+  while (p < stackLowWater && *p == STACK_PAINT) p++;
+  stackLowWater = p;
+
+  bool wasLow = memoryStats.staticBytes && memoryStats.headroom < MEMORY_LOW_HEADROOM;
+  memoryStats.staticBytes = &__heap_start - (uint8_t *)RAMSTART;
+  memoryStats.heapBytes = heapTop - &__heap_start;
+  memoryStats.stackPeak = (uint8_t *)RAMEND + 1 - stackLowWater;
+  memoryStats.freeBytes = (uint8_t *)SP - heapTop;
+  memoryStats.headroom = stackLowWater - heapTop;
+  if (!wasLow && memoryStats.headroom < MEMORY_LOW_HEADROOM) {
+    LOG_WARN(F("Memory: stack came within "), memoryStats.headroom, F(" bytes of the heap")); // Using F() macro
+  }
+}
+#else
+void serviceMemory() {}  // host builds: no painted RAM to inspect
+inline bool watchdogReset() { return false; }
+#endif
+
 RTC_DS3231 rtc;
 SdFat SD;
 File file;
@@ -37,1190 +375,4283 @@ unsigned long lastByteTime = 0;
 File streamingFile;
 bool streamingActive = false;
 
+// Incremental matcher for the #START#/#END# framing markers. Bytes are fed
+// one at a time (KMP), so the receive buffer is never rescanned.
+struct MarkerMatcher {
+  const char *pattern;
+  uint8_t length;
+  uint8_t matched;
+  uint8_t fail[8];
+};
+
+MarkerMatcher startMarker = {"#START#", 7, 0, {0}};
+MarkerMatcher endMarker = {"#END#", 5, 0, {0}};
+MarkerMatcher statsMarker = {"#STATS#", 7, 0, {0}};
+MarkerMatcher logMarker = {"#LOG#", 5, 0, {0}};
+MarkerMatcher inventoryMarker = {"#INV#", 5, 0, {0}};
+
+// Payload bytes are collected into a whole SD sector before being written.
+uint8_t sectorBuffer[SD_SECTOR_SIZE];
+uint16_t sectorFill = 0;
+
+// Per-upload SD traffic, reset in startStreamingSave().
+struct UploadStats {
+  unsigned long bytesReceived;
+  unsigned long bytesToSD;
+  unsigned int sectorsWritten;
+  unsigned int syncs;
+};
+
+UploadStats uploadStats = {0, 0, 0, 0};
+
+enum FrameParseState : uint8_t {
+  FRAME_WAIT_SOF,
+  FRAME_READ_TYPE,
+  FRAME_READ_SEQ,
+  FRAME_READ_LEN,
+  FRAME_READ_PAYLOAD,
+  FRAME_READ_CRC_LO,
+  FRAME_READ_CRC_HI
+};
+
+enum FrameResult : uint8_t { FRAME_PENDING, FRAME_COMPLETE, FRAME_CORRUPT };
+
+struct FrameParser {
+  FrameParseState state;
+  uint8_t type;
+  uint8_t seq;
+  uint8_t len;
+  uint8_t pos;
+  uint16_t crc;  // running crc of type..payload
+  uint16_t received;
+  uint8_t payload[FRAME_MAX_PAYLOAD];
+};
+
+FrameParser frameParser = {FRAME_WAIT_SOF};
+
+enum UploadStatus : uint8_t {
+  UPLOAD_OK = 0,
+  UPLOAD_SAVE_FAILED = 1,
+  UPLOAD_BAD_CONTENT = 2,   // length or content crc mismatch
+  UPLOAD_BAD_SCHEDULE = 3,  // stored, but did not parse
+  UPLOAD_PATCH_MISMATCH = 4,  // patch does not fit the stored schedule
+  UPLOAD_PATCH_FULL = 5       // no room for the edit; send a full upload
+};
+
+// How the DATA bytes of a framed upload encode the schedule file.
+enum UploadEncoding : uint8_t {
+  UPLOAD_ENCODING_RAW = 0,
+  UPLOAD_ENCODING_LZ = 1  // LZSS, decoded by lzFeed()
+};
+
+// LZSS decoder state. The stream is groups of a flag byte and up to eight
+// items, LSB first: flag 1 = a literal byte, flag 0 = a little-endian u16
+// (distance - 1) | (length - LZ_MIN_MATCH) << LZ_DISTANCE_BITS copying
+// from earlier output. The window is sectorBuffer itself: a flushed
+// sector is left in place, so the byte 'distance' back is always at
+// (sectorFill - distance) mod SD_SECTOR_SIZE and decoding needs no extra RAM.
+enum LzState : uint8_t { LZ_READ_FLAGS, LZ_READ_ITEM, LZ_READ_MATCH_HI };
+
+struct LzDecoder {
+  LzState state;
+  uint8_t flags;
+  uint8_t flagsLeft;
+  uint8_t matchLo;
+  bool error;       // a match reached before the start of the output
+  uint32_t output;  // decoded bytes so far
+};
+
+LzDecoder lzDecoder = {LZ_READ_FLAGS, 0, 0, 0, false, 0};
+
+// Framed upload in progress. expectedSeq counts frames from the resume
+// point, offset counts (encoded) bytes from the start of the stream.
+struct FramedUpload {
+  bool active;
+  UploadEncoding encoding;
+  uint32_t length;
+  uint16_t contentCrc;
+  uint32_t offset;
+  uint16_t runningCrc;  // crc of bytes [0, offset)
+  uint8_t expectedSeq;
+  int8_t lastStatus;    // repeated if the END_ACK is lost, -1 = none
+};
+
+FramedUpload framedUpload = {false, UPLOAD_ENCODING_RAW, 0, 0, 0, 0, 0, -1};
+
+// Left behind by an aborted framed upload: the partial file on the inactive
+// slot is kept and a BEGIN for the same length/crc continues from offset.
+struct UploadResume {
+  bool valid;
+  uint32_t length;
+  uint16_t contentCrc;
+  uint32_t offset;
+  uint16_t runningCrc;
+  uint8_t slot;
+};
+
+UploadResume uploadResume = {false, 0, 0, 0, 0, 0};
+
+// Reply to the last PATCH frame, repeated if the sender retries it because
+// the PATCH_ACK was lost. Matched on seq and frame crc.
+struct PatchReply {
+  uint8_t seq;
+  uint16_t crc;
+  int8_t status;  // -1 = none yet
+};
+
+PatchReply lastPatchReply = {0, 0, -1};
+
 char notificationMessage[200] = "";
 unsigned long notificationStartTime = 0;
-volatile bool sdBusy = false;
 DateTime rtctime;
 
+// Set from the DS3231 INT/SQW interrupt. Alarm 1 is the next dose, alarm 2
+// fires every minute for the clock; loop() reads the RTC only after one.
+volatile bool rtcAlarmFlag = false;
+bool rtcReady = false;
+bool doseAlarmStale = true;
+unsigned long lastRtcRead = 0;
+bool uiRefreshPending = true;
+
+enum UiScreen : uint8_t {
+  UI_SCREEN_NONE,  // display contents unknown, next refresh redraws all
+  UI_SCREEN_MAIN,
+  UI_SCREEN_NO_DATA,
+  UI_SCREEN_NOTIFICATION,
+  UI_SCREEN_SETUP,
+  UI_SCREEN_UPLOAD
+};
+
+// What is currently on the display. showMainMenu() compares it with the
+// live state and repaints only the fields that differ; -1 means "not drawn".
+struct UiModel {
+  UiScreen screen;
+  int16_t clockMinute;
+  uint8_t day;
+  int8_t status;
+  int8_t nextIndex;
+  uint8_t scheduleVersion;
+  int16_t countdown;
+  int8_t progress;
+  int8_t blink;
+  int16_t stockDays;
+  int8_t lowMask;
+};
+
+UiModel drawnUi = {UI_SCREEN_NONE, -1, 0, -1, -1, 0, -1, -1, -1, -1, -1};
+uint8_t scheduleVersion = 0;  // bumped when groupedSchedules[] changes
+
+struct SdSession {
+  bool mounted;
+  unsigned int mounts;
+  unsigned int errors;
+};
+
+SdSession sdSession = {false, 0, 0};
+
+// The half of startup that waits for the card. setup() runs from the
+// EEPROM schedule cache; serviceBoot() then mounts the card and re-reads
+// the schedule from it, retrying without blocking the loop.
+#define BOOT_SD_RETRY_MS 200
+#define BOOT_SD_FAST_RETRIES 5
+#define BOOT_SD_SLOW_RETRY_MS 5000UL
+
+struct BootState {
+  bool sdPending;
+  uint8_t attempts;
+  unsigned long lastTry;
+};
+
+BootState bootState = {true, 0, 0};
+
+// Schedules are kept in two slot files. Uploads always go to the inactive
+// slot; the tiny pointer file in SCHEDULE_SLOT_FILE names the live one and
+// is rewritten in place (one sector) to commit an upload.
+const char *const scheduleSlotFiles[2] = {"data_a.json", "data_b.json"};
+
+struct ScheduleSlotHeader {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t length;
+  uint8_t active;
+  uint8_t reserved;
+  uint16_t crc;
+};
+
+ScheduleSlotHeader slotHeader = {0, 0, 0, 0, 0, 0};
+bool slotHeaderValid = false;
+uint8_t streamingSlot = 0;
+
 int currentMenuPage = 0;
 unsigned long lastMenuUpdate = 0;
 bool showNotification = false;
 bool motorStates[4] = {false, false, false, false};
 
+// Per-tube calibration, stored in EEPROM as part of CalibrationRecord.
+struct TubeCalibration {
+  uint8_t standbyPos;
+  uint8_t openPos;
+  uint8_t closePos;
+  uint16_t fsrCalQ8;  // FSR counts per gram for this tube's pills, Q8
+};
+
 struct TubeMapping {
   char tubeName[8];  // Fixed size instead of String
   int servoIndex;
   int motorPin;
   Servo *servo;
+  uint8_t servoPin;
+  TubeCalibration cal;
+  unsigned long servoIdleSince;  // 0 while moving or detached
 };
 
 TubeMapping tubeMappings[4] = {
-    {"tube1", 0, MOTOR_1, &servo1},
-    {"tube2", 1, MOTOR_2, &servo2},
-    {"tube3", 2, MOTOR_3, &servo3},
-    {"tube4", 3, MOTOR_4, &servo4}
+    {"tube1", 0, MOTOR_1, &servo1, A0, {91, SERVO_OPEN_POS, SERVO_CLOSE_POS, FSR_DEFAULT_CAL_Q8}, 0},
+    {"tube2", 1, MOTOR_2, &servo2, A1, {91, SERVO_OPEN_POS, SERVO_CLOSE_POS, FSR_DEFAULT_CAL_Q8}, 0},
+    {"tube3", 2, MOTOR_3, &servo3, A2, {90, SERVO_OPEN_POS, SERVO_CLOSE_POS, FSR_DEFAULT_CAL_Q8}, 0},
+    {"tube4", 3, MOTOR_4, &servo4, A3, {90, SERVO_OPEN_POS, SERVO_CLOSE_POS, FSR_DEFAULT_CAL_Q8}, 0}
 };
 
+struct CalibrationRecord {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t count;
+  TubeCalibration tubes[4];
+  uint16_t crc;  // CRC16 of everything above
+};
+
+// Interned schedule strings. Each distinct medication or dosage text is
+// stored once, NUL terminated, and records refer to it by its offset, so
+// offset 0 is always "". The pool is rebuilt whenever schedules[] is
+// loaded; text left unused by patches stays until then.
+static_assert(STRING_POOL_SIZE <= 256, "string ids are 8-bit pool offsets");
+
+char stringPool[STRING_POOL_SIZE];
+uint16_t stringPoolUsed = 1;
+
+void resetStringPool() {
+  stringPool[0] = '\0';
+  stringPoolUsed = 1;
+}
+
+// Finds or appends s. False if the pool has no room for it.
+bool internString(const char *s, uint8_t &id) {
+  for (uint16_t i = 0; i < stringPoolUsed; i += strlen(stringPool + i) + 1) {
+    if (strcmp(stringPool + i, s) == 0) {
+      id = i;
+      return true;
+    }
+  }
+  size_t len = strlen(s);
+  if (stringPoolUsed + len + 1 > STRING_POOL_SIZE) return false;
+  memcpy(stringPool + stringPoolUsed, s, len + 1);
+  id = stringPoolUsed;
+  stringPoolUsed += len + 1;
+  return true;
+}
+
+inline const char *poolString(uint8_t id) {
+  return stringPool + id;
+}
+
+// Also the on-card record layout of SCHEDULE_IMAGE_FILE (see
+// loadScheduleImage()), so keep it packed and free of pointers.
 struct MedicationTime {
-  char time[6];   
-  char dosage[16]; 
-  char medication[24];
-  char tube[8];      
-  int amount;
+  uint16_t minutes;    // minutes since midnight
+  int16_t amount;
+  uint8_t medication;  // stringPool offsets
+  uint8_t dosage;
+  uint8_t tube;        // tubeMappings[] index, resolved when parsed
 };
 
 MedicationTime schedules[MAX_SCHEDULES]; 
 int scheduleCount = 0;
 
+bool scheduleBaseLoaded = false;  // schedules[] holds a parsed slot file or its image
+
+// A dose time and the schedules[] entries due at it. Members are indices
+// rather than copies of the strings.
 struct GroupedMedication {
-  char time[6];               
-  char medications[MAX_MEDS_PER_TIME][24];
-  char dosages[MAX_MEDS_PER_TIME][16];
-  char tubes[MAX_MEDS_PER_TIME][8];
-  int amounts[MAX_MEDS_PER_TIME];
-  int count;
+  uint16_t minutes;           // sort key, minutes since midnight
+  uint8_t members[MAX_MEDS_PER_TIME];
+  uint8_t count;
 };
 
+static_assert(MAX_SCHEDULES <= 255, "GroupedMedication members are 8-bit indices");
+
+// Kept sorted by minutes so due/next lookups are a binary search.
 GroupedMedication groupedSchedules[MAX_GROUPED];
 int groupedCount = 0;
+int ungroupedCount = 0;  // schedules[] entries with no room in groupedSchedules[]
+int notifiedGroup = -1;  // group notificationMessage was built for
+int snoozedGroup = -1;   // group to remind again SNOOZE_MS after snoozeStart
+unsigned long snoozeStart = 0;
+int16_t doseHandledMinute = -1;  // minute whose dose was dispensed, skipped or snoozed
 
 bool setupMode = false;
 int currentTubeSetup = 0;
 int totalTubesNeeded = 0;
+uint8_t setupTubes[4];       // tubeMappings[] index per setup step
+uint8_t setupSchedules[4];   // first schedules[] entry using that tube
 char setupInstructions[200];
 bool waitingForDropButton = false;
 
 static bool triggerSetupAfterBT = false;
+uint8_t setupTubeMask = 0;  // tubes (bit per tubeMappings[] entry) the next setup covers
+
+enum DispenseState {
+  DISPENSE_IDLE,          // channel not started
+  DISPENSE_SERVO_OPEN,    // servo swung to open position
+  DISPENSE_READY,         // open, waiting for the drop window
+  DISPENSE_SETTLE,        // window held; wait for the last drop to land
+  DISPENSE_MOTOR_RUN,     // start the tube motor once the budget allows
+  DISPENSE_WEIGHT_WATCH,  // wait for the FSR ISR to trip, or timeout
+  DISPENSE_MOTOR_STOP,    // motor off, window released, wait before closing
+  DISPENSE_SERVO_CLOSE,   // servo swung to close position
+  DISPENSE_DONE
+};
 
-void openServo(Servo &servo, int standbyPos = 91, int openPos = 45) {
-  Serial.println(F("Opening servo"));
-  servo.write(openPos);
-  delay(600);
-  servo.write(standbyPos);
-}
-
-void closeServo(Servo &servo, int standbyPos = 91, int closePos = 135) {
-  Serial.println(F("Closing servo"));
-  servo.write(closePos);
-  delay(600);
-  servo.write(standbyPos);
-}
-
-void triggerMotor(int motorPin, bool turnOn) {
-  if (turnOn) {
-    Serial.print(F("Starting motor on pin "));
-    Serial.println(motorPin);
-    digitalWrite(motorPin, HIGH);
-  } else {
-    Serial.print(F("Stopping motor on pin "));
-    Serial.println(motorPin);
-    digitalWrite(motorPin, LOW);
-  }
-}
+struct DispenseChannel {
+  DispenseState state;
+  unsigned long stateStart;
+  TubeMapping *tube;
+  uint8_t pills;  // taken from the tube's stock once the drop is confirmed
+};
 
-TubeMapping *getTubeMapping(const char* tubeName) {
-  for (int i = 0; i < 4; i++) {
-    if (strcmp(tubeMappings[i].tubeName, tubeName) == 0) {
-      return &tubeMappings[i];
-    }
-  }
-  return nullptr;
-}
+struct DispenseJob {
+  bool active;
+  DispenseChannel channels[MAX_MEDS_PER_TIME];
+  int count;
+  int current;    // channel that holds, or is next for, the drop window
+  int finished;   // channels in DISPENSE_DONE
+  uint8_t load;   // sum of running servo/motor loads
+  unsigned long windowFree;  // when the previous drop window was released
+  unsigned long lastSample;
+};
 
-inline bool acquireSD() {
-  digitalWrite(TFT_CS, HIGH);
-  delayMicroseconds(5);
-  return SD.begin(SD_CS);
-}
+DispenseJob dispenseJob = {false, {}, 0, 0, 0, 0, 0, 0};
 
-void dispenseFromTube(const char* tubeName) {
-  TubeMapping *mapping = getTubeMapping(tubeName);
-  if (mapping == nullptr) {
-    Serial.print(F("Unknown tube: "));
-    Serial.println(tubeName);
-    return;
-  }
+enum DoseOutcome : uint8_t {
+  DOSE_DISPENSED = 0,  // the FSR saw the target weight
+  DOSE_TIMEOUT = 1,    // DISPENSE_TIMEOUT_MS passed first
+  DOSE_SKIPPED = 2,    // double press on the reminder; nothing dispensed
+  DOSE_SNOOZED = 3     // long press; reminded again after SNOOZE_MS
+};
 
-  Serial.print(F("Dispensing from "));
-  Serial.println(tubeName);
+// One dispense, as stored in EVENT_LOG_FILE and sent by #LOG#. seq counts
+// from 1 and never repeats, which is how the newest record is found again
+// after a restart.
+struct DoseEvent {
+  uint32_t seq;
+  uint32_t time;        // RTC unixtime when the motor stopped
+  int16_t weightCg;     // FSR weight change, 1/100 g
+  uint16_t dispenseMs;  // motor run time
+  uint8_t tube;         // tubeMappings[] index
+  uint8_t outcome;      // DoseOutcome
+  uint16_t crc;
+};
 
-  float initialWeight = (analogRead(FSR_PIN) /1.504761904761905);
-  Serial.print(F("Initial weight: "));
-  Serial.print(initialWeight, 1);
-  Serial.println(F(" g"));
+#define EVENT_LOG_RECORDS (EVENT_LOG_SECTORS * (SD_SECTOR_SIZE / sizeof(DoseEvent)))
+#define EVENT_LOG_BYTES ((uint32_t)EVENT_LOG_SECTORS * SD_SECTOR_SIZE)
 
-  openServo(*mapping->servo);
-  delay(500);
+static_assert(sizeof(DoseEvent) == 16, "DoseEvent is a 16 byte wire and file record");
+static_assert(EVENT_LOG_RECORDS <= 65535, "ring index is 16-bit");
 
-  triggerMotor(mapping->motorPin, true);
-  motorStates[mapping->servoIndex] = true;
+// Events not yet on the card; seq and crc are filled in when written.
+struct EventLog {
+  bool ready;            // head and nextSeq have been read from the card
+  uint16_t head;         // ring record the next event goes to
+  uint32_t nextSeq;
+  uint8_t pending;
+  unsigned long firstPending;
+  DoseEvent buffer[EVENT_LOG_BUFFERED];
+};
 
-  unsigned long startTime = millis();
-  bool dispensingComplete = false;
+EventLog eventLog = {false, 0, 1, 0, 0};
 
-  while (!dispensingComplete && (millis() - startTime < 10000)) {
-    float currentWeight = (analogRead(FSR_PIN) / 1.504761904761905);
-    float weightIncrease = currentWeight - initialWeight;
+// #LOG# reply in progress: the whole ring is read once, starting at the
+// head (the oldest record once it has wrapped), and the valid records sent.
+struct EventLogDump {
+  bool active;
+  uint16_t pos;
+  uint16_t left;  // ring records still to read
+  uint16_t sent;
+  uint8_t seq;
+};
 
-    Serial.print(F("Current weight: "));
-    Serial.print(currentWeight, 1);
-    Serial.print(F(" g, Increase: "));
-    Serial.print(weightIncrease, 1);
-    Serial.println(F(" g"));
+EventLogDump eventLogDump = {false, 0, 0, 0, 0};
+File eventLogFile;  // open while a dump runs
 
-    if (weightIncrease >= 5.0) {
-      dispensingComplete = true;
-      Serial.println(F("Target weight reached!"));
-    }
-    delay(100);
+void recordDoseEvent(uint8_t tube, uint8_t outcome, float grams, unsigned long ms) {
+  if (eventLog.pending == EVENT_LOG_BUFFERED) {
+    LOG_WARN(F("Event log: buffer full, event dropped")); // Using F() macro
+    return;
+  }
+  if (eventLog.pending == 0) eventLog.firstPending = millis();
+
+  DoseEvent &e = eventLog.buffer[eventLog.pending++];
+  e.time = rtcReady ? rtc.now().unixtime() : 0;
+  e.weightCg = constrain(grams * 100.0, -32767.0, 32767.0);
+  e.dispenseMs = ms < 65535 ? ms : 65535;
+  e.tube = tube;
+  e.outcome = outcome;
+  if (eventLog.pending == EVENT_LOG_BUFFERED) {
+    eventLog.firstPending = millis() - EVENT_LOG_FLUSH_MS;  // due now
   }
+}
 
-  triggerMotor(mapping->motorPin, false);
-  motorStates[mapping->servoIndex] = false;
+// Pills left in each tube. Stock is set when a tube is loaded through tube
+// setup (the medication's "amount") and goes down on every confirmed drop;
+// dailyPills is kept up to date by the schedule index functions, so days
+// left is one division per tube. Persisted by serviceInventory().
+#ifndef LOW_STOCK_DAYS
+#define LOW_STOCK_DAYS 3  // warn once a tube covers this many days or fewer
+#endif
+#define INVENTORY_UNKNOWN 0xFFFF  // tube not loaded through tube setup yet
+
+struct Inventory {
+  uint16_t stock[4];
+  uint16_t dailyPills[4];
+  int16_t minDays;    // fewest days any scheduled tube covers, -1 = unknown
+  uint8_t lowMask;    // bit per tube at or under LOW_STOCK_DAYS
+  bool dirty;         // stock changed since the last EEPROM record
+  bool reportPending; // #INV# line to send
+};
 
-  delay(500);
-  closeServo(*mapping->servo);
+Inventory inventory = {{INVENTORY_UNKNOWN, INVENTORY_UNKNOWN, INVENTORY_UNKNOWN, INVENTORY_UNKNOWN},
+                       {0, 0, 0, 0}, -1, 0, false, false};
 
-  Serial.print(F("Dispensing complete for "));
-  Serial.println(tubeName);
+// Leading number of the dosage text ("2 caps"), 1 if there is none.
+uint8_t pillsPerDose(const MedicationTime &med) {
+  int n = atoi(poolString(med.dosage));
+  return n > 0 && n < 256 ? n : 1;
 }
 
-void handleDispensing() {
-  Serial.println(F("DROP button pressed - starting dispensing sequence"));
-
-  char currentTime[6];
-  sprintf(currentTime, "%02d:%02d", rtctime.hour(), rtctime.minute());
+// Days the tube's stock covers, -1 if its stock is unknown or it has no doses.
+int16_t tubeDaysLeft(uint8_t tube) {
+  if (inventory.stock[tube] == INVENTORY_UNKNOWN || inventory.dailyPills[tube] == 0) return -1;
+  return inventory.stock[tube] / inventory.dailyPills[tube];
+}
 
-  GroupedMedication *currentGroup = nullptr;
-  for (int i = 0; i < groupedCount; i++) {
-    if (strcmp(groupedSchedules[i].time, currentTime) == 0) { // Using strcmp
-      currentGroup = &groupedSchedules[i];
-      break;
-    }
+void updateStockStatus() {
+  uint8_t lowMask = 0;
+  int16_t minDays = -1;
+  for (uint8_t t = 0; t < 4; t++) {
+    int16_t days = tubeDaysLeft(t);
+    if (days < 0) continue;
+    if (minDays < 0 || days < minDays) minDays = days;
+    if (days <= LOW_STOCK_DAYS) lowMask |= 1 << t;
   }
-
-  if (currentGroup == nullptr) {
-    Serial.println(F("No medications scheduled for current time"));
-    return;
+  if (lowMask & ~inventory.lowMask) {
+    LOG_WARN(F("Low stock, tube mask 0x"), LogHex{lowMask}, F(", "), minDays, F(" days left")); // Using F() macro
+  }
+  if (lowMask != inventory.lowMask || minDays != inventory.minDays) {
+    inventory.reportPending = true;
   }
+  inventory.lowMask = lowMask;
+  inventory.minDays = minDays;
+}
 
-  for (int i = 0; i < currentGroup->count; i++) {
-    Serial.print(F("Dispensing medication "));
-    Serial.print(i + 1);
-    Serial.print(F(" of "));
-    Serial.print(currentGroup->count);
-    Serial.print(F(": "));
-    Serial.println(currentGroup->medications[i]);
+// Called by the schedule index functions for every dose they add (+1) or
+// remove (-1).
+void inventoryCountDose(const MedicationTime &med, int8_t sign) {
+  inventory.dailyPills[med.tube] += sign * pillsPerDose(med);
+}
 
-    dispenseFromTube(currentGroup->tubes[i]);
+void consumeStock(uint8_t tube, uint8_t pills) {
+  if (inventory.stock[tube] == INVENTORY_UNKNOWN) return;
+  inventory.stock[tube] = inventory.stock[tube] > pills ? inventory.stock[tube] - pills : 0;
+  inventory.dirty = true;
+  inventory.reportPending = true;
+  updateStockStatus();
+}
 
-    if (i < currentGroup->count - 1) {
-      Serial.println(F("Waiting before next tube..."));
-      delay(2000);
-    }
+void refillTube(uint8_t tube, uint16_t count) {
+  LOG_INFO(F("Tube "), tube + 1, F(" refilled with "), count); // Using F() macro
+  inventory.stock[tube] = count;
+  inventory.dirty = true;
+  inventory.reportPending = true;
+  updateStockStatus();
+}
+
+// Sampler state owned by ADC_vect.
+uint16_t fsrRing[FSR_RING_SIZE];
+uint8_t fsrHead = 0;
+uint8_t fsrOversampled = 0;
+uint8_t fsrOver = 0;  // consecutive entries over the threshold
+uint16_t fsrAccum = 0;
+
+// Shared with the main loop; multi-byte values are read in ATOMIC_BLOCKs.
+volatile uint8_t fsrPrimed = 0;      // ring entries filled since fsrStart()
+volatile uint32_t fsrSum = 0;        // moving-average numerator
+volatile uint32_t fsrTare = 0;
+volatile uint32_t fsrThreshold = 0;  // 0 = disarmed
+volatile bool fsrTripped = false;
+volatile uint8_t *fsrMotorPort = nullptr;
+uint8_t fsrMotorMask = 0;
+
+// Starts a profiled move, re-attaching the servo if it was idled. The move
+// itself runs from the Servo timer ISR.
+void moveServo(TubeMapping &tube, uint8_t angle) {
+  if (!tube.servo->attached()) {
+    tube.servo->attach(tube.servoPin);
   }
+  tube.servo->moveTo(angle, SERVO_MAX_SPEED_US, SERVO_ACCEL_US);
+  tube.servoIdleSince = 0;
+}
 
-  Serial.println(F("Dispensing sequence complete"));
-  showNotification = false;
+bool servoArrived(TubeMapping &tube) {
+  return !tube.servo->moving();
 }
 
-void drawLoadingBar(int progress, int x, int y, int width, int height) {
-  tft.drawRect(x, y, width, height, ST77XX_WHITE);
-  int fillWidth = (progress * (width - 2)) / 100;
-  if (fillWidth > 0) {
-    tft.fillRect(x + 1, y + 1, fillWidth, height - 2, ST77XX_GREEN);
-  }
+void openServo(TubeMapping &tube) {
+  LOG_DEBUG(F("Opening servo"));
+  moveServo(tube, tube.cal.openPos);
 }
 
-void drawSpinner(int x, int y, int radius, int angle) {
-  tft.fillCircle(x, y, radius + 2, ST77XX_BLACK);
-  
-  for (int i = 0; i < 8; i++) {
-    int segmentAngle = (angle + i * 45) % 360;
-    int brightness = 255 - (i * 30);
-    if (brightness < 50) brightness = 50;
+void closeServo(TubeMapping &tube) {
+  LOG_DEBUG(F("Closing servo"));
+  moveServo(tube, tube.cal.closePos);
+}
 
-    int x1 = x + (radius - 3) * cos(segmentAngle * PI / 180);
-    int y1 = y + (radius - 3) * sin(segmentAngle * PI / 180);
-    int x2 = x + radius * cos(segmentAngle * PI / 180);
-    int y2 = y + radius * sin(segmentAngle * PI / 180);
+// Detaches servos that have sat at their target for SERVO_DETACH_MS, so
+// they stop buzzing and the Servo ISR stops pulsing them.
+void serviceServos() {
+  for (int i = 0; i < 4; i++) {
+    TubeMapping &tube = tubeMappings[i];
+    if (!tube.servo->attached() || tube.servo->moving()) continue;
+
+    if (tube.servoIdleSince == 0) {
+      tube.servoIdleSince = millis() | 1;
+    } else if (millis() - tube.servoIdleSince >= SERVO_DETACH_MS) {
+      tube.servo->detach();
+      tube.servoIdleSince = 0;
+      LOG_DEBUG(F("Servo idle, detached: "), tube.tubeName);
+    }
+  }
+}
 
-    uint16_t color = tft.color565(brightness, brightness, brightness);
-    tft.drawLine(x1, y1, x2, y2, color);
-    tft.drawLine(x1 + 1, y1, x2 + 1, y2, color);
+void triggerMotor(int motorPin, bool turnOn) {
+  if (turnOn) {
+    LOG_DEBUG(F("Starting motor on pin "), motorPin);
+    digitalWrite(motorPin, HIGH);
+  } else {
+    LOG_DEBUG(F("Stopping motor on pin "), motorPin);
+    digitalWrite(motorPin, LOW);
   }
 }
 
-int findMatchingBrace(const String &str, int start) {
-  int braceCount = 0;
-  for (int i = start; i < str.length(); i++) {
-    if (str[i] == '{') braceCount++;
-    else if (str[i] == '}') {
-      braceCount--;
-      if (braceCount == 0) return i;
+TubeMapping *getTubeMapping(const char* tubeName) {
+  for (int i = 0; i < 4; i++) {
+    if (strcmp(tubeMappings[i].tubeName, tubeName) == 0) {
+      return &tubeMappings[i];
     }
   }
-  return -1;
+  return nullptr;
 }
 
-void animatedIntro() {
-  tft.fillScreen(ST77XX_BLACK);
-  tft.setRotation(3);
-  
-  tft.setTextSize(3);
-  tft.setTextColor(ST77XX_WHITE);
-  tft.setCursor(50, 100);
-  tft.println(F("MedDispenser"));
-  
-  tft.setTextSize(1);
-  tft.setCursor(80, 140);
-  tft.println(F("Initializing..."));
-  
-  delay(2000);
+// Mounts the card. Both SdFat and the ST7789 driver wrap every access in
+// an SPI transaction and drive their own chip select, so the bus can be
+// shared without re-initialising the card. SdFat gives a card up to 2 s
+// to finish init, so the watchdog is kicked on both sides of it.
+bool mountSD() {
+  wdt_reset();
+  sdSession.mounted = SD.begin(SdSpiConfig(SD_CS, SHARED_SPI, SD_SCK_MHZ(8)));
+  wdt_reset();
+  if (sdSession.mounted) {
+    sdSession.mounts++;
+  }
+  return sdSession.mounted;
 }
 
-void groupMedicationsByTime() {
-  groupedCount = 0;
+// Returns true when the volume is usable, re-mounting only after an error.
+bool acquireSD() {
+  if (sdSession.mounted) return true;
+  LOG_INFO(F("SD: re-mounting card")); // Using F() macro
+  return mountSD();
+}
 
-  for (int i = 0; i < scheduleCount; i++) {
-    int groupIndex = -1;
+// Called when an SD operation fails; the next acquireSD() will re-mount.
+void reportSDError(const __FlashStringHelper *where) {
+  LOG_ERROR(F("SD error in "), where, F(", code 0x"), LogHex{SD.sdErrorCode()}); // Using F() macro
+  sdSession.errors++;
+  sdSession.mounted = false;
+}
 
-    for (int j = 0; j < groupedCount; j++) {
-      if (strcmp(groupedSchedules[j].time, schedules[i].time) == 0) {
-        groupIndex = j;
-        break;
-      }
+// Pill-drop detection runs in the ISR: once FSR_CONFIRM_SAMPLES ring
+// entries in a row sit above tare + threshold the armed motor pin is
+// dropped directly, without waiting for the main loop.
+ISR(ADC_vect) {
+  fsrAccum += ADC;
+  if (++fsrOversampled < FSR_OVERSAMPLE) return;
+  fsrOversampled = 0;
+
+  uint16_t entry = fsrAccum;
+  fsrAccum = 0;
+  fsrSum += entry;
+  fsrSum -= fsrRing[fsrHead];
+  fsrRing[fsrHead] = entry;
+  fsrHead = (fsrHead + 1) & (FSR_RING_SIZE - 1);
+
+  if (fsrPrimed < FSR_RING_SIZE) {
+    fsrPrimed++;
+    return;
+  }
+  if (fsrThreshold == 0 || fsrTripped) return;
+
+  // Trip on individual entries, not the average, so one noisy burst
+  // cannot hold the result over the threshold for a whole window
+  if ((uint32_t)entry * FSR_RING_SIZE >= fsrTare + fsrThreshold) {
+    if (++fsrOver >= FSR_CONFIRM_SAMPLES) {
+      *fsrMotorPort &= ~fsrMotorMask;
+      fsrTripped = true;
     }
+  } else {
+    fsrOver = 0;
+  }
+}
 
-    if (groupIndex == -1) {
-      groupIndex = groupedCount;
-      strcpy(groupedSchedules[groupIndex].time, schedules[i].time); // Using strcpy
-      groupedSchedules[groupIndex].count = 0;
-      groupedCount++;
-    }
+// The sampler only runs while dispensing; its interrupt rate would keep
+// the CPU out of idle sleep otherwise.
+void fsrStart() {
+  memset(fsrRing, 0, sizeof(fsrRing));
+  fsrHead = 0;
+  fsrOversampled = 0;
+  fsrPrimed = 0;
+  fsrAccum = 0;
+  fsrSum = 0;
+  fsrThreshold = 0;
+  fsrTripped = false;
+
+  DIDR0 |= _BV(FSR_ADC_CHANNEL);
+  ADMUX = _BV(REFS0) | FSR_ADC_CHANNEL;  // AVcc reference
+  ADCSRB = 0;                            // free running, MUX5 = 0
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) |
+           _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
 
-    int medIndex = groupedSchedules[groupIndex].count;
-    if (medIndex < MAX_MEDS_PER_TIME) { // Using new constant
-      strcpy(groupedSchedules[groupIndex].medications[medIndex], schedules[i].medication);
-      strcpy(groupedSchedules[groupIndex].dosages[medIndex], schedules[i].dosage);
-      strcpy(groupedSchedules[groupIndex].tubes[medIndex], schedules[i].tube);
-      groupedSchedules[groupIndex].amounts[medIndex] = schedules[i].amount;
-      groupedSchedules[groupIndex].count++;
-    }
-  }
+void fsrStop() {
+  ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);  // back to analogRead() setup
+  fsrThreshold = 0;
 }
 
-bool startStreamingSave() {
-  const char *tmpName = "data.tmp";
+bool fsrReady() {
+  return fsrPrimed >= FSR_RING_SIZE;
+}
 
-  if (sdBusy) {
-    Serial.println(F("startStreamingSave: SD busy, abort.")); // Using F() macro
-    return false;
+uint32_t fsrFiltered() {
+  uint32_t sum;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sum = fsrSum;
   }
-  sdBusy = true;
+  return sum;
+}
 
-  digitalWrite(TFT_CS, HIGH);
-  delay(5);
-  if (!acquireSD()) {
-    Serial.println(F("SD.begin failed")); // Using F() macro
-    sdBusy = false;
-    return false;
-  }
+float fsrGrams(uint32_t filtered, uint16_t calQ8) {
+  return filtered * 256.0 / ((float)calQ8 * FSR_FILTER_SCALE);
+}
 
-  if (!SD.begin(SD_CS)) {
-    Serial.println(F("startStreamingSave: SD.begin() failed.")); // Using F() macro
-    sdBusy = false;
-    return false;
+// Tares to the current filtered weight and arms the ISR to cut motorPin
+// once targetGrams have been added.
+void fsrArm(int motorPin, uint16_t calQ8, float targetGrams) {
+  uint32_t threshold = targetGrams * calQ8 * FSR_FILTER_SCALE / 256.0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    fsrTare = fsrSum;
+    fsrThreshold = threshold;
+    fsrMotorPort = portOutputRegister(digitalPinToPort(motorPin));
+    fsrMotorMask = digitalPinToBitMask(motorPin);
+    fsrOver = 0;
+    fsrTripped = false;
   }
+}
 
-  if (SD.exists(tmpName)) {
-    SD.remove(tmpName);
-    delay(100);
+void fsrDisarm() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    fsrThreshold = 0;
   }
+}
 
-  streamingFile = SD.open(tmpName, O_WRITE | O_CREAT | O_TRUNC);
-  if (!streamingFile) {
-    Serial.println(F("startStreamingSave: ERROR opening temp for write!")); // Using F() macro
-    sdBusy = false;
-    return false;
-  }
+// Moves a dispense channel to a new state and restarts its state timer.
+void enterDispenseState(DispenseChannel &channel, DispenseState state) {
+  channel.state = state;
+  channel.stateStart = millis();
+}
 
-  streamingActive = true;
-  Serial.println(F("Started streaming save to SD")); // Using F() macro
+bool reserveDispenseLoad(uint8_t load) {
+  if (dispenseJob.load + load > DISPENSE_LOAD_BUDGET) return false;
+  dispenseJob.load += load;
   return true;
 }
 
-bool writeStreamingChunk(const String &chunk) {
-  if (!streamingActive || !streamingFile) {
-    return false;
+void releaseDispenseLoad(uint8_t load) {
+  dispenseJob.load -= load;
+}
+
+// A channel may open once fewer than DISPENSE_MAX_ACTIVE channels are in
+// flight and no earlier channel is still using the same tube.
+bool canStartChannel(int index) {
+  int active = 0;
+  for (int i = 0; i < dispenseJob.count; i++) {
+    const DispenseChannel &other = dispenseJob.channels[i];
+    if (other.state == DISPENSE_IDLE || other.state == DISPENSE_DONE) continue;
+    if (other.tube == dispenseJob.channels[index].tube) return false;
+    active++;
   }
+  return active < DISPENSE_MAX_ACTIVE;
+}
 
-  size_t written = streamingFile.print(chunk);
-  streamingFile.flush();
+uint16_t currentMinuteOfDay() {
+  return rtctime.hour() * 60 + rtctime.minute();
+}
 
-  if (written != chunk.length()) {
-    Serial.println(F("writeStreamingChunk: ERROR incomplete write!")); // Using F() macro
-    return false;
+// Index of the first group at or after 'minutes', or groupedCount if none.
+int lowerBoundGroup(uint16_t minutes) {
+  int lo = 0, hi = groupedCount;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (groupedSchedules[mid].minutes < minutes) lo = mid + 1;
+    else hi = mid;
   }
-  return true;
+  return lo;
 }
 
-bool finishStreamingSave() {
-  if (!streamingActive) return false;
-
-  const char *tmpName = "data.tmp";
-  const char *finalName = "data.json";
+// Group due at exactly 'minutes', or -1.
+int findGroupAt(uint16_t minutes) {
+  int i = lowerBoundGroup(minutes);
+  return (i < groupedCount && groupedSchedules[i].minutes == minutes) ? i : -1;
+}
 
-  streamingFile.sync();
-  streamingFile.close();
-  streamingActive = false;
-  delay(50);
-
-  if (SD.exists(finalName)) {
-    bool removed = false;
-    for (int attempt = 0; attempt < 6; ++attempt) {
-      delay(40);
-      removed = SD.remove(finalName);
-      Serial.print(F("finishStreamingSave: remove final attempt ")); // Using F() macro
-      Serial.print(attempt);
-      Serial.print(F(" -> "));
-      Serial.println(removed ? F("ok") : F("fail"));
-      if (removed) break;
-    }
-  }
-
-  bool renamed = SD.rename(tmpName, finalName);
-  Serial.print(F("finishStreamingSave: rename -> ")); // Using F() macro
-  Serial.println(renamed ? F("ok") : F("fail"));
-
-  if (!renamed) {
-    Serial.println(F("finishStreamingSave: fallback copy starting...")); // Using F() macro
-    File r = SD.open(tmpName, FILE_READ);
-    if (!r) {
-      Serial.println(F("finishStreamingSave: fallback: cannot open temp for read.")); // Using F() macro
-      sdBusy = false;
-      return false;
-    }
+bool isDispensing() {
+  return dispenseJob.active;
+}
 
-    if (SD.exists(finalName)) {
-      SD.remove(finalName);
-      delay(10);
-    }
+void handleDispensing() {
+  LOG_INFO(F("DROP button pressed - starting dispensing sequence"));
 
-    File f2 = SD.open(finalName, O_WRITE | O_CREAT | O_TRUNC);
-    if (!f2) {
-      Serial.println(F("finishStreamingSave: fallback: cannot open final for write.")); // Using F() macro
-      r.close();
-      sdBusy = false;
-      return false;
-    }
+  if (isDispensing()) {
+    LOG_WARN(F("Dispensing already in progress"));
+    return;
+  }
 
-    char buffer[32];
-    while (r.available()) {
-      int bytesRead = r.readBytes(buffer, sizeof(buffer));
-      f2.write((const uint8_t *)buffer, bytesRead);
-    }
+  // The reminder on screen, which may be a snoozed dose from earlier
+  int groupIndex = notifiedGroup;
+  if (groupIndex == -1) {
+    LOG_WARN(F("No medications scheduled for current time"));
+    return;
+  }
 
-    f2.sync();
-    f2.close();
-    r.close();
-    Serial.println(F("finishStreamingSave: fallback copy complete")); // Using F() macro
+  // Resolve the tubes up front so a schedule reload mid-dose cannot
+  // change what this job dispenses.
+  GroupedMedication *currentGroup = &groupedSchedules[groupIndex];
+  doseHandledMinute = currentGroup->minutes;
+  if (snoozedGroup == groupIndex) snoozedGroup = -1;
+  dispenseJob.count = 0;
+  dispenseJob.current = 0;
+  dispenseJob.finished = 0;
+  dispenseJob.load = 0;
+  dispenseJob.windowFree = millis();
+  for (int i = 0; i < currentGroup->count; i++) {
+    const MedicationTime &med = schedules[currentGroup->members[i]];
+    DispenseChannel &channel = dispenseJob.channels[dispenseJob.count++];
+    channel.tube = &tubeMappings[med.tube];
+    channel.pills = pillsPerDose(med);
+    enterDispenseState(channel, DISPENSE_IDLE);
+  }
 
-    if (SD.exists(tmpName)) {
-      SD.remove(tmpName);
-    }
+  if (dispenseJob.count == 0) {
+    showNotification = false;
+    uiRefreshPending = true;
+    return;
   }
 
-  sdBusy = false;
-  Serial.println(F("Streaming save completed successfully")); // Using F() macro
-  delay(500);
-  return true;
+  dispenseJob.active = true;
+  fsrStart();
 }
 
-int timeToMinutes(const char* timeStr) {
-  int hours, minutes;
-  if (sscanf(timeStr, "%d:%d", &hours, &minutes) != 2) {
-    return -1;
-  }
-  return hours * 60 + minutes;
-}
-
-int findNextMedication() {
-  int currentMinutes = rtctime.hour() * 60 + rtctime.minute();
-  int closestIndex = -1;
-  int minDifference = 24 * 60;
+// Steps one channel. Returns after at most one transition so the other
+// channels get their turn in the same pass.
+void updateDispenseChannel(int index) {
+  DispenseChannel &channel = dispenseJob.channels[index];
+  TubeMapping *mapping = channel.tube;
+  unsigned long elapsed = millis() - channel.stateStart;
+
+  switch (channel.state) {
+    case DISPENSE_IDLE:
+      if (canStartChannel(index) && reserveDispenseLoad(DISPENSE_SERVO_LOAD)) {
+        LOG_INFO(F("Opening tube "), index + 1, F(" of "), dispenseJob.count,
+                 F(": "), mapping->tubeName);
+        openServo(*mapping);
+        enterDispenseState(channel, DISPENSE_SERVO_OPEN);
+      }
+      break;
 
-  for (int i = 0; i < groupedCount; i++) {
-    int scheduleMinutes = timeToMinutes(groupedSchedules[i].time);
-    if (scheduleMinutes == -1) continue;
+    case DISPENSE_SERVO_OPEN:
+      if (elapsed >= SERVO_MOVE_MS && servoArrived(*mapping)) {
+        moveServo(*mapping, mapping->cal.standbyPos);
+        releaseDispenseLoad(DISPENSE_SERVO_LOAD);
+        enterDispenseState(channel, DISPENSE_READY);
+      }
+      break;
 
-    int difference = scheduleMinutes - currentMinutes;
-    if (difference < 0) difference += 24 * 60;
+    case DISPENSE_READY:
+      if (index == dispenseJob.current) {
+        enterDispenseState(channel, DISPENSE_SETTLE);
+      }
+      break;
 
-    if (difference < minDifference) {
-      minDifference = difference;
-      closestIndex = i;
-    }
-  }
-  return closestIndex;
-}
+    case DISPENSE_SETTLE:
+      // Wait out both this tube's servo jolt and the previous tube's drop
+      // so the tare sees neither in flight
+      if (elapsed >= DISPENSE_SETTLE_MS && millis() - dispenseJob.windowFree >= DISPENSE_SETTLE_MS &&
+          fsrReady()) {
+        enterDispenseState(channel, DISPENSE_MOTOR_RUN);
+      }
+      break;
 
-bool checkMedicationTime() {
-  char currentTime[6];
-  sprintf(currentTime, "%02d:%02d", rtctime.hour(), rtctime.minute());
+    case DISPENSE_MOTOR_RUN:
+      if (!reserveDispenseLoad(DISPENSE_MOTOR_LOAD)) break;
+      LOG_INFO(F("Dispensing medication "), index + 1, F(" of "), dispenseJob.count,
+               F(" from "), mapping->tubeName);
+      fsrArm(mapping->motorPin, mapping->cal.fsrCalQ8, DISPENSE_TARGET_GRAMS);
+      LOG_DEBUG(F("Initial weight: "), fsrGrams(fsrTare, mapping->cal.fsrCalQ8), F(" g"));
+      triggerMotor(mapping->motorPin, true);
+      motorStates[mapping->servoIndex] = true;
+      dispenseJob.lastSample = 0;
+      enterDispenseState(channel, DISPENSE_WEIGHT_WATCH);
+      break;
 
-  for (int i = 0; i < groupedCount; i++) {
-    if (strcmp(groupedSchedules[i].time, currentTime) == 0) { // Using strcmp
-      if (groupedSchedules[i].count == 1) {
-        snprintf(notificationMessage, sizeof(notificationMessage), 
-                "TIME TO TAKE: %s - %s", 
-                groupedSchedules[i].medications[0], 
-                groupedSchedules[i].dosages[0]);
+    case DISPENSE_WEIGHT_WATCH: {
+      uint8_t outcome;
+      if (elapsed >= DISPENSE_TIMEOUT_MS) {
+        LOG_WARN(F("Dispense timeout"));
+        outcome = DOSE_TIMEOUT;
+      } else if (fsrTripped) {
+        LOG_INFO(F("Target weight reached!"));
+        outcome = DOSE_DISPENSED;
       } else {
-        snprintf(notificationMessage, sizeof(notificationMessage), 
-                "TIME TO TAKE %d MEDS: %s (%s)", 
-                groupedSchedules[i].count,
-                groupedSchedules[i].medications[0], 
-                groupedSchedules[i].dosages[0]);
-        
-        if (groupedSchedules[i].count > 1 && strlen(notificationMessage) < 150) {
-          char temp[50];
-          snprintf(temp, sizeof(temp), " + %s (%s)", 
-                  groupedSchedules[i].medications[1], 
-                  groupedSchedules[i].dosages[1]);
-          strncat(notificationMessage, temp, sizeof(notificationMessage) - strlen(notificationMessage) - 1);
-        }
-      }
-      return true;
-    }
-  }
-  return false;
-}
-
-bool loadScheduleData() {
-  if (sdBusy) {
-    Serial.println(F("loadScheduleData: SD busy, abort")); // Using F() macro
-    return false;
-  }
-  sdBusy = true;
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+        // Weight trace only; detection itself happens in ADC_vect
+        if (dispenseJob.lastSample != 0 && millis() - dispenseJob.lastSample < FSR_SAMPLE_MS) break;
+        dispenseJob.lastSample = millis();
 
-  digitalWrite(TFT_CS, HIGH);
-  delayMicroseconds(5);
-  if (!acquireSD()) {
-    Serial.println(F("loadScheduleData: SD.begin failed")); // Using F() macro
-    sdBusy = false;
-    return false;
-  }
+        float currentWeight = fsrGrams(fsrFiltered(), mapping->cal.fsrCalQ8);
+        float weightIncrease = currentWeight - fsrGrams(fsrTare, mapping->cal.fsrCalQ8);
 
-  File f = SD.open("data.json", FILE_READ);
-  if (!f) {
-    Serial.println(F("Cannot find data.json")); // Using F() macro
-    sdBusy = false;
-    return false;
-  }
+        LOG_DEBUG(F("Current weight: "), currentWeight, F(" g, Increase: "), weightIncrease, F(" g"));
+#endif
+        break;
+      }
 
-  size_t fileSize = f.size();
-  Serial.print(F("loadScheduleData: fileSize = ")); // Using F() macro
-  Serial.println(fileSize);
-  if (fileSize == 0) {
-    Serial.println(F("loadScheduleData: file empty")); // Using F() macro
-    f.close();
-    sdBusy = false;
-    return false;
-  }
+      float grams = fsrGrams(fsrFiltered(), mapping->cal.fsrCalQ8) - fsrGrams(fsrTare, mapping->cal.fsrCalQ8);
+      fsrDisarm();
+      if (motorStates[mapping->servoIndex]) {
+        triggerMotor(mapping->motorPin, false);
+        motorStates[mapping->servoIndex] = false;
+      }
+      releaseDispenseLoad(DISPENSE_MOTOR_LOAD);
+      recordDoseEvent(mapping->servoIndex, outcome, grams, elapsed);
+      if (outcome == DOSE_DISPENSED) consumeStock(mapping->servoIndex, channel.pills);
+
+      // Hand the window on; the next tube's settle overlaps this one's
+      dispenseJob.current++;
+      dispenseJob.windowFree = millis();
+      enterDispenseState(channel, DISPENSE_MOTOR_STOP);
+      break;
+    }
 
-  StaticJsonDocument<128> filter;
-  filter[0]["tube"] = true;
-  filter[0]["type"] = true;
-  filter[0]["amount"] = true;
-  filter[0]["time_to_take"][0]["time"] = true;
-  filter[0]["time_to_take"][0]["dosage"] = true;
+    case DISPENSE_MOTOR_STOP:
+      if (elapsed >= DISPENSE_SETTLE_MS && reserveDispenseLoad(DISPENSE_SERVO_LOAD)) {
+        closeServo(*mapping);
+        enterDispenseState(channel, DISPENSE_SERVO_CLOSE);
+      }
+      break;
 
-  scheduleCount = 0;
+    case DISPENSE_SERVO_CLOSE:
+      if (elapsed >= SERVO_MOVE_MS && servoArrived(*mapping)) {
+        moveServo(*mapping, mapping->cal.standbyPos);
+        releaseDispenseLoad(DISPENSE_SERVO_LOAD);
+        LOG_DEBUG(F("Dispensing complete for "), mapping->tubeName);
+        dispenseJob.finished++;
+        enterDispenseState(channel, DISPENSE_DONE);
+      }
+      break;
 
-  StaticJsonDocument<1024> doc;
-  ReadBufferingStream in(f, 32); // Reduced buffer size from 64 to 32
-  DeserializationError err = deserializeJson(doc, in, DeserializationOption::Filter(filter));
+    default:
+      break;
+  }
+}
 
-  f.close();
+void updateDispensing() {
+  PROFILE_SCOPE(PROFILE_DISPENSE);
+  if (!isDispensing()) return;
 
-  if (err) {
-    Serial.print(F("JSON parse error: ")); // Using F() macro
-    Serial.println(err.c_str());
-    sdBusy = false;
-    return false;
+  for (int i = 0; i < dispenseJob.count; i++) {
+    updateDispenseChannel(i);
   }
 
-  if (!doc.is<JsonArray>()) {
-    Serial.println(F("JSON root is not an array")); // Using F() macro
-    sdBusy = false;
-    return false;
+  if (dispenseJob.finished == dispenseJob.count) {
+    LOG_INFO(F("Dispensing sequence complete"));
+    fsrStop();
+    dispenseJob.active = false;
+    showNotification = false;
+    uiRefreshPending = true;
   }
+}
 
-  JsonArray arr = doc.as<JsonArray>();
-  for (JsonObject med : arr) {
-    const char* tubeC = med["tube"] | "";
-    const char* typeC = med["type"] | "";
-    int amount = med["amount"] | 0;
-
-    JsonArray times = med["time_to_take"].as<JsonArray>();
-    if (times.isNull()) continue;
+#define SPINNER_SEGMENTS 8
+#define GREY565(v) ((((v) & 0xF8) << 8) | (((v) & 0xFC) << 3) | ((v) >> 3))
 
-    for (JsonObject t : times) {
-      if (scheduleCount >= MAX_SCHEDULES) break; // Using new constant
-      const char* timeC = t["time"] | "";
-      const char* dosageC = t["dosage"] | "";
+// sin() of the segment angles (45 degree steps) in Q7 fixed point; the two
+// extra entries let cos(k) be read as spinnerSin[k + 2].
+const int8_t spinnerSin[SPINNER_SEGMENTS + 2] PROGMEM = {
+  0, 90, 127, 90, 0, -90, -127, -90, 0, 90
+};
 
-      strncpy(schedules[scheduleCount].tube, tubeC, sizeof(schedules[scheduleCount].tube) - 1);
-      schedules[scheduleCount].tube[sizeof(schedules[scheduleCount].tube) - 1] = '\0';
-      
-      strncpy(schedules[scheduleCount].medication, typeC, sizeof(schedules[scheduleCount].medication) - 1);
-      schedules[scheduleCount].medication[sizeof(schedules[scheduleCount].medication) - 1] = '\0';
-      
-      schedules[scheduleCount].amount = amount;
-      
-      strncpy(schedules[scheduleCount].time, timeC, sizeof(schedules[scheduleCount].time) - 1);
-      schedules[scheduleCount].time[sizeof(schedules[scheduleCount].time) - 1] = '\0';
-      
-      strncpy(schedules[scheduleCount].dosage, dosageC, sizeof(schedules[scheduleCount].dosage) - 1);
-      schedules[scheduleCount].dosage[sizeof(schedules[scheduleCount].dosage) - 1] = '\0';
-      
-      scheduleCount++;
-    }
-  }
+// Grey level by distance behind the head segment.
+const uint8_t spinnerShade[SPINNER_SEGMENTS] PROGMEM = {
+  255, 180, 110, 50, 50, 50, 50, 50
+};
 
-  sdBusy = false;
-  groupMedicationsByTime();
-  Serial.print(F("Loaded ")); // Using F() macro
-  Serial.print(scheduleCount);
-  Serial.println(F(" medication schedules"));
+// Spinner with fixed segment positions; only the brightness moves, so each
+// step redraws just the segments whose shade changed (4 of 8).
+struct Spinner {
+  int16_t x, y;
+  uint8_t radius;
+  uint8_t head;
+  uint8_t drawnShade[SPINNER_SEGMENTS];  // 0 = not drawn yet
+};
 
-  return scheduleCount > 0;
+void initSpinner(Spinner &spinner, int16_t x, int16_t y, uint8_t radius) {
+  spinner.x = x;
+  spinner.y = y;
+  spinner.radius = radius;
+  spinner.head = 0;
+  memset(spinner.drawnShade, 0, sizeof(spinner.drawnShade));
 }
 
-void drawHeader() {
-  tft.fillRect(0, 0, 320, 35, ST77XX_BLUE);
+void drawSpinnerSegment(const Spinner &spinner, uint8_t k, uint8_t shade) {
+  int16_t c = (int8_t)pgm_read_byte(&spinnerSin[k + 2]);
+  int16_t s = (int8_t)pgm_read_byte(&spinnerSin[k]);
+  int16_t inner = spinner.radius - 3;
 
-  tft.setTextSize(2);
-  tft.setTextColor(ST77XX_WHITE);
-  tft.setCursor(10, 8);
-  if (rtctime.hour() < 10) tft.print("0");
-  tft.print(rtctime.hour());
-  tft.print(":");
-  if (rtctime.minute() < 10) tft.print("0");
-  tft.print(rtctime.minute());
+  int x1 = spinner.x + ((inner * c) >> 7);
+  int y1 = spinner.y + ((inner * s) >> 7);
+  int x2 = spinner.x + ((spinner.radius * c) >> 7);
+  int y2 = spinner.y + ((spinner.radius * s) >> 7);
 
-  tft.setTextSize(1);
-  tft.setCursor(10, 22);
-  tft.print(rtctime.day());
-  tft.print("/");
-  tft.print(rtctime.month());
-  tft.print("/");
-  tft.print(rtctime.year());
+  uint16_t color = GREY565(shade);
+  tft.drawLine(x1, y1, x2, y2, color);
+  tft.drawLine(x1 + 1, y1, x2 + 1, y2, color);
+}
 
-  tft.setTextSize(1);
-  tft.setCursor(200, 8);
-  tft.print(F("STATUS: ")); // Using F() macro
-  tft.setTextColor(filestat ? ST77XX_GREEN : ST77XX_RED);
-  tft.print(filestat ? F("READY") : F("ERROR")); // Using F() macro
+// Advances the head one segment and repaints the segments that changed.
+void stepSpinner(Spinner &spinner) {
+  spinner.head = (spinner.head + 1) % SPINNER_SEGMENTS;
 
-  tft.fillRect(290, 8, 20, 12, ST77XX_GREEN);
-  tft.drawRect(289, 7, 22, 14, ST77XX_WHITE);
-  tft.fillRect(311, 10, 3, 8, ST77XX_WHITE);
+  for (uint8_t k = 0; k < SPINNER_SEGMENTS; k++) {
+    uint8_t behind = (spinner.head - k) & (SPINNER_SEGMENTS - 1);
+    uint8_t shade = pgm_read_byte(&spinnerShade[behind]);
+    if (spinner.drawnShade[k] != shade) {
+      drawSpinnerSegment(spinner, k, shade);
+      spinner.drawnShade[k] = shade;
+    }
+  }
 }
 
-void drawGroupedMedicationCard(int x, int y, int width, int height, GroupedMedication group, bool isNext = false) {
-  uint16_t cardColor = isNext ? ST77XX_YELLOW : ST77XX_WHITE;
-  uint16_t textColor = isNext ? ST77XX_BLACK : ST77XX_BLACK;
-
-  tft.fillRoundRect(x, y, width, height, 8, cardColor);
-  tft.drawRoundRect(x, y, width, height, 8, isNext ? ST77XX_RED : ST77XX_BLUE);
+// Progress bar that paints only the slice between the old and new fill.
+struct LoadingBar {
+  int16_t x, y, width, height;
+  int16_t drawnFill;  // -1 = frame not drawn yet
+};
 
-  tft.setTextSize(2);
-  tft.setTextColor(textColor);
-  tft.setCursor(x + 8, y + 8);
-  tft.print(group.time);
+void initLoadingBar(LoadingBar &bar, int16_t x, int16_t y, int16_t width, int16_t height) {
+  bar.x = x;
+  bar.y = y;
+  bar.width = width;
+  bar.height = height;
+  bar.drawnFill = -1;
+}
 
-  if (group.count > 1) {
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_RED);
-    tft.setCursor(x + width - 50, y + 8);
-    tft.print(group.count);
-    tft.print(F(" MEDS")); // Using F() macro
+void drawLoadingBar(LoadingBar &bar, int progress) {
+  if (bar.drawnFill < 0) {
+    tft.drawRect(bar.x, bar.y, bar.width, bar.height, ST77XX_WHITE);
+    bar.drawnFill = 0;
   }
 
-  tft.setTextSize(1);
-  tft.setTextColor(textColor);
-  tft.setCursor(x + 8, y + 32);
-  tft.print(group.medications[0]);
-  tft.print(F(" - ")); // Using F() macro
-  tft.print(group.dosages[0]);
+  if (progress < 0) progress = 0;
+  if (progress > 100) progress = 100;
+  int16_t fillWidth = ((long)progress * (bar.width - 2)) / 100;
 
-  if (group.count > 1) {
-    tft.setCursor(x + 8, y + 45);
-    tft.print(group.medications[1]);
-    tft.print(F(" - ")); // Using F() macro
-    tft.print(group.dosages[1]);
+  if (fillWidth > bar.drawnFill) {
+    tft.fillRect(bar.x + 1 + bar.drawnFill, bar.y + 1, fillWidth - bar.drawnFill, bar.height - 2, ST77XX_GREEN);
+  } else if (fillWidth < bar.drawnFill) {
+    tft.fillRect(bar.x + 1 + fillWidth, bar.y + 1, bar.drawnFill - fillWidth, bar.height - 2, ST77XX_BLACK);
   }
+  bar.drawnFill = fillWidth;
+}
 
-  if (group.count > 2) {
-    tft.setCursor(x + 8, y + 58);
-    tft.print(F("+ ")); // Using F() macro
-    tft.print(group.count - 2);
-    tft.print(F(" more medications")); // Using F() macro
-  } else if (group.count <= 2) {
-    tft.setCursor(x + 8, y + 58);
-    tft.print(group.tubes[0]);
-    if (group.count == 2) {
-      tft.print(F(", ")); // Using F() macro
-      tft.print(group.tubes[1]);
-    }
-  }
+Spinner uploadSpinner;
+LoadingBar dispenseBar;
 
-  if (isNext) {
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_RED);
-    tft.setCursor(x + width - 35, y + height - 15);
-    tft.print(F("NEXT")); // Using F() macro
-  }
+void animatedIntro() {
+  tft.fillScreen(ST77XX_BLACK);
+  
+  tft.setTextSize(3);
+  tft.setTextColor(ST77XX_WHITE);
+  tft.setCursor(50, 100);
+  tft.println(F("MedDispenser"));
+  
+  tft.setTextSize(1);
+  tft.setCursor(80, 140);
+  tft.println(F("Initializing..."));
 }
 
-void drawNotification() {
-  if (!showNotification) return;
+#define GROUP_HASH_SIZE 64  // power of two, at least 2 * MAX_GROUPED
+#define GROUP_HASH_EMPTY 0xFF
 
-  int notifHeight = 80;
-  if (strlen(notificationMessage) > 50) {
-    notifHeight = 100;
-  }
+static_assert(GROUP_HASH_SIZE >= 2 * MAX_GROUPED, "grouping hash table too small");
 
-  tft.fillRect(10, 80, 300, notifHeight, ST77XX_RED);
-  tft.drawRect(9, 79, 302, notifHeight + 2, ST77XX_WHITE);
+// groupedSchedules[] changed: drop cached lookups and repaint the cards.
+void scheduleChanged() {
+  notifiedGroup = -1;
+  snoozedGroup = -1;
+  doseAlarmStale = true;
+  scheduleVersion++;
+}
 
-  bool blink = (millis() / 500) % 2;
-  uint16_t textColor = blink ? ST77XX_WHITE : ST77XX_YELLOW;
+// Groups schedules[] by dose minute in one pass, using a small
+// open-addressing table from minute to group index, then orders the groups
+// by minute for the lookup functions.
+void groupMedicationsByTime() {
+  uint8_t slots[GROUP_HASH_SIZE];
+  memset(slots, GROUP_HASH_EMPTY, sizeof(slots));
+  groupedCount = 0;
+  ungroupedCount = 0;
+  memset(inventory.dailyPills, 0, sizeof(inventory.dailyPills));
 
-  tft.setTextSize(1);
-  tft.setTextColor(textColor);
-  tft.setCursor(15, 90);
-  tft.print(F("MEDICATION ALERT!")); // Using F() macro
+  for (int i = 0; i < scheduleCount; i++) {
+    uint16_t minutes = schedules[i].minutes;
+    uint8_t h = (minutes * 37) & (GROUP_HASH_SIZE - 1);
+    while (slots[h] != GROUP_HASH_EMPTY && groupedSchedules[slots[h]].minutes != minutes) {
+      h = (h + 1) & (GROUP_HASH_SIZE - 1);
+    }
 
-  tft.setTextSize(1);
-  int lineY = 105;
-  int charsPerLine = 35;
-  
-  int msgLen = strlen(notificationMessage);
-  int pos = 0;
-  
-  while (pos < msgLen && lineY < 80 + notifHeight - 20) {
-    int lineEnd = pos + charsPerLine;
-    if (lineEnd > msgLen) lineEnd = msgLen;
-    
-    if (lineEnd < msgLen) {
-      while (lineEnd > pos && notificationMessage[lineEnd] != ' ') {
-        lineEnd--;
+    if (slots[h] == GROUP_HASH_EMPTY) {
+      if (groupedCount >= MAX_GROUPED) {
+        ungroupedCount++;
+        continue;
       }
-      if (lineEnd == pos) lineEnd = pos + charsPerLine;
+      slots[h] = groupedCount;
+      groupedSchedules[groupedCount].minutes = minutes;
+      groupedSchedules[groupedCount].count = 0;
+      groupedCount++;
     }
-    
-    tft.setCursor(15, lineY);
-    for (int i = pos; i < lineEnd; i++) {
-      tft.print(notificationMessage[i]);
+
+    GroupedMedication &group = groupedSchedules[slots[h]];
+    if (group.count < MAX_MEDS_PER_TIME) { // Using new constant
+      group.members[group.count++] = i;
+      inventoryCountDose(schedules[i], 1);
+    } else {
+      ungroupedCount++;
     }
-    
-    pos = lineEnd;
-    if (pos < msgLen && notificationMessage[pos] == ' ') pos++;
-    lineY += 12;
+  }
+  if (ungroupedCount > 0) {
+    // These doses are loaded but would never be reminded or dispensed
+    LOG_WARN(F("groupMedicationsByTime: too many dose times, "), ungroupedCount, F(" doses not scheduled")); // Using F() macro
   }
 
-  tft.setTextSize(1);
-  tft.setCursor(15, 80 + notifHeight - 25);
-  tft.print(F("Press DROP button to dispense")); // Using F() macro
+  // Insertion sort by minute key; the table is tiny.
+  for (int i = 1; i < groupedCount; i++) {
+    GroupedMedication key = groupedSchedules[i];
+    int j = i - 1;
+    while (j >= 0 && groupedSchedules[j].minutes > key.minutes) {
+      groupedSchedules[j + 1] = groupedSchedules[j];
+      j--;
+    }
+    groupedSchedules[j + 1] = key;
+  }
+  updateStockStatus();
+  scheduleChanged();
+}
 
-  tft.setCursor(15, 80 + notifHeight - 15);
-  tft.print(F("Auto-dismiss in ")); // Using F() macro
-  tft.print(300 - (millis() - notificationStartTime) / 1000);
-  tft.print(F("s")); // Using F() macro
+// Incremental counterparts of groupMedicationsByTime() for single-dose
+// edits: only the group at the dose's minute is touched, and members stay
+// in schedules[] order. false if the dose found no room and is not grouped,
+// which checkSchedulePatch() rules out for patches.
+bool groupInsertDose(uint8_t index) {
+  uint16_t minutes = schedules[index].minutes;
+  int g = lowerBoundGroup(minutes);
+  if (g == groupedCount || groupedSchedules[g].minutes != minutes) {
+    if (groupedCount >= MAX_GROUPED) return false;
+    memmove(&groupedSchedules[g + 1], &groupedSchedules[g], (groupedCount - g) * sizeof(GroupedMedication));
+    groupedSchedules[g].minutes = minutes;
+    groupedSchedules[g].count = 0;
+    groupedCount++;
+  }
 
-  if (millis() - notificationStartTime > 300000) {
-    showNotification = false;
+  GroupedMedication &group = groupedSchedules[g];
+  if (group.count >= MAX_MEDS_PER_TIME) return false;
+  int j = group.count;
+  while (j > 0 && group.members[j - 1] > index) {
+    group.members[j] = group.members[j - 1];
+    j--;
   }
+  group.members[j] = index;
+  group.count++;
+  inventoryCountDose(schedules[index], 1);
+  updateStockStatus();
+  return true;
 }
 
-void startTubeSetupMode() {
-  setupMode = true;
-  currentTubeSetup = 0;
-  waitingForDropButton = false;
-  
-  totalTubesNeeded = 0;
-  char uniqueTubes[10][8]; // Array to store unique tube names (max 10 tubes)
-  
-  // Go through all schedules and collect unique tube names
-  for (int i = 0; i < scheduleCount; i++) {
-    bool tubeExists = false;
-    
-    // Check if this tube name already exists in our unique list
-    for (int j = 0; j < totalTubesNeeded; j++) {
-      if (strcmp(uniqueTubes[j], schedules[i].tube) == 0) {
-        tubeExists = true;
-        break;
-      }
-    }
-    
-    // If tube doesn't exist in our list, add it
-    if (!tubeExists && totalTubesNeeded < 10) {
-      strcpy(uniqueTubes[totalTubesNeeded], schedules[i].tube);
-      totalTubesNeeded++;
-    }
+void groupRemoveDose(uint8_t index) {
+  int g = findGroupAt(schedules[index].minutes);
+  if (g == -1) return;
+
+  GroupedMedication &group = groupedSchedules[g];
+  for (int k = 0; k < group.count; k++) {
+    if (group.members[k] != index) continue;
+    memmove(&group.members[k], &group.members[k + 1], group.count - k - 1);
+    group.count--;
+    inventoryCountDose(schedules[index], -1);
+    updateStockStatus();
+    break;
   }
-  
-  Serial.println(F("Starting tube setup mode"));
-  Serial.print(F("Total unique tubes to configure: "));
-  Serial.println(totalTubesNeeded);
-  
-  // Debug: Print all unique tubes found
-  Serial.println(F("Unique tubes found:"));
-  for (int i = 0; i < totalTubesNeeded; i++) {
-    Serial.print(F("- "));
-    Serial.println(uniqueTubes[i]);
+  if (group.count == 0) {
+    groupedCount--;
+    memmove(&groupedSchedules[g], &groupedSchedules[g + 1], (groupedCount - g) * sizeof(GroupedMedication));
   }
 }
 
-void showTubeSetupScreen() {
-  tft.fillScreen(ST77XX_BLACK);
-  drawHeader();
-  
-  // Title
-  tft.setTextSize(2);
-  tft.setTextColor(ST77XX_YELLOW);
-  tft.setCursor(50, 50);
-  tft.print(F("TUBE SETUP"));
-  
-  // Progress indicator
-  tft.setTextSize(1);
-  tft.setTextColor(ST77XX_WHITE);
-  tft.setCursor(20, 80);
-  tft.print(F("Tube "));
-  tft.print(currentTubeSetup + 1);
-  tft.print(F(" of "));
-  tft.print(totalTubesNeeded);
-  
-  // Current medication info
-  if (currentTubeSetup < groupedCount) {
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_CYAN);
-    tft.setCursor(20, 100);
-    tft.print(F("Put this medication:"));
-    
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_WHITE);
-    tft.setCursor(20, 120);
-    
-    // Display medication name and dosage
-    if (currentTubeSetup < groupedCount && groupedSchedules[currentTubeSetup].count > 0) {
-      tft.print(groupedSchedules[currentTubeSetup].medications[0]);
-      tft.setCursor(20, 135);
-      tft.print(groupedSchedules[currentTubeSetup].dosages[0]);
-    }
-    
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_GREEN);
-    tft.setCursor(20, 160);
-    tft.print(F("Into TUBE "));
-    tft.print(currentTubeSetup + 1);
-  }
-  
-  // Instructions
-  tft.setTextSize(1);
-  tft.setTextColor(ST77XX_YELLOW);
-  tft.setCursor(20, 190);
-  if (waitingForDropButton) {
-    bool blink = (millis() / 500) % 2;
-    if (blink) {
-      tft.print(F("Press DROP button when done"));
+// Removes schedules[index] and renumbers the group members after it.
+void removeScheduleEntry(uint8_t index) {
+  groupRemoveDose(index);
+  scheduleCount--;
+  memmove(&schedules[index], &schedules[index + 1], (scheduleCount - index) * sizeof(MedicationTime));
+  for (int g = 0; g < groupedCount; g++) {
+    for (int k = 0; k < groupedSchedules[g].count; k++) {
+      if (groupedSchedules[g].members[k] > index) groupedSchedules[g].members[k]--;
     }
-  } else {
-    tft.print(F("Place medication in tube"));
-    tft.setCursor(20, 205);
-    tft.print(F("then press DROP button"));
   }
-  
-  // Progress bar
-  int barWidth = 280;
-  int barHeight = 10;
-  int barX = 20;
-  int barY = 230;
-  
-  tft.drawRect(barX, barY, barWidth, barHeight, ST77XX_WHITE);
-  int progress = (currentTubeSetup * barWidth) / totalTubesNeeded;
-  tft.fillRect(barX + 1, barY + 1, progress, barHeight - 2, ST77XX_GREEN);
 }
 
-void handleTubeSetupButton() {
-  Serial.print(F("Tube "));
-  Serial.print(currentTubeSetup + 1);
-  Serial.println(F(" setup completed"));
-  
-  currentTubeSetup++;
-  waitingForDropButton = false;
-  
-  if (currentTubeSetup >= totalTubesNeeded) {
-    // Setup complete
-    setupMode = false;
-    Serial.println(F("Tube setup completed! System ready for automatic dispensing."));
-    
-    // Show completion message
-    tft.fillScreen(ST77XX_BLACK);
-    drawHeader();
-    tft.setTextSize(2);
-    tft.setTextColor(ST77XX_GREEN);
-    tft.setCursor(50, 100);
-    tft.print(F("SETUP"));
-    tft.setCursor(50, 130);
-    tft.print(F("COMPLETE!"));
-    
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_WHITE);
-    tft.setCursor(20, 170);
-    tft.print(F("System ready for"));
-    tft.setCursor(20, 185);
-    tft.print(F("automatic dispensing"));
-    
-    delay(3000);
-  } else {
-    waitingForDropButton = false;
+void initMarker(MarkerMatcher &m) {
+  m.matched = 0;
+  m.fail[0] = 0;
+  uint8_t k = 0;
+  for (uint8_t q = 1; q < m.length; q++) {
+    while (k > 0 && m.pattern[k] != m.pattern[q]) k = m.fail[k - 1];
+    if (m.pattern[k] == m.pattern[q]) k++;
+    m.fail[q] = k;
   }
 }
 
-void showMainMenu() {
-  tft.fillScreen(ST77XX_BLACK);
-  drawHeader();
-
-  if (!setupMode && triggerSetupAfterBT && filestat && groupedCount > 0) {
-    startTubeSetupMode();
-    triggerSetupAfterBT = false; // Reset the flag
+// Feeds one byte into the matcher. Returns true once the whole marker has
+// been seen. A partial match that breaks releases the pattern prefix it was
+// holding back: 'released' receives how many leading pattern bytes are now
+// known to be payload, and 'consumed' is false when c itself is payload.
+bool feedMarker(MarkerMatcher &m, char c, uint8_t &released, bool &consumed) {
+  uint8_t q = m.matched;
+  while (q > 0 && m.pattern[q] != c) q = m.fail[q - 1];
+  released = m.matched - q;
+  consumed = (m.pattern[q] == c);
+  if (consumed) q++;
+
+  if (q == m.length) {
+    m.matched = 0;
+    return true;
   }
+  m.matched = q;
+  return false;
+}
 
-  if (setupMode) {
-    showTubeSetupScreen();
-    return; // Pause other tasks when in setup mode
+// CRC-16/CCITT-FALSE, shared by the on-card formats.
+uint16_t crc16Update(uint16_t crc, uint8_t b) {
+  crc ^= (uint16_t)b << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
   }
+  return crc;
+}
 
-  if (checkMedicationTime() && !showNotification) {
-    showNotification = true;
-    notificationStartTime = millis();
-  }
+uint16_t crc16(const void *data, size_t len, uint16_t crc = 0xFFFF) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len--) crc = crc16Update(crc, *p++);
+  return crc;
+}
 
-  if (showNotification) {
-    drawNotification();
-    return;
-  }
+bool readScheduleSlot() {
+  slotHeaderValid = false;
+  File f = SD.open(SCHEDULE_SLOT_FILE, FILE_READ);
+  if (!f) return false;
 
-  int contentY = 40;
+  ScheduleSlotHeader h;
+  bool ok = f.read(&h, sizeof(h)) == (int)sizeof(h);
+  f.close();
 
-  if (!filestat || groupedCount == 0) {
-    tft.setTextSize(2);
-    tft.setTextColor(ST77XX_RED);
-    tft.setCursor(50, contentY + 50);
-    tft.print(F("NO SCHEDULE DATA")); // Using F() macro
-
-    tft.setTextSize(1);
-    tft.setTextColor(ST77XX_WHITE);
-    tft.setCursor(50, contentY + 80);
-    tft.print(F("Please load medication")); // Using F() macro
-    tft.setCursor(50, contentY + 95);
-    tft.print(F("schedule via app")); // Using F() macro
-    return;
+  if (!ok || h.magic != SCHEDULE_SLOT_MAGIC || h.active > 1 ||
+      h.crc != crc16(&h, sizeof(h) - sizeof(h.crc))) {
+    LOG_WARN(F("readScheduleSlot: pointer file invalid")); // Using F() macro
+    return false;
   }
 
-  int nextMedIndex = findNextMedication();
+  slotHeader = h;
+  slotHeaderValid = true;
+  return true;
+}
 
-  tft.setTextSize(1);
-  tft.setTextColor(ST77XX_CYAN);
-  tft.setCursor(10, contentY + 5);
-  tft.print(F("MEDICATION SCHEDULE")); // Using F() macro
+// Name of the schedule file to load. Cards written before the slot scheme
+// only have data.json, which is used until the first upload commits a slot.
+const char *activeScheduleFile() {
+  if (slotHeaderValid) return scheduleSlotFiles[slotHeader.active];
+  if (SD.exists(SCHEDULE_LEGACY_FILE)) return SCHEDULE_LEGACY_FILE;
+  return scheduleSlotFiles[0];
+}
 
-  int cardY = contentY + 25;
-  int cardsShown = 0;
+uint8_t inactiveScheduleSlot() {
+  return slotHeaderValid ? 1 - slotHeader.active : 0;
+}
 
-  if (nextMedIndex != -1) {
-    drawGroupedMedicationCard(10, cardY, 300, 75, groupedSchedules[nextMedIndex], true);
-    cardY += 85;
-    cardsShown++;
+// Flips the live slot. The header is a fixed-size record rewritten at
+// offset 0, so the commit is a single sector write whatever the file size.
+bool commitScheduleSlot(uint8_t slot, uint32_t length) {
+  ScheduleSlotHeader h;
+  h.magic = SCHEDULE_SLOT_MAGIC;
+  h.generation = slotHeaderValid ? slotHeader.generation + 1 : 1;
+  h.length = length;
+  h.active = slot;
+  h.reserved = 0;
+  h.crc = crc16(&h, sizeof(h) - sizeof(h.crc));
+
+  File f = SD.open(SCHEDULE_SLOT_FILE, O_RDWR | O_CREAT);
+  if (!f) return false;
+  bool ok = f.seekSet(0) && f.write(&h, sizeof(h)) == sizeof(h) && f.sync();
+  f.close();
+  if (!ok) return false;
+
+  slotHeader = h;
+  slotHeaderValid = true;
+  return true;
+}
+
+void printUploadStats() {
+  LOG_INFO(F("Upload: "), uploadStats.bytesReceived, F(" bytes received, "), // Using F() macro
+           uploadStats.bytesToSD, F(" bytes to SD in "),
+           uploadStats.sectorsWritten, F(" sectors, "),
+           uploadStats.syncs, F(" sync"));
+}
+
+// Opens the inactive slot for writing. A non-zero resumeOffset keeps the
+// first resumeOffset bytes of the slot file and appends after them.
+bool startStreamingSave(uint32_t resumeOffset = 0) {
+  if (streamingActive) {
+    LOG_ERROR(F("startStreamingSave: upload already active, abort.")); // Using F() macro
+    return false;
   }
 
-  for (int i = 0; i < groupedCount && cardsShown < 3; i++) {
-    if (i != nextMedIndex) {
-      drawGroupedMedicationCard(10, cardY, 300, 75, groupedSchedules[i], false);
-      cardY += 85;
-      cardsShown++;
-    }
+  if (!acquireSD()) {
+    LOG_ERROR(F("startStreamingSave: SD mount failed.")); // Using F() macro
+    return false;
   }
 
-  tft.setTextSize(1);
-  tft.setTextColor(ST77XX_CYAN);
-  tft.setCursor(10, 260);
-  tft.print(F("Total schedules: ")); // Using F() macro
-  tft.print(groupedCount);
-  tft.print(F(" (")); // Using F() macro
-  tft.print(scheduleCount);
-  tft.print(F(" doses)")); // Using F() macro
+  streamingSlot = inactiveScheduleSlot();
+  streamingFile = SD.open(scheduleSlotFiles[streamingSlot],
+                          resumeOffset ? O_WRITE : O_WRITE | O_CREAT | O_TRUNC);
+  if (!streamingFile) {
+    reportSDError(F("startStreamingSave"));
+    return false;
+  }
+  if (resumeOffset && (streamingFile.size() < resumeOffset ||
+                       !streamingFile.truncate(resumeOffset) || !streamingFile.seekSet(resumeOffset))) {
+    streamingFile.close();
+    reportSDError(F("startStreamingSave"));
+    return false;
+  }
 
-  tft.setCursor(200, 260);
-  tft.print(F("Auto-refresh: 5s")); // Using F() macro
+  memset(&uploadStats, 0, sizeof(uploadStats));
+  streamingActive = true;
+  LOG_DEBUG(F("Started streaming save to SD")); // Using F() macro
+  return true;
 }
 
-bool checkJsonFile() {
-  File f = SD.open("data.json", FILE_READ);
-  if (!f) {
-    Serial.println(F("Cannot find data.json")); // Using F() macro
+bool writeStreamingChunk(const uint8_t *data, size_t len) {
+  PROFILE_SCOPE(PROFILE_SD_WRITE);
+  if (!streamingActive || !streamingFile) {
     return false;
   }
 
-  String jsonStr;
-  while (f.available()) jsonStr += (char)f.read();
-  f.close();
-
-  StaticJsonDocument<512> doc;
-  DeserializationError err = deserializeJson(doc, jsonStr);
+  // No flush here: the file is only synced once in finishStreamingSave() (or
+  // on abort). Callers hand over whole sectors, so writes stay sector-aligned.
+  size_t written = streamingFile.write(data, len);
+  uploadStats.bytesToSD += written;
+  uploadStats.sectorsWritten += (written + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
 
-  if (err) {
-    Serial.print(F("JSON syntax error: ")); // Using F() macro
-    Serial.println(err.c_str());
+  if (written != len) {
+    LOG_ERROR(F("writeStreamingChunk: ERROR incomplete write!")); // Using F() macro
+    reportSDError(F("writeStreamingChunk"));
     return false;
   }
-
-  Serial.println(F("JSON is valid!")); // Using F() macro
   return true;
 }
 
-bool initSD() {
-  pinMode(SD_CS, OUTPUT);
-  pinMode(TFT_CS, OUTPUT);
-  digitalWrite(SD_CS, LOW);
+bool finishStreamingSave() {
+  if (!streamingActive) return false;
+
+  uint32_t length = streamingFile.size();
+  bool synced = streamingFile.sync();
+  uploadStats.syncs++;
+  streamingFile.close();
+  streamingActive = false;
+  printUploadStats();
+
+  if (!synced || !commitScheduleSlot(streamingSlot, length)) {
+    reportSDError(F("finishStreamingSave"));
+    return false;
+  }
+
+  LOG_INFO(F("Streaming save committed to "), scheduleSlotFiles[streamingSlot]); // Using F() macro
+  return true;
+}
+
+int timeToMinutes(const char* timeStr) {
+  int hours, minutes;
+  if (sscanf(timeStr, "%d:%d", &hours, &minutes) != 2) {
+    return -1;
+  }
+  if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59) {
+    return -1;
+  }
+  return hours * 60 + minutes;
+}
+
+int findNextMedication() {
+  if (groupedCount == 0) return -1;
+  int i = lowerBoundGroup(currentMinuteOfDay());
+  return i < groupedCount ? i : 0;  // wrap to the first dose tomorrow
+}
+
+// Group the reminder should show: a snoozed dose whose SNOOZE_MS is up,
+// else the one due this minute unless it was already handled. -1 if none.
+int dueDoseGroup() {
+  int16_t now = currentMinuteOfDay();
+  if (doseHandledMinute != now) doseHandledMinute = -1;
+  if (snoozedGroup >= 0 && millis() - snoozeStart >= SNOOZE_MS) {
+    int i = snoozedGroup;
+    snoozedGroup = -1;
+    return i;
+  }
+  return doseHandledMinute == now ? -1 : findGroupAt(now);
+}
+
+void buildNotification(int i) {
+  if (i == notifiedGroup) return;  // message already built
+
+  const GroupedMedication &group = groupedSchedules[i];
+  const MedicationTime &first = schedules[group.members[0]];
+  if (group.count == 1) {
+    snprintf(notificationMessage, sizeof(notificationMessage), 
+            "TIME TO TAKE: %s - %s", 
+            poolString(first.medication), 
+            poolString(first.dosage));
+  } else {
+    snprintf(notificationMessage, sizeof(notificationMessage), 
+            "TIME TO TAKE %d MEDS: %s (%s)", 
+            group.count,
+            poolString(first.medication), 
+            poolString(first.dosage));
+    
+    if (group.count > 1 && strlen(notificationMessage) < 150) {
+      const MedicationTime &second = schedules[group.members[1]];
+      char temp[50];
+      snprintf(temp, sizeof(temp), " + %s (%s)", 
+              poolString(second.medication), 
+              poolString(second.dosage));
+      strncat(notificationMessage, temp, sizeof(notificationMessage) - strlen(notificationMessage) - 1);
+    }
+  }
+  notifiedGroup = i;
+}
+
+// Schedule image header. The image is written by the firmware after a JSON
+// parse (generation = slot generation of that JSON) or by the desktop tool
+// next to data.json (generation 0, used with legacy single-file cards).
+struct ScheduleImageHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t recordSize;
+  uint16_t count;
+  uint32_t generation;
+  uint32_t sourceLength;  // size of the JSON file the image was built from
+  uint16_t recordsCrc;    // over the string pool, then the records
+  uint16_t poolSize;      // stringPool bytes stored ahead of the records
+  uint16_t reserved;
+  uint16_t crc;
+};
+
+uint32_t activeScheduleGeneration() {
+  return slotHeaderValid ? slotHeader.generation : 0;
+}
+
+uint32_t activeScheduleLength() {
+  if (slotHeaderValid) return slotHeader.length;
+  File f = SD.open(activeScheduleFile(), FILE_READ);
+  if (!f) return 0;
+  uint32_t length = f.size();
+  f.close();
+  return length;
+}
+
+// Sanity check of stringPool and schedules[] read back from storage, after
+// the CRC: every id must point into the pool and the pool must be terminated.
+bool scheduleTablesValid(int count, uint16_t poolSize) {
+  if (stringPool[0] != '\0' || stringPool[poolSize - 1] != '\0') return false;
+  for (int i = 0; i < count; i++) {
+    if (schedules[i].medication >= poolSize || schedules[i].dosage >= poolSize || schedules[i].tube >= 4) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint16_t scheduleTablesCrc() {
+  return crc16(schedules, scheduleCount * sizeof(MedicationTime), crc16(stringPool, stringPoolUsed));
+}
+
+// Reads the packed schedule image straight into stringPool and schedules[].
+// Returns false if it is missing, corrupt or belongs to a different
+// schedule upload.
+bool loadScheduleImage() {
+  File f = SD.open(SCHEDULE_IMAGE_FILE, FILE_READ);
+  if (!f) return false;
+
+  ScheduleImageHeader h;
+  if (f.read(&h, sizeof(h)) != (int)sizeof(h) || h.magic != SCHEDULE_IMAGE_MAGIC ||
+      h.version != SCHEDULE_IMAGE_VERSION || h.recordSize != sizeof(MedicationTime) ||
+      h.poolSize == 0 || h.poolSize > STRING_POOL_SIZE ||
+      h.crc != crc16(&h, sizeof(h) - sizeof(h.crc))) {
+    LOG_ERROR(F("loadScheduleImage: bad header")); // Using F() macro
+    f.close();
+    return false;
+  }
+  if (h.generation != activeScheduleGeneration() || h.sourceLength != activeScheduleLength()) {
+    LOG_WARN(F("loadScheduleImage: stale image")); // Using F() macro
+    f.close();
+    return false;
+  }
+
+  int count = h.count < MAX_SCHEDULES ? h.count : MAX_SCHEDULES;
+  size_t bytes = count * sizeof(MedicationTime);
+  bool ok = f.read(stringPool, h.poolSize) == (int)h.poolSize && f.read(schedules, bytes) == (int)bytes;
+  uint16_t crc = crc16(schedules, bytes, crc16(stringPool, h.poolSize));
+
+  // Records beyond MAX_SCHEDULES are skipped but still covered by the CRC.
+  MedicationTime extra;
+  for (int i = count; ok && i < h.count; i++) {
+    ok = f.read(&extra, sizeof(extra)) == (int)sizeof(extra);
+    crc = crc16(&extra, sizeof(extra), crc);
+  }
+  f.close();
+
+  if (!ok || crc != h.recordsCrc || !scheduleTablesValid(count, h.poolSize)) {
+    LOG_WARN(F("loadScheduleImage: bad records")); // Using F() macro
+    resetStringPool();
+    scheduleCount = 0;
+    return false;
+  }
+
+  stringPoolUsed = h.poolSize;
+  scheduleCount = count;
+  return true;
+}
+
+bool saveScheduleImage() {
+  ScheduleImageHeader h;
+  h.magic = SCHEDULE_IMAGE_MAGIC;
+  h.version = SCHEDULE_IMAGE_VERSION;
+  h.recordSize = sizeof(MedicationTime);
+  h.count = scheduleCount;
+  h.generation = activeScheduleGeneration();
+  h.sourceLength = activeScheduleLength();
+  h.recordsCrc = scheduleTablesCrc();
+  h.poolSize = stringPoolUsed;
+  h.reserved = 0;
+  h.crc = crc16(&h, sizeof(h) - sizeof(h.crc));
+
+  File f = SD.open(SCHEDULE_IMAGE_FILE, O_WRITE | O_CREAT | O_TRUNC);
+  if (!f) {
+    reportSDError(F("saveScheduleImage"));
+    return false;
+  }
+  size_t bytes = scheduleCount * sizeof(MedicationTime);
+  bool ok = f.write(&h, sizeof(h)) == sizeof(h) && f.write(stringPool, stringPoolUsed) == stringPoolUsed &&
+            f.write(schedules, bytes) == bytes && f.sync();
+  f.close();
+  return ok;
+}
+
+// EEPROM mirror of the live schedule (stringPool and schedules[], patches
+// included), so a restart can arm the next dose and draw the menu before
+// the card is read. serviceScheduleCache() rewrites it in the background,
+// only changed bytes, body first and header last; the CRC covers both, so
+// a write cut short by a brownout is not trusted on the next boot.
+#define SCHEDULE_CACHE_EEPROM_ADDR 64  // after CalibrationRecord
+#define SCHEDULE_CACHE_MAGIC 0x4345     // "EC"
+#define EEPROM_BYTES 4096
+
+struct ScheduleCacheHeader {
+  uint16_t magic;
+  uint8_t version;     // SCHEDULE_IMAGE_VERSION, the record layout
+  uint8_t recordSize;
+  uint8_t count;
+  uint8_t reserved;
+  uint16_t poolSize;
+  uint32_t generation;  // slot generation the schedule was loaded from
+  uint16_t bodyCrc;     // scheduleTablesCrc()
+  uint16_t crc;
+};
+
+static_assert(CALIBRATION_EEPROM_ADDR + sizeof(CalibrationRecord) <= SCHEDULE_CACHE_EEPROM_ADDR,
+              "schedule cache overlaps the calibration record");
+static_assert(SCHEDULE_CACHE_EEPROM_ADDR + sizeof(ScheduleCacheHeader) + STRING_POOL_SIZE +
+                  MAX_SCHEDULES * sizeof(MedicationTime) <= EEPROM_BYTES,
+              "schedule cache does not fit the EEPROM");
+
+struct ScheduleCacheWriter {
+  bool pending;
+  uint8_t version;  // scheduleVersion the pending write was taken from
+  uint16_t cursor;  // bytes done, counted from the end of the header
+  ScheduleCacheHeader header;
+};
+
+ScheduleCacheWriter cacheWriter = {false, 0, 0};
+
+bool loadScheduleCache() {
+  ScheduleCacheHeader h;
+  EEPROM.get(SCHEDULE_CACHE_EEPROM_ADDR, h);
+  if (h.magic != SCHEDULE_CACHE_MAGIC || h.version != SCHEDULE_IMAGE_VERSION ||
+      h.recordSize != sizeof(MedicationTime) || h.count > MAX_SCHEDULES ||
+      h.poolSize == 0 || h.poolSize > STRING_POOL_SIZE || h.crc != crc16(&h, sizeof(h) - sizeof(h.crc))) {
+    return false;
+  }
+
+  uint16_t addr = SCHEDULE_CACHE_EEPROM_ADDR + sizeof(h);
+  for (uint16_t i = 0; i < h.poolSize; i++) stringPool[i] = EEPROM.read(addr++);
+  uint8_t *records = (uint8_t *)schedules;
+  for (uint16_t i = 0; i < h.count * sizeof(MedicationTime); i++) records[i] = EEPROM.read(addr++);
+
+  stringPoolUsed = h.poolSize;
+  scheduleCount = h.count;
+  if (scheduleTablesCrc() != h.bodyCrc || !scheduleTablesValid(h.count, h.poolSize)) {
+    LOG_WARN(F("loadScheduleCache: bad records")); // Using F() macro
+    resetStringPool();
+    scheduleCount = 0;
+    return false;
+  }
+  LOG_INFO(F("Loaded "), scheduleCount, F(" schedules from EEPROM, generation "), h.generation); // Using F() macro
+  return true;
+}
+
+uint16_t scheduleCacheSize() {
+  return sizeof(ScheduleCacheHeader) + cacheWriter.header.poolSize +
+         cacheWriter.header.count * sizeof(MedicationTime);
+}
+
+uint8_t scheduleCacheByte(uint16_t pos) {
+  uint16_t poolEnd = sizeof(ScheduleCacheHeader) + cacheWriter.header.poolSize;
+  if (pos < sizeof(ScheduleCacheHeader)) return ((const uint8_t *)&cacheWriter.header)[pos];
+  if (pos < poolEnd) return stringPool[pos - sizeof(ScheduleCacheHeader)];
+  return ((const uint8_t *)schedules)[pos - poolEnd];
+}
+
+// Programs at most one changed byte per call (about 3.3 ms each, in the
+// EEPROM's own time), so even a full rewrite never stalls the loop. A
+// schedule change mid-write just starts the pass again.
+void serviceScheduleCache() {
+  if (!scheduleBaseLoaded) return;  // only mirror what the card holds
+
+  if (cacheWriter.version != scheduleVersion) {
+    ScheduleCacheHeader &h = cacheWriter.header;
+    h.magic = SCHEDULE_CACHE_MAGIC;
+    h.version = SCHEDULE_IMAGE_VERSION;
+    h.recordSize = sizeof(MedicationTime);
+    h.count = scheduleCount;
+    h.reserved = 0;
+    h.poolSize = stringPoolUsed;
+    h.generation = activeScheduleGeneration();
+    h.bodyCrc = scheduleTablesCrc();
+    h.crc = crc16(&h, sizeof(h) - sizeof(h.crc));
+    cacheWriter.version = scheduleVersion;
+    cacheWriter.cursor = 0;
+    cacheWriter.pending = true;
+  }
+  if (!cacheWriter.pending) return;
+
+  uint16_t total = scheduleCacheSize();
+  while (cacheWriter.cursor < total) {
+    if (!eeprom_is_ready()) return;  // reads wait for a write in flight too
+    uint16_t pos = (cacheWriter.cursor + sizeof(ScheduleCacheHeader)) % total;
+    uint8_t b = scheduleCacheByte(pos);
+    cacheWriter.cursor++;
+    if (EEPROM.read(SCHEDULE_CACHE_EEPROM_ADDR + pos) != b) {
+      EEPROM.write(SCHEDULE_CACHE_EEPROM_ADDR + pos, b);
+      return;
+    }
+  }
+  cacheWriter.pending = false;
+  LOG_DEBUG(F("Schedule cache written to EEPROM")); // Using F() macro
+}
+
+// Inventory records rotate through INVENTORY_SLOTS EEPROM slots, one per
+// change, so each cell is rewritten once every INVENTORY_SLOTS doses. The
+// newest valid record wins on boot; a torn one fails its crc and the one
+// before it is used.
+#define INVENTORY_EEPROM_ADDR 1024
+#define INVENTORY_SLOTS 16
+
+struct InventoryRecord {
+  uint16_t seq;  // wraps; newest is the one no other valid record is ahead of
+  uint16_t stock[4];
+  uint16_t crc;
+};
+
+static_assert(SCHEDULE_CACHE_EEPROM_ADDR + sizeof(ScheduleCacheHeader) + STRING_POOL_SIZE +
+                  MAX_SCHEDULES * sizeof(MedicationTime) <= INVENTORY_EEPROM_ADDR,
+              "schedule cache overlaps the inventory records");
+static_assert(INVENTORY_EEPROM_ADDR + INVENTORY_SLOTS * sizeof(InventoryRecord) <= EEPROM_BYTES,
+              "inventory records do not fit the EEPROM");
+
+struct InventoryWriter {
+  bool pending;
+  uint8_t slot;     // of the newest complete record
+  uint8_t cursor;   // bytes of 'record' done
+  InventoryRecord record;
+};
+
+InventoryWriter inventoryWriter = {false, INVENTORY_SLOTS - 1, 0};
+
+void loadInventory() {
+  bool found = false;
+  InventoryRecord best;
+  for (uint8_t slot = 0; slot < INVENTORY_SLOTS; slot++) {
+    InventoryRecord r;
+    EEPROM.get(INVENTORY_EEPROM_ADDR + slot * sizeof(InventoryRecord), r);
+    if (r.crc != crc16(&r, offsetof(InventoryRecord, crc))) continue;
+    if (!found || (int16_t)(r.seq - best.seq) > 0) {
+      best = r;
+      inventoryWriter.slot = slot;
+      found = true;
+    }
+  }
+  if (!found) {
+    LOG_INFO(F("Inventory: no EEPROM record")); // Using F() macro
+    return;
+  }
+  inventoryWriter.record = best;
+  memcpy(inventory.stock, best.stock, sizeof(inventory.stock));
+  updateStockStatus();
+  LOG_INFO(F("Inventory loaded, record "), best.seq); // Using F() macro
+}
+
+// Writes the next record one byte per call, like serviceScheduleCache().
+void serviceInventory() {
+  if (inventory.dirty && !inventoryWriter.pending) {
+    InventoryRecord &r = inventoryWriter.record;
+    r.seq++;
+    memcpy(r.stock, inventory.stock, sizeof(r.stock));
+    r.crc = crc16(&r, offsetof(InventoryRecord, crc));
+    inventoryWriter.slot = (inventoryWriter.slot + 1) % INVENTORY_SLOTS;
+    inventoryWriter.cursor = 0;
+    inventoryWriter.pending = true;
+    inventory.dirty = false;  // a change from here on takes the next slot
+  }
+  while (inventoryWriter.pending && eeprom_is_ready()) {
+    uint16_t addr = INVENTORY_EEPROM_ADDR + inventoryWriter.slot * sizeof(InventoryRecord) + inventoryWriter.cursor;
+    uint8_t b = ((const uint8_t *)&inventoryWriter.record)[inventoryWriter.cursor];
+    if (++inventoryWriter.cursor == sizeof(InventoryRecord)) inventoryWriter.pending = false;
+    if (EEPROM.read(addr) != b) {
+      EEPROM.write(addr, b);
+      break;
+    }
+  }
+}
+
+// Streaming (SAX-style) parser for the schedule JSON. It is fed one byte
+// at a time and writes each time_to_take entry into schedules[] as soon as
+// its object closes, so memory use does not depend on the file size. Text
+// is interned into stringPool and tube names resolved on the way. The
+// expected shape is
+//   [ { "tube": .., "type": .., "amount": .., "time_to_take": [
+//       { "time": "HH:MM", "dosage": .. }, ... ] }, ... ]
+// Keys may come in any order; unknown keys and values are skipped.
+enum JsonParseState : uint8_t {
+  JSON_EXPECT_ROOT,
+  JSON_EXPECT_VALUE,
+  JSON_EXPECT_VALUE_OR_END,  // just after '['
+  JSON_EXPECT_KEY_OR_END,    // just after '{'
+  JSON_EXPECT_KEY,
+  JSON_EXPECT_COLON,
+  JSON_EXPECT_COMMA_OR_END,
+  JSON_IN_STRING,
+  JSON_IN_ESCAPE,
+  JSON_IN_UNICODE,
+  JSON_IN_SCALAR,
+  JSON_DONE,
+  JSON_ERROR
+};
+
+struct ScheduleJsonParser {
+  JsonParseState state;
+  uint8_t depth;
+  uint8_t objectMask;   // bit n set when container at depth n+1 is an object
+  uint8_t valueLen;
+  uint8_t unicodeLeft;
+  bool stringIsKey;
+  bool inTimes;         // inside a medication's "time_to_take" array
+  bool emit;            // false to only validate the syntax
+  char key[JSON_KEY_SIZE];
+  char value[JSON_VALUE_SIZE];
+  unsigned long offset;
+
+  // Fields of the medication/entry currently being parsed.
+  int medFirst;
+  char tube[8];
+  char medication[24];
+  int16_t amount;
+  int entryMinutes;
+  char entryDosage[16];
+  unsigned int dropped;  // no room in schedules[] or stringPool
+};
+
+void jsonParserInit(ScheduleJsonParser &p, bool emit) {
+  memset(&p, 0, sizeof(p));
+  p.state = JSON_EXPECT_ROOT;
+  p.emit = emit;
+}
+
+void copyField(char *dst, size_t size, const char *src) {
+  strncpy(dst, src, size - 1);
+  dst[size - 1] = '\0';
+}
+
+bool jsonTopIsObject(const ScheduleJsonParser &p) {
+  return p.depth > 0 && (p.objectMask & (1 << (p.depth - 1)));
+}
+
+// A complete scalar or string value was read at the current depth.
+void jsonOnValue(ScheduleJsonParser &p, bool isString) {
+  if (!p.emit || !jsonTopIsObject(p)) return;
+
+  if (p.depth == 2) {
+    if (isString && strcmp_P(p.key, PSTR("tube")) == 0) {
+      copyField(p.tube, sizeof(p.tube), p.value);
+    } else if (isString && strcmp_P(p.key, PSTR("type")) == 0) {
+      copyField(p.medication, sizeof(p.medication), p.value);
+    } else if (!isString && strcmp_P(p.key, PSTR("amount")) == 0) {
+      p.amount = atoi(p.value);
+    }
+  } else if (p.depth == 4 && p.inTimes && isString) {
+    if (strcmp_P(p.key, PSTR("time")) == 0) {
+      p.entryMinutes = timeToMinutes(p.value);
+    } else if (strcmp_P(p.key, PSTR("dosage")) == 0) {
+      copyField(p.entryDosage, sizeof(p.entryDosage), p.value);
+    }
+  }
+}
+
+bool jsonPush(ScheduleJsonParser &p, bool isObject) {
+  if (p.depth >= 8) return false;
+
+  if (p.emit) {
+    if (p.depth == 1 && isObject) {
+      p.medFirst = scheduleCount;
+      p.tube[0] = '\0';
+      p.medication[0] = '\0';
+      p.amount = 0;
+    } else if (p.depth == 2 && !isObject && jsonTopIsObject(p) &&
+               strcmp_P(p.key, PSTR("time_to_take")) == 0) {
+      p.inTimes = true;
+    } else if (p.depth == 3 && isObject && p.inTimes) {
+      p.entryMinutes = -1;
+      p.entryDosage[0] = '\0';
+    }
+  }
+
+  if (isObject) p.objectMask |= (1 << p.depth);
+  else p.objectMask &= ~(1 << p.depth);
+  p.depth++;
+  p.state = isObject ? JSON_EXPECT_KEY_OR_END : JSON_EXPECT_VALUE_OR_END;
+  return true;
+}
+
+bool jsonPop(ScheduleJsonParser &p, bool isObject) {
+  if (p.depth == 0 || jsonTopIsObject(p) != isObject) return false;
+
+  if (p.emit) {
+    if (p.depth == 4 && isObject && p.inTimes) {
+      if (p.entryMinutes >= 0) {
+        if (scheduleCount < MAX_SCHEDULES && internString(p.entryDosage, schedules[scheduleCount].dosage)) {
+          schedules[scheduleCount].minutes = p.entryMinutes;
+          scheduleCount++;
+        } else {
+          p.dropped++;
+        }
+      }
+    } else if (p.depth == 3 && !isObject) {
+      p.inTimes = false;
+    } else if (p.depth == 2 && isObject) {
+      // The medication's own fields may follow its time_to_take array, so
+      // they are applied to its entries once the object is complete.
+      TubeMapping *mapping = getTubeMapping(p.tube);
+      uint8_t medication;
+      if (mapping == nullptr || !internString(p.medication, medication)) {
+        if (mapping == nullptr) LOG_WARN(F("Unknown tube in schedule: "), p.tube); // Using F() macro
+        else p.dropped += scheduleCount - p.medFirst;
+        scheduleCount = p.medFirst;
+      }
+      for (int i = p.medFirst; i < scheduleCount; i++) {
+        schedules[i].tube = mapping->servoIndex;
+        schedules[i].medication = medication;
+        schedules[i].amount = p.amount;
+      }
+    }
+  }
+
+  p.depth--;
+  p.state = p.depth == 0 ? JSON_DONE : JSON_EXPECT_COMMA_OR_END;
+  return true;
+}
+
+bool jsonIsSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool jsonIsScalarChar(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+void jsonAppend(ScheduleJsonParser &p, char *buf, uint8_t size, char c) {
+  if (p.valueLen < size - 1) {
+    buf[p.valueLen++] = c;
+    buf[p.valueLen] = '\0';
+  }
+}
+
+// Feeds one byte. Returns false once the input is known to be invalid.
+bool jsonParserFeed(ScheduleJsonParser &p, char c) {
+  p.offset++;
+
+  switch (p.state) {
+    case JSON_IN_STRING:
+      if (c == '\\') {
+        p.state = JSON_IN_ESCAPE;
+      } else if (c == '"') {
+        if (p.stringIsKey) {
+          p.state = JSON_EXPECT_COLON;
+        } else {
+          jsonOnValue(p, true);
+          p.state = JSON_EXPECT_COMMA_OR_END;
+        }
+      } else if (p.stringIsKey) {
+        // Over-long keys are mangled so they cannot match a known key.
+        if (p.valueLen < JSON_KEY_SIZE - 1) jsonAppend(p, p.key, JSON_KEY_SIZE, c);
+        else p.key[0] = '\0';
+      } else {
+        jsonAppend(p, p.value, JSON_VALUE_SIZE, c);
+      }
+      return true;
+
+    case JSON_IN_ESCAPE:
+      if (c == 'u') {
+        p.unicodeLeft = 4;
+        p.state = JSON_IN_UNICODE;
+        c = '?';
+      } else {
+        if (c == 'n' || c == 't' || c == 'r' || c == 'b' || c == 'f') c = ' ';
+        p.state = JSON_IN_STRING;
+      }
+      if (p.stringIsKey) jsonAppend(p, p.key, JSON_KEY_SIZE, c);
+      else jsonAppend(p, p.value, JSON_VALUE_SIZE, c);
+      return true;
+
+    case JSON_IN_UNICODE:
+      if (--p.unicodeLeft == 0) p.state = JSON_IN_STRING;
+      return true;
+
+    case JSON_IN_SCALAR:
+      if (jsonIsScalarChar(c)) {
+        jsonAppend(p, p.value, JSON_VALUE_SIZE, c);
+        return true;
+      }
+      jsonOnValue(p, false);
+      p.state = JSON_EXPECT_COMMA_OR_END;
+      break;  // re-process c below
+
+    default:
+      break;
+  }
+
+  if (jsonIsSpace(c)) return true;
+
+  switch (p.state) {
+    case JSON_EXPECT_ROOT:
+      if (c != '[') {
+        p.state = JSON_ERROR;
+        return false;
+      }
+      return jsonPush(p, false);
+
+    case JSON_EXPECT_VALUE_OR_END:
+      if (c == ']') return jsonPop(p, false) || (p.state = JSON_ERROR, false);
+      // fall through
+    case JSON_EXPECT_VALUE:
+      if (c == '{') return jsonPush(p, true) || (p.state = JSON_ERROR, false);
+      if (c == '[') return jsonPush(p, false) || (p.state = JSON_ERROR, false);
+      p.valueLen = 0;
+      p.value[0] = '\0';
+      if (c == '"') {
+        p.stringIsKey = false;
+        p.state = JSON_IN_STRING;
+        return true;
+      }
+      if (jsonIsScalarChar(c)) {
+        jsonAppend(p, p.value, JSON_VALUE_SIZE, c);
+        p.state = JSON_IN_SCALAR;
+        return true;
+      }
+      break;
+
+    case JSON_EXPECT_KEY_OR_END:
+      if (c == '}') return jsonPop(p, true) || (p.state = JSON_ERROR, false);
+      // fall through
+    case JSON_EXPECT_KEY:
+      if (c == '"') {
+        p.valueLen = 0;
+        p.key[0] = '\0';
+        p.stringIsKey = true;
+        p.state = JSON_IN_STRING;
+        return true;
+      }
+      break;
+
+    case JSON_EXPECT_COLON:
+      if (c == ':') {
+        p.state = JSON_EXPECT_VALUE;
+        return true;
+      }
+      break;
+
+    case JSON_EXPECT_COMMA_OR_END:
+      if (c == ',') {
+        p.state = jsonTopIsObject(p) ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+        return true;
+      }
+      if (c == '}' || c == ']') {
+        return jsonPop(p, c == '}') || (p.state = JSON_ERROR, false);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  p.state = JSON_ERROR;
+  return false;
+}
+
+// Runs the whole file through the parser. Returns true for valid JSON.
+bool parseScheduleFile(File &f, ScheduleJsonParser &p) {
+  ReadBufferingStream in(f, 32);
+  int c;
+  while ((c = in.read()) >= 0) {
+    if (!jsonParserFeed(p, (char)c)) break;
+  }
+  if (p.state == JSON_IN_SCALAR) jsonParserFeed(p, ' ');
+
+  if (p.state != JSON_DONE) {
+    LOG_ERROR(F("JSON parse error at byte "), p.offset); // Using F() macro
+    return false;
+  }
+  return true;
+}
+
+bool loadScheduleJson() {
+  const char *fileName = activeScheduleFile();
+  File f = SD.open(fileName, FILE_READ);
+  if (!f) {
+    LOG_WARN(F("Cannot find "), fileName); // Using F() macro
+    return false;
+  }
+
+  size_t fileSize = f.size();
+  LOG_DEBUG(F("loadScheduleData: fileSize = "), fileSize); // Using F() macro
+  if (slotHeaderValid && fileSize != slotHeader.length) {
+    LOG_WARN(F("loadScheduleData: slot length mismatch")); // Using F() macro
+    f.close();
+    return false;
+  }
+  if (fileSize == 0) {
+    LOG_WARN(F("loadScheduleData: file empty")); // Using F() macro
+    f.close();
+    return false;
+  }
+
+  scheduleCount = 0;
+  resetStringPool();
+
+  ScheduleJsonParser parser;
+  jsonParserInit(parser, true);
+  bool ok = parseScheduleFile(f, parser);
+  f.close();
+
+  if (!ok) {
+    scheduleCount = 0;
+    return false;
+  }
+
+  if (parser.dropped > 0) {
+    LOG_WARN(F("loadScheduleData: schedule table or string pool full, dropped "), parser.dropped, F(" doses")); // Using F() macro
+  }
+  return true;
+}
+
+// Single-dose schedule edits. A dose is addressed by its tube and minute,
+// packed as tube << 11 | minutes (minutes < 2048). Applied edits are
+// journalled in SCHEDULE_PATCH_FILE on top of the live slot file, which is
+// never rewritten; loadScheduleData() replays the journal after the slot
+// (or its image) is loaded, and the next full upload makes it stale.
+#define DOSE_KEY(tube, minutes) ((uint16_t)(tube) << 11 | (minutes))
+#define DOSE_KEY_TUBE(key) ((key) >> 11)
+
+enum SchedulePatchOp : uint8_t {
+  PATCH_ADD_DOSE = 1,     // record
+  PATCH_REMOVE_DOSE = 2,  // key
+  PATCH_MODIFY_DOSE = 3,  // key, record (may move the dose)
+  PATCH_REMOVE_TUBE = 4   // key (tube bits only)
+};
+
+// A dose with its text spelled out. The journal cannot hold pool offsets:
+// the pool is rebuilt on every load, so edits are interned when applied.
+struct DoseRecord {
+  uint16_t minutes;
+  int16_t amount;
+  uint8_t tube;  // tubeMappings[] index
+  char medication[24];
+  char dosage[16];
+};
+
+// One journal record.
+struct SchedulePatch {
+  uint8_t op;
+  uint8_t reserved;
+  uint16_t key;
+  DoseRecord record;
+  uint16_t crc;  // CRC16 of everything above
+};
+
+// Ties the journal to the slot file it edits, like ScheduleImageHeader.
+struct SchedulePatchHeader {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t sourceLength;
+  uint16_t recordSize;  // sizeof(SchedulePatch), so a layout change drops the journal
+  uint16_t crc;
+};
+
+struct PatchJournal {
+  bool valid;     // header on the card matches the live slot
+  uint8_t count;  // records replayed or appended since
+};
+
+PatchJournal patchJournal = {false, 0};
+
+uint16_t doseKey(const MedicationTime &med) {
+  return DOSE_KEY(med.tube, med.minutes);
+}
+
+int findDose(uint16_t key) {
+  for (int i = 0; i < scheduleCount; i++) {
+    if (doseKey(schedules[i]) == key) return i;
+  }
+  return -1;
+}
+
+bool tubeInUse(uint8_t tube) {
+  for (int i = 0; i < scheduleCount; i++) {
+    if (schedules[i].tube == tube) return true;
+  }
+  return false;
+}
+
+// True if 'tube' already holds 'medication', so a dose of it needs no refill.
+bool tubeHolds(uint8_t tube, uint8_t medication) {
+  for (int i = 0; i < scheduleCount; i++) {
+    if (schedules[i].tube == tube && schedules[i].medication == medication) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t groupSizeAt(uint16_t minutes) {
+  int g = findGroupAt(minutes);
+  return g == -1 ? 0 : groupedSchedules[g].count;
+}
+
+// Whether 'patch' applies to the current schedules[]; an UploadStatus.
+uint8_t checkSchedulePatch(const SchedulePatch &patch) {
+  int index;
+  uint16_t newKey = DOSE_KEY(patch.record.tube, patch.record.minutes);
+
+  switch (patch.op) {
+    case PATCH_ADD_DOSE:
+      if (findDose(newKey) != -1) return UPLOAD_PATCH_MISMATCH;
+      if (scheduleCount >= MAX_SCHEDULES || groupSizeAt(patch.record.minutes) >= MAX_MEDS_PER_TIME) {
+        return UPLOAD_PATCH_FULL;
+      }
+      // A new dose minute needs a free group
+      if (findGroupAt(patch.record.minutes) == -1 && groupedCount >= MAX_GROUPED) return UPLOAD_PATCH_FULL;
+      return UPLOAD_OK;
+
+    case PATCH_REMOVE_DOSE:
+      return findDose(patch.key) != -1 ? UPLOAD_OK : UPLOAD_PATCH_MISMATCH;
+
+    case PATCH_MODIFY_DOSE:
+      index = findDose(patch.key);
+      if (index == -1) return UPLOAD_PATCH_MISMATCH;
+      if (newKey != patch.key && findDose(newKey) != -1) return UPLOAD_PATCH_MISMATCH;
+      if (patch.record.minutes != schedules[index].minutes) {
+        if (groupSizeAt(patch.record.minutes) >= MAX_MEDS_PER_TIME) return UPLOAD_PATCH_FULL;
+        // Moving to a new minute needs a free group, unless the dose
+        // leaves one behind by being the last at its old minute
+        if (findGroupAt(patch.record.minutes) == -1 && groupedCount >= MAX_GROUPED &&
+            groupSizeAt(schedules[index].minutes) > 1) {
+          return UPLOAD_PATCH_FULL;
+        }
+      }
+      return UPLOAD_OK;
+
+    case PATCH_REMOVE_TUBE:
+      return tubeInUse(DOSE_KEY_TUBE(patch.key)) ? UPLOAD_OK : UPLOAD_PATCH_MISMATCH;
+
+    default:
+      return UPLOAD_PATCH_MISMATCH;
+  }
+}
+
+// checkSchedulePatch(), then the new dose's text interned into 'dose'.
+uint8_t prepareSchedulePatch(const SchedulePatch &patch, MedicationTime &dose) {
+  uint8_t status = checkSchedulePatch(patch);
+  if (status != UPLOAD_OK || (patch.op != PATCH_ADD_DOSE && patch.op != PATCH_MODIFY_DOSE)) return status;
+
+  dose.minutes = patch.record.minutes;
+  dose.amount = patch.record.amount;
+  dose.tube = patch.record.tube;
+  if (!internString(patch.record.medication, dose.medication) || !internString(patch.record.dosage, dose.dosage)) {
+    return UPLOAD_PATCH_FULL;
+  }
+  return UPLOAD_OK;
+}
+
+// Applies a patch that passed prepareSchedulePatch(), which filled 'dose'.
+// Callers finish with scheduleChanged().
+void applySchedulePatch(const SchedulePatch &patch, const MedicationTime &dose) {
+  int index;
+  switch (patch.op) {
+    case PATCH_ADD_DOSE:
+      index = scheduleCount++;
+      schedules[index] = dose;
+      if (!groupInsertDose(index)) LOG_ERROR(F("Patch: no group for the new dose")); // Using F() macro
+      break;
+
+    case PATCH_REMOVE_DOSE:
+      removeScheduleEntry(findDose(patch.key));
+      break;
+
+    case PATCH_MODIFY_DOSE:
+      index = findDose(patch.key);
+      groupRemoveDose(index);
+      schedules[index] = dose;
+      if (!groupInsertDose(index)) LOG_ERROR(F("Patch: no group for the moved dose")); // Using F() macro
+      break;
+
+    case PATCH_REMOVE_TUBE:
+      for (int i = scheduleCount - 1; i >= 0; i--) {
+        if (schedules[i].tube == DOSE_KEY_TUBE(patch.key)) removeScheduleEntry(i);
+      }
+      break;
+  }
+}
+
+// Appends to the journal, starting a fresh one if it belongs to an older
+// slot. Records go at the position after the last good one, so a torn
+// write left by a power cut is overwritten rather than replayed past.
+uint8_t appendSchedulePatch(SchedulePatch &patch) {
+  if (patchJournal.valid && patchJournal.count >= SCHEDULE_PATCH_MAX) return UPLOAD_PATCH_FULL;
+  if (!acquireSD()) return UPLOAD_SAVE_FAILED;
+
+  File f;
+  if (!patchJournal.valid) {
+    SchedulePatchHeader h;
+    h.magic = SCHEDULE_PATCH_MAGIC;
+    h.generation = activeScheduleGeneration();
+    h.sourceLength = activeScheduleLength();
+    h.recordSize = sizeof(SchedulePatch);
+    h.crc = crc16(&h, sizeof(h) - sizeof(h.crc));
+
+    f = SD.open(SCHEDULE_PATCH_FILE, O_WRITE | O_CREAT | O_TRUNC);
+    if (!f || f.write(&h, sizeof(h)) != sizeof(h)) {
+      if (f) f.close();
+      reportSDError(F("appendSchedulePatch"));
+      return UPLOAD_SAVE_FAILED;
+    }
+    patchJournal.valid = true;
+    patchJournal.count = 0;
+  } else {
+    f = SD.open(SCHEDULE_PATCH_FILE, O_RDWR);
+    if (!f) {
+      reportSDError(F("appendSchedulePatch"));
+      return UPLOAD_SAVE_FAILED;
+    }
+  }
+
+  uint32_t pos = sizeof(SchedulePatchHeader) + (uint32_t)patchJournal.count * sizeof(SchedulePatch);
+  patch.crc = crc16(&patch, sizeof(patch) - sizeof(patch.crc));
+  bool ok = (f.size() <= pos || f.truncate(pos)) && f.seekSet(pos) &&
+            f.write(&patch, sizeof(patch)) == sizeof(patch) && f.sync();
+  f.close();
+  if (!ok) {
+    reportSDError(F("appendSchedulePatch"));
+    return UPLOAD_SAVE_FAILED;
+  }
+  patchJournal.count++;
+  return UPLOAD_OK;
+}
+
+// Re-applies the journalled edits to a freshly loaded schedules[]. Stops
+// at the first torn or inapplicable record; a stale journal is deleted.
+void replaySchedulePatches() {
+  patchJournal.valid = false;
+  patchJournal.count = 0;
+
+  File f = SD.open(SCHEDULE_PATCH_FILE, FILE_READ);
+  if (!f) return;
+
+  SchedulePatchHeader h;
+  if (f.read(&h, sizeof(h)) != (int)sizeof(h) || h.magic != SCHEDULE_PATCH_MAGIC ||
+      h.crc != crc16(&h, sizeof(h) - sizeof(h.crc)) || h.recordSize != sizeof(SchedulePatch) ||
+      h.generation != activeScheduleGeneration() || h.sourceLength != activeScheduleLength()) {
+    f.close();
+    SD.remove(SCHEDULE_PATCH_FILE);
+    LOG_DEBUG(F("replaySchedulePatches: dropped stale journal")); // Using F() macro
+    return;
+  }
+
+  patchJournal.valid = true;
+  SchedulePatch patch;
+  MedicationTime dose;
+  while (patchJournal.count < SCHEDULE_PATCH_MAX && f.read(&patch, sizeof(patch)) == (int)sizeof(patch)) {
+    if (patch.crc != crc16(&patch, sizeof(patch) - sizeof(patch.crc)) ||
+        prepareSchedulePatch(patch, dose) != UPLOAD_OK) {
+      LOG_WARN(F("replaySchedulePatches: stopped at record "), patchJournal.count); // Using F() macro
+      break;
+    }
+    applySchedulePatch(patch, dose);
+    patchJournal.count++;
+  }
+  f.close();
+  LOG_DEBUG(F("replaySchedulePatches: applied "), patchJournal.count); // Using F() macro
+}
+
+bool loadScheduleData() {
+  scheduleBaseLoaded = false;
+  if (!acquireSD()) {
+    LOG_ERROR(F("loadScheduleData: SD mount failed")); // Using F() macro
+    return false;
+  }
+
+  if (loadScheduleImage()) {
+    LOG_DEBUG(F("loadScheduleData: using schedule image")); // Using F() macro
+  } else {
+    if (!loadScheduleJson()) return false;
+    if (!saveScheduleImage()) {
+      LOG_WARN(F("loadScheduleData: could not cache schedule image")); // Using F() macro
+    }
+  }
+  scheduleBaseLoaded = true;
+
+  // The image caches the slot file only; edits are replayed on top
+  groupMedicationsByTime();
+  replaySchedulePatches();
+  if (patchJournal.count > 0) scheduleChanged();
+  LOG_INFO(F("Loaded "), scheduleCount, F(" medication schedules")); // Using F() macro
+
+  return scheduleCount > 0;
+}
+
+// Glyph source for drawTextRun(). The classic font table is private to
+// Adafruit_GFX.cpp, so instead of compiling a second copy here each
+// character is drawn into this one-bit canvas and read back.
+GFXcanvas1 glyphCanvas(8, 8);
+#define TEXT_RUN_MAX 53  // size 1 characters across the 320 px display
+
+// Column bytes of glyph c, top row in bit 0, as in the font table.
+void readGlyph(uint8_t c, uint8_t *columns) {
+  glyphCanvas.drawChar(0, 0, c, 1, 0, 1);  // applies GFX's cp437 offset too
+  const uint8_t *rows = glyphCanvas.getBuffer();
+  for (uint8_t col = 0; col < 5; col++) {
+    uint8_t bits = 0;
+    for (uint8_t row = 0; row < 8; row++) {
+      if (rows[row] & (0x80 >> col)) bits |= 1 << row;
+    }
+    columns[col] = bits;
+  }
+}
+
+// Draws len characters of the classic font as one opaque block: a single
+// address window for the whole line, filled with run-length colour writes.
+// Adafruit_GFX::drawChar() opens a window per pixel at size 1, which is what
+// made text-heavy screens slow. Returns the x just past the run.
+int16_t drawTextRun(int16_t x, int16_t y, const char *text, uint8_t len,
+                    uint16_t fg, uint16_t bg, uint8_t size = 1) {
+  int16_t maxChars = (tft.width() - x) / (6 * size);
+  if (maxChars <= 0) return x;
+  if (len > maxChars) len = maxChars;
+  if (len > TEXT_RUN_MAX) len = TEXT_RUN_MAX;
+  if (len == 0) return x;
+
+  // Pixel rows of the run that are on the panel; the controller RAM past
+  // the visible area must not be written
+  int16_t h = 8 * size;
+  if (y >= tft.height() || y + h <= 0) return x;
+  int16_t top = y < 0 ? -y : 0;
+  if (y + h > tft.height()) h = tft.height() - y;
+
+  uint8_t glyphs[TEXT_RUN_MAX * 5];
+  for (uint8_t i = 0; i < len; i++) readGlyph(text[i], &glyphs[i * 5]);
+
+  int16_t w = len * 6 * size;
+  tft.startWrite();
+  tft.setAddrWindow(x, y + top, w, h - top);
+
+  uint16_t runColor = bg;
+  uint32_t run = 0;
+  for (int16_t line = top; line < h; line++) {
+    uint8_t row = line / size;
+    for (uint8_t i = 0; i < len; i++) {
+      for (uint8_t col = 0; col < 6; col++) {
+        uint8_t bits = col < 5 ? glyphs[i * 5 + col] : 0;
+        uint16_t color = (bits >> row) & 1 ? fg : bg;
+        if (color != runColor && run) {
+          tft.writeColor(runColor, run);
+          run = 0;
+        }
+        runColor = color;
+        run += size;
+      }
+    }
+  }
+  if (run) tft.writeColor(runColor, run);
+
+  tft.endWrite();
+  return x + w;
+}
+
+int16_t drawTextLine(int16_t x, int16_t y, const char *text,
+                     uint16_t fg, uint16_t bg, uint8_t size = 1) {
+  size_t len = strlen(text);
+  return drawTextRun(x, y, text, len > 255 ? 255 : len, fg, bg, size);
+}
+
+// Anything drawn outside showMainMenu() must call this so the next refresh
+// repaints the whole screen.
+void invalidateUi() {
+  drawnUi.screen = UI_SCREEN_NONE;
+}
+
+// A message screen drawn outside showMainMenu() that must stay up for a
+// while; 0 = none.
+#define UI_HOLD_MS 3000
+unsigned long uiHoldSince = 0;
+
+// Screen layouts. The fixed boxes and text of each screen are a PROGMEM
+// table that drawLayout() walks; text that changes is a LAYOUT_FIELD item
+// filled in by formatLayoutField() when it is drawn. The update functions
+// compare drawnUi with the live state and pass the field that changed, so
+// the same table drives the full paint and the in-place repaints.
+enum LayoutOp : uint8_t {
+  LAYOUT_END,
+  LAYOUT_FILL,   // w x h box in fg
+  LAYOUT_FRAME,  // w x h outline in fg
+  LAYOUT_TEXT,   // text, in flash
+  LAYOUT_FIELD   // formatLayoutField(field)
+};
+
+enum LayoutField : uint8_t {
+  FIELD_NONE,  // fixed item; drawLayout(layout, FIELD_NONE) draws only these
+  FIELD_CLOCK,
+  FIELD_DATE,
+  FIELD_STATUS,
+  FIELD_STOCK,
+  FIELD_REFILL,
+  FIELD_UPLOAD_BYTES,
+  FIELD_SETUP_STEP,
+  FIELD_SETUP_MEDICATION,
+  FIELD_SETUP_DOSAGE,
+  FIELD_SETUP_TUBE,
+  FIELD_SETUP_HINT,
+  FIELD_SETUP_HINT2,
+  FIELD_SCHEDULE_TOTALS,
+  FIELD_ALERT_TITLE,
+  FIELD_ALERT_PROMPT,
+  FIELD_ALERT_COUNTDOWN
+};
+
+#define LAYOUT_ALL 0xFF  // drawLayout(): fixed items and every field
+
+struct LayoutItem {
+  uint8_t op;
+  uint8_t field;
+  int16_t x, y;
+  int16_t w, h;  // LAYOUT_FILL/LAYOUT_FRAME
+  uint16_t fg, bg;
+  uint8_t size;
+  const char *text;  // LAYOUT_TEXT
+};
+
+#define LAYOUT_BOX(x, y, w, h, color) {LAYOUT_FILL, FIELD_NONE, x, y, w, h, color, 0, 0, nullptr}
+#define LAYOUT_OUTLINE(x, y, w, h, color) {LAYOUT_FRAME, FIELD_NONE, x, y, w, h, color, 0, 0, nullptr}
+#define LAYOUT_LABEL(x, y, text, fg, bg, size) {LAYOUT_TEXT, FIELD_NONE, x, y, 0, 0, fg, bg, size, text}
+#define LAYOUT_VALUE(x, y, field, fg, bg, size) {LAYOUT_FIELD, field, x, y, 0, 0, fg, bg, size, nullptr}
+#define LAYOUT_DONE {LAYOUT_END, FIELD_NONE, 0, 0, 0, 0, 0, 0, 0, nullptr}
+#define LAYOUT_LINE_MAX 40  // longest label or field, with the terminator
+
+const char textStatus[] PROGMEM = "STATUS: ";
+const char textNoData[] PROGMEM = "NO SCHEDULE DATA";
+const char textLoadSchedule[] PROGMEM = "Please load medication";
+const char textViaApp[] PROGMEM = "schedule via app";
+const char textReceiving[] PROGMEM = "RECEIVING";
+const char textSchedule[] PROGMEM = "SCHEDULE";
+const char textTubeSetup[] PROGMEM = "TUBE SETUP";
+const char textPutMedication[] PROGMEM = "Put this medication:";
+const char textSetup[] PROGMEM = "SETUP";
+const char textComplete[] PROGMEM = "COMPLETE!";
+const char textSystemReady[] PROGMEM = "System ready for";
+const char textAutomatic[] PROGMEM = "automatic dispensing";
+const char textScheduleTitle[] PROGMEM = "MEDICATION SCHEDULE";
+const char textAutoRefresh[] PROGMEM = "Auto-refresh: 1 min";
+const char textDropPrompt[] PROGMEM = "DROP:take 2x:skip hold:snooze";
+#define ALERT_PROMPT_WIDTH ((int)sizeof(textDropPrompt) - 1)  // both prompt lines, see FIELD_ALERT_PROMPT
+
+const LayoutItem headerLayout[] PROGMEM = {
+  LAYOUT_BOX(0, 0, 320, 35, ST77XX_BLUE),
+  LAYOUT_LABEL(200, 8, textStatus, ST77XX_WHITE, ST77XX_BLUE, 1),
+  LAYOUT_BOX(290, 8, 20, 12, ST77XX_GREEN),  // battery
+  LAYOUT_OUTLINE(289, 7, 22, 14, ST77XX_WHITE),
+  LAYOUT_BOX(311, 10, 3, 8, ST77XX_WHITE),
+  LAYOUT_VALUE(10, 8, FIELD_CLOCK, ST77XX_WHITE, ST77XX_BLUE, 2),
+  LAYOUT_VALUE(10, 22, FIELD_DATE, ST77XX_WHITE, ST77XX_BLUE, 1),
+  LAYOUT_VALUE(248, 8, FIELD_STATUS, ST77XX_GREEN, ST77XX_BLUE, 1),
+  LAYOUT_VALUE(100, 8, FIELD_STOCK, ST77XX_WHITE, ST77XX_BLUE, 1),
+  LAYOUT_VALUE(100, 22, FIELD_REFILL, ST77XX_YELLOW, ST77XX_BLUE, 1),
+  LAYOUT_DONE
+};
+
+const LayoutItem noDataLayout[] PROGMEM = {
+  LAYOUT_LABEL(50, 90, textNoData, ST77XX_RED, ST77XX_BLACK, 2),
+  LAYOUT_LABEL(50, 120, textLoadSchedule, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_LABEL(50, 135, textViaApp, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_DONE
+};
+
+const LayoutItem uploadLayout[] PROGMEM = {
+  LAYOUT_LABEL(50, 60, textReceiving, ST77XX_CYAN, ST77XX_BLACK, 2),
+  LAYOUT_LABEL(50, 80, textSchedule, ST77XX_CYAN, ST77XX_BLACK, 2),
+  LAYOUT_VALUE(50, 180, FIELD_UPLOAD_BYTES, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_DONE
+};
+
+// One step of tube setup; the progress fill is drawn by drawTubeSetupStep().
+const LayoutItem setupLayout[] PROGMEM = {
+  LAYOUT_BOX(0, 35, 320, 205, ST77XX_BLACK),
+  LAYOUT_LABEL(50, 50, textTubeSetup, ST77XX_YELLOW, ST77XX_BLACK, 2),
+  LAYOUT_VALUE(20, 80, FIELD_SETUP_STEP, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_LABEL(20, 100, textPutMedication, ST77XX_CYAN, ST77XX_BLACK, 1),
+  LAYOUT_VALUE(20, 120, FIELD_SETUP_MEDICATION, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_VALUE(20, 135, FIELD_SETUP_DOSAGE, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_VALUE(20, 160, FIELD_SETUP_TUBE, ST77XX_GREEN, ST77XX_BLACK, 1),
+  LAYOUT_VALUE(20, 190, FIELD_SETUP_HINT, ST77XX_YELLOW, ST77XX_BLACK, 1),
+  LAYOUT_VALUE(20, 205, FIELD_SETUP_HINT2, ST77XX_YELLOW, ST77XX_BLACK, 1),
+  LAYOUT_OUTLINE(20, 230, 280, 10, ST77XX_WHITE),
+  LAYOUT_DONE
+};
+
+const LayoutItem setupCompleteLayout[] PROGMEM = {
+  LAYOUT_LABEL(50, 100, textSetup, ST77XX_GREEN, ST77XX_BLACK, 2),
+  LAYOUT_LABEL(50, 130, textComplete, ST77XX_GREEN, ST77XX_BLACK, 2),
+  LAYOUT_LABEL(20, 170, textSystemReady, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_LABEL(20, 185, textAutomatic, ST77XX_WHITE, ST77XX_BLACK, 1),
+  LAYOUT_DONE
+};
+
+// Around the cards, which drawScheduleCards() lays out itself.
+const LayoutItem scheduleLayout[] PROGMEM = {
+  LAYOUT_BOX(0, 40, 320, 200, ST77XX_BLACK),
+  LAYOUT_LABEL(10, 45, textScheduleTitle, ST77XX_CYAN, ST77XX_BLACK, 1),
+  LAYOUT_VALUE(10, 228, FIELD_SCHEDULE_TOTALS, ST77XX_CYAN, ST77XX_BLACK, 1),
+  LAYOUT_LABEL(200, 228, textAutoRefresh, ST77XX_CYAN, ST77XX_BLACK, 1),
+  LAYOUT_DONE
+};
+
+// The message box and its text are sized to the message, see
+// drawNotificationChrome(); the footer lines are placed for the short box
+// and moved down with drawLayout()'s dy for the tall one.
+const LayoutItem notificationLayout[] PROGMEM = {
+  LAYOUT_VALUE(15, 90, FIELD_ALERT_TITLE, ST77XX_WHITE, ST77XX_RED, 1),
+  LAYOUT_DONE
+};
+
+const LayoutItem notificationFooterLayout[] PROGMEM = {
+  LAYOUT_VALUE(15, 135, FIELD_ALERT_PROMPT, ST77XX_WHITE, ST77XX_RED, 1),
+  LAYOUT_VALUE(15, 145, FIELD_ALERT_COUNTDOWN, ST77XX_WHITE, ST77XX_RED, 1),
+  LAYOUT_DONE
+};
+
+// Text of a field from the live state. fg arrives as the table colour and
+// may be changed; an empty line draws nothing. Fixed-width fields pad with
+// spaces so a shorter value covers the longer one before it.
+void formatLayoutField(uint8_t field, char *line, size_t size, uint16_t &fg) {
+  line[0] = '\0';
+  switch (field) {
+    case FIELD_CLOCK:
+      snprintf_P(line, size, PSTR("%02u:%02u"), rtctime.hour(), rtctime.minute());
+      break;
+    case FIELD_DATE:
+      snprintf_P(line, size, PSTR("%u/%u/%u  "), rtctime.day(), rtctime.month(), rtctime.year());
+      break;
+    case FIELD_STATUS:
+      fg = filestat ? ST77XX_GREEN : ST77XX_RED;
+      strcpy_P(line, filestat ? PSTR("READY") : PSTR("ERROR"));
+      break;
+    case FIELD_STOCK:
+      // Days the emptiest tube has left
+      if (inventory.lowMask) fg = ST77XX_YELLOW;
+      if (inventory.minDays < 0) snprintf_P(line, size, PSTR("STOCK  -   "));
+      else snprintf_P(line, size, PSTR("STOCK %3dd "), inventory.minDays < 999 ? inventory.minDays : 999);
+      break;
+    case FIELD_REFILL: {
+      // Tubes due for a refill
+      int n = snprintf_P(line, size, PSTR("%s"), inventory.lowMask ? "REFILL" : "");
+      for (uint8_t t = 0; t < 4; t++) {
+        if (inventory.lowMask & (1 << t)) n += snprintf_P(line + n, size - n, PSTR(" %u"), t + 1);
+      }
+      snprintf_P(line + n, size - n, PSTR("%*s"), n < 14 ? 14 - n : 0, "");
+      break;
+    }
+    case FIELD_UPLOAD_BYTES:
+      snprintf_P(line, size, PSTR("%lu bytes  "), uploadStats.bytesReceived);
+      break;
+    case FIELD_SETUP_STEP:
+      snprintf_P(line, size, PSTR("Tube %d of %d"), currentTubeSetup + 1, totalTubesNeeded);
+      break;
+    case FIELD_SETUP_MEDICATION:
+    case FIELD_SETUP_DOSAGE:
+    case FIELD_SETUP_TUBE:
+      if (currentTubeSetup < totalTubesNeeded) {
+        const MedicationTime &med = schedules[setupSchedules[currentTubeSetup]];
+        if (field == FIELD_SETUP_TUBE) snprintf_P(line, size, PSTR("Into TUBE %u"), setupTubes[currentTubeSetup] + 1);
+        else snprintf_P(line, size, PSTR("%s"), poolString(field == FIELD_SETUP_MEDICATION ? med.medication : med.dosage));
+      }
+      break;
+    case FIELD_SETUP_HINT:
+      if (waitingForDropButton) {
+        if ((millis() / 500) % 2 == 0) fg = ST77XX_BLACK;  // blinks
+        strcpy_P(line, PSTR("Press DROP button when done"));
+      } else {
+        strcpy_P(line, PSTR("Place medication in tube"));
+      }
+      break;
+    case FIELD_SETUP_HINT2:
+      if (!waitingForDropButton) strcpy_P(line, PSTR("then press DROP button"));
+      break;
+    case FIELD_SCHEDULE_TOTALS:
+      snprintf_P(line, size, PSTR("Total schedules: %d (%d doses)"), groupedCount, scheduleCount);
+      break;
+    case FIELD_ALERT_TITLE:
+      if ((millis() / 500) % 2 == 0) fg = ST77XX_YELLOW;  // blinks
+      strcpy_P(line, PSTR("MEDICATION ALERT!"));
+      break;
+    case FIELD_ALERT_PROMPT: {
+      // Either message is set to the width of the button prompt, so the
+      // one drawn over the other covers it
+      char text[LAYOUT_LINE_MAX];
+      if (isDispensing()) {
+        // current passes count once the last drop is done and tubes close
+        int progress = dispenseJob.current;
+        snprintf_P(text, sizeof(text), PSTR("Dispensing %d of %d..."),
+                   progress < dispenseJob.count ? progress + 1 : dispenseJob.count, dispenseJob.count);
+      } else {
+        strcpy_P(text, textDropPrompt);
+      }
+      snprintf_P(line, size, PSTR("%-*.*s"), ALERT_PROMPT_WIDTH, ALERT_PROMPT_WIDTH, text);
+      break;
+    }
+    case FIELD_ALERT_COUNTDOWN: {
+      unsigned long elapsed = millis() - notificationStartTime;
+      snprintf_P(line, size, PSTR("Auto-dismiss in %ds  "), elapsed >= 300000 ? 0 : 300 - (int)(elapsed / 1000));
+      break;
+    }
+  }
+}
+
+// Draws the items of layout for field (FIELD_NONE: fixed items only,
+// LAYOUT_ALL: everything), dy pixels lower than the table says.
+void drawLayout(const LayoutItem *layout, uint8_t field = LAYOUT_ALL, int16_t dy = 0) {
+  char line[LAYOUT_LINE_MAX];
+  for (;; layout++) {
+    LayoutItem item;
+    memcpy_P(&item, layout, sizeof(item));
+    if (item.op == LAYOUT_END) return;
+    if (field != LAYOUT_ALL && item.field != field) continue;
+
+    int16_t y = item.y + dy;
+    switch (item.op) {
+      case LAYOUT_FILL:
+        tft.fillRect(item.x, y, item.w, item.h, item.fg);
+        break;
+      case LAYOUT_FRAME:
+        tft.drawRect(item.x, y, item.w, item.h, item.fg);
+        break;
+      case LAYOUT_TEXT:
+        strcpy_P(line, item.text);
+        drawTextLine(item.x, y, line, item.fg, item.bg, item.size);
+        break;
+      case LAYOUT_FIELD:
+        formatLayoutField(item.field, line, sizeof(line), item.fg);
+        if (line[0]) drawTextLine(item.x, y, line, item.fg, item.bg, item.size);
+        break;
+    }
+  }
+}
+
+void drawHeader() {
+  drawLayout(headerLayout);
+}
+
+void updateHeader() {
+  int16_t clockMinute = currentMinuteOfDay();
+  if (drawnUi.clockMinute != clockMinute || drawnUi.day != rtctime.day()) {
+    // The size 2 clock overlaps the top of the date, so they go together
+    drawLayout(headerLayout, FIELD_CLOCK);
+    drawLayout(headerLayout, FIELD_DATE);
+    drawnUi.clockMinute = clockMinute;
+    drawnUi.day = rtctime.day();
+  }
+  if (drawnUi.status != filestat) {
+    drawLayout(headerLayout, FIELD_STATUS);
+    drawnUi.status = filestat;
+  }
+  if (drawnUi.stockDays != inventory.minDays || drawnUi.lowMask != inventory.lowMask) {
+    drawLayout(headerLayout, FIELD_STOCK);
+    drawLayout(headerLayout, FIELD_REFILL);
+    drawnUi.stockDays = inventory.minDays;
+    drawnUi.lowMask = inventory.lowMask;
+  }
+}
+
+void drawGroupedMedicationCard(int x, int y, int width, int height, const GroupedMedication &group, bool isNext = false) {
+  uint16_t cardColor = isNext ? ST77XX_YELLOW : ST77XX_WHITE;
+  uint16_t textColor = isNext ? ST77XX_BLACK : ST77XX_BLACK;
+  const MedicationTime &first = schedules[group.members[0]];
+  char line[52];
+
+  tft.fillRoundRect(x, y, width, height, 8, cardColor);
+  tft.drawRoundRect(x, y, width, height, 8, isNext ? ST77XX_RED : ST77XX_BLUE);
+
+  snprintf_P(line, sizeof(line), PSTR("%02u:%02u"), group.minutes / 60, group.minutes % 60);
+  drawTextLine(x + 8, y + 8, line, textColor, cardColor, 2);
+
+  if (group.count > 1) {
+    snprintf_P(line, sizeof(line), PSTR("%u MEDS"), group.count);
+    drawTextLine(x + width - 50, y + 8, line, ST77XX_RED, cardColor);
+  }
+
+  snprintf_P(line, sizeof(line), PSTR("%s - %s"), poolString(first.medication), poolString(first.dosage));
+  drawTextLine(x + 8, y + 32, line, textColor, cardColor);
+
+  if (group.count > 1) {
+    const MedicationTime &second = schedules[group.members[1]];
+    snprintf_P(line, sizeof(line), PSTR("%s - %s"), poolString(second.medication), poolString(second.dosage));
+    drawTextLine(x + 8, y + 45, line, textColor, cardColor);
+  }
+
+  if (group.count > 2) {
+    snprintf_P(line, sizeof(line), PSTR("+ %u more medications"), group.count - 2);
+  } else if (group.count == 2) {
+    snprintf_P(line, sizeof(line), PSTR("%s, %s"), tubeMappings[first.tube].tubeName,
+               tubeMappings[schedules[group.members[1]].tube].tubeName);
+  } else {
+    snprintf_P(line, sizeof(line), PSTR("%s"), tubeMappings[first.tube].tubeName);
+  }
+  drawTextLine(x + 8, y + 58, line, textColor, cardColor);
+
+  if (isNext) {
+    drawTextLine(x + width - 35, y + height - 15, "NEXT", ST77XX_RED, cardColor);
+  }
+}
+
+int notificationHeight() {
+  return strlen(notificationMessage) > 50 ? 100 : 80;
+}
+
+// Box and message text; drawn once when the notification appears.
+void drawNotificationChrome() {
+  int notifHeight = notificationHeight();
+  initLoadingBar(dispenseBar, 10, 80 + notifHeight + 10, 300, 10);
+
+  tft.fillRect(10, 80, 300, notifHeight, ST77XX_RED);
+  tft.drawRect(9, 79, 302, notifHeight + 2, ST77XX_WHITE);
+
+  int lineY = 105;
+  int charsPerLine = 35;
+  
+  int msgLen = strlen(notificationMessage);
+  int pos = 0;
+  
+  while (pos < msgLen && lineY < 80 + notifHeight - 20) {
+    int lineEnd = pos + charsPerLine;
+    if (lineEnd > msgLen) lineEnd = msgLen;
+    
+    if (lineEnd < msgLen) {
+      while (lineEnd > pos && notificationMessage[lineEnd] != ' ') {
+        lineEnd--;
+      }
+      if (lineEnd == pos) lineEnd = pos + charsPerLine;
+    }
+    
+    drawTextRun(15, lineY, notificationMessage + pos, lineEnd - pos, ST77XX_WHITE, ST77XX_RED);
+    
+    pos = lineEnd;
+    if (pos < msgLen && notificationMessage[pos] == ' ') pos++;
+    lineY += 12;
+  }
+}
+
+// Blinking title, dispense progress and countdown; each redrawn only when
+// its value changes.
+void updateNotification() {
+  int16_t dy = notificationHeight() - 80;
+  unsigned long elapsed = millis() - notificationStartTime;
+
+  int8_t blink = (millis() / 500) % 2;
+  if (drawnUi.blink != blink) {
+    drawLayout(notificationLayout, FIELD_ALERT_TITLE);
+    drawnUi.blink = blink;
+  }
+
+  int8_t progress = isDispensing() ? dispenseJob.current : -1;
+  if (drawnUi.progress != progress) {
+    drawLayout(notificationFooterLayout, FIELD_ALERT_PROMPT, dy);
+    if (progress >= 0) {
+      drawLoadingBar(dispenseBar, (progress * 100) / dispenseJob.count);
+    }
+    drawnUi.progress = progress;
+  }
+
+  int16_t countdown = elapsed >= 300000 ? 0 : 300 - elapsed / 1000;
+  if (drawnUi.countdown != countdown) {
+    drawLayout(notificationFooterLayout, FIELD_ALERT_COUNTDOWN, dy);
+    drawnUi.countdown = countdown;
+  }
+
+  if (elapsed > 300000 && !isDispensing()) {
+    showNotification = false;
+    uiRefreshPending = true;
+  }
+}
+
+// Walks the user through loading each tube in tubeMask that the schedule uses.
+void startTubeSetupMode(uint8_t tubeMask) {
+  setupMode = true;
+  currentTubeSetup = 0;
+  waitingForDropButton = false;
+  
+  totalTubesNeeded = 0;
+  uint8_t seenTubes = 0;  // bit per tubeMappings[] entry
+  
+  // One pass over the schedules, in order of first use of each tube
+  for (int i = 0; i < scheduleCount; i++) {
+    uint8_t bit = 1 << schedules[i].tube;
+    if ((tubeMask & bit) && !(seenTubes & bit)) {
+      seenTubes |= bit;
+      setupTubes[totalTubesNeeded] = schedules[i].tube;
+      setupSchedules[totalTubesNeeded] = i;
+      totalTubesNeeded++;
+    }
+  }
+  
+  LOG_INFO(F("Starting tube setup mode"));
+  LOG_DEBUG(F("Total unique tubes to configure: "), totalTubesNeeded);
+  
+  // Debug: Print all unique tubes found
+  LOG_DEBUG(F("Unique tubes found:"));
+  for (int i = 0; i < totalTubesNeeded; i++) {
+    LOG_DEBUG(F("- "), tubeMappings[setupTubes[i]].tubeName);
+  }
+
+  if (totalTubesNeeded == 0) {
+    setupMode = false;
+  }
+}
+
+// Static part of the current setup step; redrawn when the step changes.
+void drawTubeSetupStep() {
+  drawLayout(setupLayout);
+
+  // Progress bar fill, inside the outline from setupLayout
+  int progress = (currentTubeSetup * 280) / totalTubesNeeded;
+  tft.fillRect(21, 231, progress, 8, ST77XX_GREEN);
+}
+
+void updateTubeSetupScreen() {
+  if (drawnUi.progress != currentTubeSetup) {
+    drawTubeSetupStep();
+    drawnUi.progress = currentTubeSetup;
+    drawnUi.blink = -1;
+  }
+
+  if (waitingForDropButton) {
+    int8_t blink = (millis() / 500) % 2;
+    if (drawnUi.blink != blink) {
+      drawLayout(setupLayout, FIELD_SETUP_HINT);
+      drawnUi.blink = blink;
+    }
+  }
+}
+
+void handleTubeSetupButton() {
+  LOG_INFO(F("Tube "), currentTubeSetup + 1, F(" setup completed"));
+  if (currentTubeSetup < totalTubesNeeded) {
+    const MedicationTime &med = schedules[setupSchedules[currentTubeSetup]];
+    if (med.amount > 0) refillTube(setupTubes[currentTubeSetup], med.amount);
+  }
+  
+  currentTubeSetup++;
+  waitingForDropButton = false;
+  
+  if (currentTubeSetup >= totalTubesNeeded) {
+    // Setup complete
+    setupMode = false;
+    LOG_INFO(F("Tube setup completed! System ready for automatic dispensing."));
+    
+    // Show completion message
+    tft.fillScreen(ST77XX_BLACK);
+    drawHeader();
+    drawLayout(setupCompleteLayout);
+    invalidateUi();
+    uiHoldSince = millis() | 1;  // serviceUi() leaves it up for UI_HOLD_MS
+  } else {
+    waitingForDropButton = false;
+  }
+}
+
+void drawNoDataScreen() {
+  drawLayout(noDataLayout);
+}
+
+void drawUploadScreen() {
+  drawLayout(uploadLayout, FIELD_NONE);
+  initSpinner(uploadSpinner, 160, 140, 20);
+}
+
+// Spinner step and byte count; cheap enough to run between RX drains.
+void updateUploadScreen() {
+  stepSpinner(uploadSpinner);
+  drawLayout(uploadLayout, FIELD_UPLOAD_BYTES);
+}
+
+// Cards and footer; redrawn when the next dose or the schedule changes.
+void drawScheduleCards(int nextMedIndex) {
+  int contentY = 40;
+
+  drawLayout(scheduleLayout);
+
+  int cardY = contentY + 25;
+  int cardsShown = 0;
+
+  if (nextMedIndex != -1) {
+    drawGroupedMedicationCard(10, cardY, 300, 75, groupedSchedules[nextMedIndex], true);
+    cardY += 85;
+    cardsShown++;
+  }
+
+  for (int i = 0; i < groupedCount && cardsShown < 3; i++) {
+    if (i != nextMedIndex) {
+      drawGroupedMedicationCard(10, cardY, 300, 75, groupedSchedules[i], false);
+      cardY += 85;
+      cardsShown++;
+    }
+  }
+}
+
+// Brings the display up to date with the current state. Only a change of
+// screen clears the display; otherwise just the changed fields repaint.
+void showMainMenu() {
+  PROFILE_SCOPE(PROFILE_UI);
+  profileFrameDrawn();
+
+  if (!setupMode && triggerSetupAfterBT && filestat && groupedCount > 0) {
+    startTubeSetupMode(setupTubeMask);
+    triggerSetupAfterBT = false; // Reset the flag
+    setupTubeMask = 0;
+  }
+
+  UiScreen screen;
+  if (receiving) {
+    screen = UI_SCREEN_UPLOAD;
+  } else if (setupMode) {
+    screen = UI_SCREEN_SETUP; // Pause other tasks when in setup mode
+  } else {
+    if (!showNotification) {
+      int due = dueDoseGroup();
+      if (due >= 0) {
+        buildNotification(due);
+        showNotification = true;
+        notificationStartTime = millis();
+      }
+    }
+
+    if (showNotification) {
+      screen = UI_SCREEN_NOTIFICATION;
+    } else if (!filestat || groupedCount == 0) {
+      screen = UI_SCREEN_NO_DATA;
+    } else {
+      screen = UI_SCREEN_MAIN;
+    }
+  }
+
+  if (drawnUi.screen != screen) {
+    tft.fillScreen(ST77XX_BLACK);
+    drawLayout(headerLayout, FIELD_NONE);
+    drawnUi = {screen, -1, 0, -1, -1, scheduleVersion, -1, -1, -1, -2, -1};
+
+    if (screen == UI_SCREEN_NOTIFICATION) drawNotificationChrome();
+    else if (screen == UI_SCREEN_NO_DATA) drawNoDataScreen();
+    else if (screen == UI_SCREEN_UPLOAD) drawUploadScreen();
+  }
+
+  updateHeader();
+
+  switch (screen) {
+    case UI_SCREEN_SETUP:
+      updateTubeSetupScreen();
+      break;
+
+    case UI_SCREEN_NOTIFICATION:
+      updateNotification();
+      break;
+
+    case UI_SCREEN_UPLOAD:
+      updateUploadScreen();
+      break;
+
+    case UI_SCREEN_MAIN: {
+      int nextMedIndex = findNextMedication();
+      if (drawnUi.nextIndex != nextMedIndex || drawnUi.scheduleVersion != scheduleVersion) {
+        drawScheduleCards(nextMedIndex);
+        drawnUi.nextIndex = nextMedIndex;
+        drawnUi.scheduleVersion = scheduleVersion;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+bool checkJsonFile() {
+  File f = SD.open(activeScheduleFile(), FILE_READ);
+  if (!f) {
+    LOG_WARN(F("Cannot find schedule file")); // Using F() macro
+    return false;
+  }
+
+  ScheduleJsonParser parser;
+  jsonParserInit(parser, false);
+  bool ok = parseScheduleFile(f, parser);
+  f.close();
+
+  if (!ok) {
+    return false;
+  }
+
+  LOG_INFO(F("JSON is valid!")); // Using F() macro
+  return true;
+}
+
+// One mount attempt; serviceBoot() does the retrying.
+bool initSD() {
+  pinMode(SD_CS, OUTPUT);
+  pinMode(TFT_CS, OUTPUT);
+  digitalWrite(SD_CS, HIGH);
   digitalWrite(TFT_CS, HIGH);
-  delay(50);
 
-  for (int i = 0; i < 5; i++) {
-    if (SD.begin(SD_CS)) {
-      Serial.println(F("SD initialized.")); // Using F() macro
-      delay(10);
-      return true;
-    }
-    Serial.println(F("SD init failed, retrying...")); // Using F() macro
-    delay(200);
+  if (!sdSession.mounted && !mountSD()) return false;
+  LOG_INFO(F("SD initialized.")); // Using F() macro
+  readScheduleSlot();
+  return true;
+}
+
+// Mounts the card after boot and replaces the cached schedule with the one
+// on the card. If the card holds none, the cached one is kept.
+void serviceBoot() {
+  if (!bootState.sdPending) return;
+  unsigned long interval = bootState.attempts < BOOT_SD_FAST_RETRIES ? BOOT_SD_RETRY_MS : BOOT_SD_SLOW_RETRY_MS;
+  if (bootState.attempts > 0 && millis() - bootState.lastTry < interval) return;
+  bootState.lastTry = millis();
+
+  if (!initSD()) {
+    if (++bootState.attempts == BOOT_SD_FAST_RETRIES) {
+      LOG_ERROR(F("Cannot initialize SD card! Running from the EEPROM schedule")); // Using F() macro
+      uiRefreshPending = true;  // leave the intro screen
+    } else {
+      LOG_WARN(F("SD init failed, retrying...")); // Using F() macro
+    }
+    return;
+  }
+  bootState.sdPending = false;
+
+  bool cached = filestat;
+  filestat = loadScheduleData();
+  if (!filestat && cached && loadScheduleCache()) {
+    LOG_WARN(F("No schedule on the card, keeping the EEPROM copy")); // Using F() macro
+    groupMedicationsByTime();
+    filestat = true;
+  }
+  uiRefreshPending = true;
+}
+
+bool flushSectorBuffer() {
+  if (sectorFill == 0) return true;
+  bool ok = writeStreamingChunk(sectorBuffer, sectorFill);
+  sectorFill = 0;
+  return ok;
+}
+
+void bufferFileByte(uint8_t c) {
+  sectorBuffer[sectorFill++] = c;
+  if (sectorFill == SD_SECTOR_SIZE) {
+    flushSectorBuffer();
+  }
+}
+
+void appendPayloadByte(uint8_t c) {
+  uploadStats.bytesReceived++;
+  bufferFileByte(c);
+}
+
+void lzReset() {
+  memset(&lzDecoder, 0, sizeof(lzDecoder));
+  lzDecoder.state = LZ_READ_FLAGS;
+}
+
+// Feeds one encoded byte; decoded bytes go straight to the sector buffer.
+void lzFeed(uint8_t c) {
+  LzDecoder &lz = lzDecoder;
+  uploadStats.bytesReceived++;
+
+  switch (lz.state) {
+    case LZ_READ_FLAGS:
+      lz.flags = c;
+      lz.flagsLeft = 8;
+      lz.state = LZ_READ_ITEM;
+      return;
+
+    case LZ_READ_ITEM:
+      if (lz.flags & 1) {
+        bufferFileByte(c);
+        lz.output++;
+        break;
+      }
+      lz.matchLo = c;
+      lz.state = LZ_READ_MATCH_HI;
+      return;
+
+    case LZ_READ_MATCH_HI: {
+      uint16_t item = lz.matchLo | (uint16_t)c << 8;
+      uint16_t distance = (item & ((1 << LZ_DISTANCE_BITS) - 1)) + 1;
+      uint8_t length = (item >> LZ_DISTANCE_BITS) + LZ_MIN_MATCH;
+      if (distance > lz.output) {
+        lz.error = true;
+      } else {
+        for (uint8_t i = 0; i < length; i++) {
+          bufferFileByte(sectorBuffer[(sectorFill + SD_SECTOR_SIZE - distance) % SD_SECTOR_SIZE]);
+        }
+        lz.output += length;
+      }
+      break;
+    }
+  }
+
+  // One item done
+  lz.flags >>= 1;
+  lz.state = --lz.flagsLeft ? LZ_READ_ITEM : LZ_READ_FLAGS;
+}
+
+// Whether the stream ended on an item boundary without a bad match.
+bool lzFinished() {
+  return !lzDecoder.error && lzDecoder.state != LZ_READ_MATCH_HI;
+}
+
+void abortUpload() {
+  if (streamingActive) {
+    flushSectorBuffer();
+    streamingFile.sync();
+    uploadStats.syncs++;
+    printUploadStats();
+    streamingFile.close();
+    streamingActive = false;
+
+    if (framedUpload.active && framedUpload.encoding == UPLOAD_ENCODING_RAW) {
+      // Everything received is on the card now, so it can be resumed.
+      // Not for LZ: the decoder window and state are not on the card.
+      uploadResume.valid = true;
+      uploadResume.length = framedUpload.length;
+      uploadResume.contentCrc = framedUpload.contentCrc;
+      uploadResume.offset = framedUpload.offset;
+      uploadResume.runningCrc = framedUpload.runningCrc;
+      uploadResume.slot = streamingSlot;
+      LOG_INFO(F("Upload can resume at byte "), framedUpload.offset); // Using F() macro
+    }
+  }
+  sectorFill = 0;
+  endMarker.matched = 0;
+  framedUpload.active = false;
+  receiving = false;
+}
+
+void beginUpload() {
+  uploadResume.valid = false;  // this upload overwrites the inactive slot
+  if (!startStreamingSave()) {
+    LOG_ERROR(F("Failed to start streaming save")); // Using F() macro
+    return;
+  }
+  receiving = true;
+  receiveStartTime = millis();
+  sectorFill = 0;
+  endMarker.matched = 0;
+  LOG_INFO(F("Started receiving JSON data...")); // Using F() macro
+}
+
+// Flushes and commits the streamed file. Returns false if nothing was
+// committed; the partial file is then discarded.
+bool commitUpload() {
+  bool saved = flushSectorBuffer() && finishStreamingSave();
+  framedUpload.active = false;
+  if (!saved && streamingActive) {
+    abortUpload();
+  }
+  uploadResume.valid = false;
+  receiving = false;
+  return saved;
+}
+
+// Loads a freshly committed schedule and queues tube setup for it.
+void applyUploadedSchedule(bool saved) {
+  if (saved) {
+    // One attempt is enough now that the volume stays mounted; a failure
+    // here means the file itself is bad, not that the card needs waking.
+    filestat = loadScheduleData();
+    if (filestat) {
+      LOG_INFO(F("Schedule loaded successfully after BT transfer.")); // Using F() macro
+      currentTubeSetup = 0;
+      setupMode = false;
+      setupTubeMask = 0x0F;
+      triggerSetupAfterBT = true;
+    } else {
+      LOG_WARN(F("Schedule load failed after BT transfer.")); // Using F() macro
+    }
+  } else {
+    filestat = false;
+    LOG_ERROR(F("Failed to save JSON to SD.")); // Using F() macro
+  }
+
+  uiRefreshPending = true;
+  LOG_INFO(F("Complete")); // Using F() macro
+}
+
+// Legacy #START#...#END# upload: acknowledged once with 'A'.
+void completeUpload() {
+  bool saved = commitUpload();
+  LOG_INFO(F("\nReceived complete JSON!")); // Using F() macro
+  Serial1.write('A');
+  applyUploadedSchedule(saved);
+}
+
+void sendFrame(uint8_t type, uint8_t seq, const void *payload, uint8_t len) {
+  uint8_t head[3] = {type, seq, len};
+  uint16_t crc = crc16(head, sizeof(head));
+  crc = crc16(payload, len, crc);
+
+  Serial1.write(FRAME_SOF);
+  Serial1.write(head, sizeof(head));
+  Serial1.write((const uint8_t *)payload, len);
+  Serial1.write((uint8_t)(crc & 0xFF));
+  Serial1.write((uint8_t)(crc >> 8));
+}
+
+void sendUploadAck() {
+  sendFrame(FRAME_ACK, framedUpload.expectedSeq, &framedUpload.offset, sizeof(framedUpload.offset));
+}
+
+void sendBeginAck() {
+  uint8_t reply[6];
+  memcpy(reply, &framedUpload.offset, 4);  // AVR is little-endian, like the wire
+  reply[4] = FRAME_WINDOW;
+  reply[5] = FRAME_MAX_PAYLOAD;
+  sendFrame(FRAME_BEGIN_ACK, 0, reply, sizeof(reply));
+}
+
+void sendPatchAck(uint8_t seq, uint8_t status) {
+  sendFrame(FRAME_PATCH_ACK, seq, &status, 1);
+}
+
+void sendEndAck(uint8_t status) {
+  framedUpload.lastStatus = status;
+  sendFrame(FRAME_END_ACK, 0, &status, 1);
+}
+
+// One byte of a frame. Returns FRAME_COMPLETE with the frame in p, or
+// FRAME_CORRUPT when a frame failed its length or crc check.
+FrameResult feedFrame(FrameParser &p, uint8_t c) {
+  switch (p.state) {
+    case FRAME_WAIT_SOF:
+      if (c == FRAME_SOF) p.state = FRAME_READ_TYPE;
+      return FRAME_PENDING;
+
+    case FRAME_READ_TYPE:
+      p.type = c;
+      p.crc = crc16Update(0xFFFF, c);
+      p.state = FRAME_READ_SEQ;
+      return FRAME_PENDING;
+
+    case FRAME_READ_SEQ:
+      p.seq = c;
+      p.crc = crc16Update(p.crc, c);
+      p.state = FRAME_READ_LEN;
+      return FRAME_PENDING;
+
+    case FRAME_READ_LEN:
+      if (c > FRAME_MAX_PAYLOAD) {
+        p.state = FRAME_WAIT_SOF;
+        return FRAME_CORRUPT;
+      }
+      p.len = c;
+      p.pos = 0;
+      p.crc = crc16Update(p.crc, c);
+      p.state = c ? FRAME_READ_PAYLOAD : FRAME_READ_CRC_LO;
+      return FRAME_PENDING;
+
+    case FRAME_READ_PAYLOAD:
+      p.payload[p.pos++] = c;
+      p.crc = crc16Update(p.crc, c);
+      if (p.pos == p.len) p.state = FRAME_READ_CRC_LO;
+      return FRAME_PENDING;
+
+    case FRAME_READ_CRC_LO:
+      p.received = c;
+      p.state = FRAME_READ_CRC_HI;
+      return FRAME_PENDING;
+
+    case FRAME_READ_CRC_HI:
+      p.received |= (uint16_t)c << 8;
+      p.state = FRAME_WAIT_SOF;
+      return p.received == p.crc ? FRAME_COMPLETE : FRAME_CORRUPT;
+  }
+  p.state = FRAME_WAIT_SOF;
+  return FRAME_PENDING;
+}
+
+void beginFramedUpload(uint32_t length, uint16_t contentCrc, UploadEncoding encoding) {
+  uint32_t offset = 0;
+  uint16_t runningCrc = 0xFFFF;
+  if (encoding == UPLOAD_ENCODING_RAW && uploadResume.valid && uploadResume.length == length &&
+      uploadResume.contentCrc == contentCrc && uploadResume.slot == inactiveScheduleSlot()) {
+    offset = uploadResume.offset;
+    runningCrc = uploadResume.runningCrc;
+  }
+  uploadResume.valid = false;
+
+  if (!startStreamingSave(offset)) {
+    LOG_ERROR(F("Failed to start streaming save")); // Using F() macro
+    sendEndAck(UPLOAD_SAVE_FAILED);
+    return;
+  }
+
+  framedUpload.active = true;
+  framedUpload.encoding = encoding;
+  framedUpload.length = length;
+  framedUpload.contentCrc = contentCrc;
+  framedUpload.offset = offset;
+  framedUpload.runningCrc = runningCrc;
+  framedUpload.expectedSeq = 0;
+  framedUpload.lastStatus = -1;
+  uploadStats.bytesReceived = offset;
+  sectorFill = 0;
+  lzReset();
+  receiving = true;
+  receiveStartTime = millis();
+
+  LOG_INFO(F("Framed upload of "), length, F(" bytes from "), offset, F(", encoding "), encoding); // Using F() macro
+  sendBeginAck();
+}
+
+// Reads a length-prefixed string field into a fixed-size buffer.
+bool readPatchString(const uint8_t *&in, const uint8_t *end, char *dst, uint8_t size) {
+  if (in >= end) return false;
+  uint8_t len = *in++;
+  if (len >= size || len > end - in) return false;
+  memcpy(dst, in, len);
+  dst[len] = '\0';
+  in += len;
+  return true;
+}
+
+// PATCH payload: op, then a u16 key for REMOVE/MODIFY, then for ADD/MODIFY
+// the new dose as u16 key, i16 amount and length-prefixed medication and
+// dosage strings. At most 47 bytes, so one frame carries any edit.
+bool decodeSchedulePatch(const uint8_t *payload, uint8_t len, SchedulePatch &patch) {
+  const uint8_t *in = payload;
+  const uint8_t *end = payload + len;
+  memset(&patch, 0, sizeof(patch));
+  if (len < 1) return false;
+  patch.op = *in++;
+
+  if (patch.op != PATCH_ADD_DOSE) {
+    if (end - in < 2) return false;
+    memcpy(&patch.key, in, 2);
+    in += 2;
+    if (DOSE_KEY_TUBE(patch.key) >= 4) return false;
   }
-  return false;
+  if (patch.op == PATCH_REMOVE_DOSE || patch.op == PATCH_REMOVE_TUBE) return in == end;
+  if (patch.op != PATCH_ADD_DOSE && patch.op != PATCH_MODIFY_DOSE) return false;
+
+  uint16_t key;
+  if (end - in < 4) return false;
+  memcpy(&key, in, 2);
+  memcpy(&patch.record.amount, in + 2, 2);
+  in += 4;
+  if (DOSE_KEY_TUBE(key) >= 4 || (key & 0x7FF) >= 24 * 60) return false;
+  patch.record.minutes = key & 0x7FF;
+  patch.record.tube = DOSE_KEY_TUBE(key);
+  if (patch.op == PATCH_ADD_DOSE) patch.key = key;
+
+  return readPatchString(in, end, patch.record.medication, sizeof(patch.record.medication)) &&
+         readPatchString(in, end, patch.record.dosage, sizeof(patch.record.dosage)) && in == end;
 }
 
-void setup() {
-  Serial.begin(9600);
-  Serial1.begin(115200);
+// Applies one edit from a PATCH frame: journal first, then schedules[] and
+// only the groups it touches. Tube setup is queued just for tubes that now
+// have to hold a medication they did not hold before.
+uint8_t receiveSchedulePatch(const uint8_t *payload, uint8_t len) {
+  SchedulePatch patch;
+  MedicationTime dose;
+  if (!decodeSchedulePatch(payload, len, patch)) return UPLOAD_BAD_CONTENT;
+  if (!scheduleBaseLoaded) return UPLOAD_PATCH_MISMATCH;
+
+  uint8_t status = prepareSchedulePatch(patch, dose);
+  if (status == UPLOAD_OK) status = appendSchedulePatch(patch);
+  if (status != UPLOAD_OK) return status;
+
+  uint8_t refill = 0;
+  if ((patch.op == PATCH_ADD_DOSE || patch.op == PATCH_MODIFY_DOSE) && !tubeHolds(dose.tube, dose.medication)) {
+    refill = 1 << dose.tube;
+  }
 
-  pinMode(SD_CS, OUTPUT);
-  pinMode(TFT_CS, OUTPUT);
-  pinMode(DROP_BTN, INPUT_PULLUP);
-  
-  SPI.begin();
-  digitalWrite(SD_CS, HIGH);
-  digitalWrite(TFT_CS, HIGH);
-  tft.init(240, 280);
+  applySchedulePatch(patch, dose);
+  scheduleChanged();
+  filestat = scheduleCount > 0;
+  if (refill) {
+    setupTubeMask |= refill;
+    triggerSetupAfterBT = true;
+  }
+  uiRefreshPending = true;
+  LOG_INFO(F("Schedule patch "), patch.op, F(" applied, "), scheduleCount, F(" doses")); // Using F() macro
+  return UPLOAD_OK;
+}
 
-  animatedIntro();
+void completeFramedUpload() {
+  uint8_t status;
+  if (framedUpload.offset != framedUpload.length || framedUpload.runningCrc != framedUpload.contentCrc ||
+      (framedUpload.encoding == UPLOAD_ENCODING_LZ && !lzFinished())) {
+    LOG_ERROR(F("Framed upload: content check failed")); // Using F() macro
+    framedUpload.active = false;  // nothing worth resuming
+    abortUpload();
+    status = UPLOAD_BAD_CONTENT;
+  } else {
+    bool saved = commitUpload();
+    applyUploadedSchedule(saved);
+    status = !saved ? UPLOAD_SAVE_FAILED : filestat ? UPLOAD_OK : UPLOAD_BAD_SCHEDULE;
+  }
+  sendEndAck(status);
+}
 
-  servo1.attach(A0);
-  servo2.attach(A1);
-  servo3.attach(A2);
-  servo4.attach(A3);
+// Go-back-N receiver: only the next expected DATA frame is accepted, and
+// every DATA frame (accepted, duplicate or out of order) is answered with
+// an ACK carrying the next expected seq, so the sender resends from there.
+void handleFrame(const FrameParser &p) {
+  switch (p.type) {
+    case FRAME_BEGIN: {
+      if (p.len != 6 && p.len != 7) return;
+      uint32_t length;
+      uint16_t contentCrc;
+      memcpy(&length, p.payload, 4);
+      memcpy(&contentCrc, p.payload + 4, 2);
+      UploadEncoding encoding = p.len == 7 ? (UploadEncoding)p.payload[6] : UPLOAD_ENCODING_RAW;
+      if (encoding > UPLOAD_ENCODING_LZ) {
+        sendEndAck(UPLOAD_BAD_CONTENT);
+        return;
+      }
 
-  servo1.write(91);
-  servo2.write(91);
-  servo3.write(90);
-  servo4.write(90);
+      if (framedUpload.active && framedUpload.length == length && framedUpload.contentCrc == contentCrc &&
+          framedUpload.encoding == encoding && framedUpload.expectedSeq == 0) {
+        sendBeginAck();  // our BEGIN_ACK was lost
+        return;
+      }
+      if (receiving) abortUpload();
+      beginFramedUpload(length, contentCrc, encoding);
+      break;
+    }
 
-  pinMode(MOTOR_1, OUTPUT);
-  pinMode(MOTOR_2, OUTPUT);
-  pinMode(MOTOR_3, OUTPUT);
-  pinMode(MOTOR_4, OUTPUT);
-  delay(200);
+    case FRAME_DATA:
+      if (!framedUpload.active) return;
+      if (p.seq == framedUpload.expectedSeq && framedUpload.offset + p.len <= framedUpload.length) {
+        for (uint8_t i = 0; i < p.len; i++) {
+          if (framedUpload.encoding == UPLOAD_ENCODING_LZ) lzFeed(p.payload[i]);
+          else appendPayloadByte(p.payload[i]);
+        }
+        framedUpload.runningCrc = crc16(p.payload, p.len, framedUpload.runningCrc);
+        framedUpload.offset += p.len;
+        framedUpload.expectedSeq++;
+      }
+      sendUploadAck();
+      break;
 
-  if (!initSD()) {
-    Serial.println(F("Cannot initialize SD card!")); // Using F() macro
-    while (1);
+    case FRAME_PATCH:
+      if (lastPatchReply.status < 0 || p.seq != lastPatchReply.seq || p.crc != lastPatchReply.crc) {
+        lastPatchReply.seq = p.seq;
+        lastPatchReply.crc = p.crc;
+        lastPatchReply.status = receiveSchedulePatch(p.payload, p.len);
+      }
+      sendPatchAck(p.seq, lastPatchReply.status);  // a retry only gets the reply again
+      break;
+
+    case FRAME_END:
+      if (framedUpload.active) {
+        completeFramedUpload();
+      } else if (framedUpload.lastStatus >= 0) {
+        sendEndAck(framedUpload.lastStatus);  // our END_ACK was lost
+      }
+      break;
+
+    default:
+      break;
   }
+}
 
-  Serial.println(F("SD card ready.")); // Using F() macro
-  filestat = loadScheduleData();
+bool readDoseEvent(File &f, uint16_t index, DoseEvent &e) {
+  return f.seekSet((uint32_t)index * sizeof(DoseEvent)) && f.read(&e, sizeof(e)) == (int)sizeof(e) &&
+         e.seq != 0 && e.crc == crc16(&e, offsetof(DoseEvent, crc));
+}
 
-  if (!rtc.begin()) {
-    Serial.println(F("RTC not found!")); // Using F() macro
+// The newest record is in the sector whose first record has the highest
+// seq; the head is after the run of consecutive seqs that follows it. One
+// short read per sector, done once after boot.
+void locateEventLogHead(File &f) {
+  const uint16_t perSector = SD_SECTOR_SIZE / sizeof(DoseEvent);
+  DoseEvent e;
+  uint32_t last = 0;
+  uint16_t index = 0;
+  for (uint16_t sector = 0; sector < EVENT_LOG_SECTORS; sector++) {
+    if (readDoseEvent(f, sector * perSector, e) && e.seq > last) {
+      last = e.seq;
+      index = sector * perSector;
+    }
   }
-  rtc.adjust(DateTime(2025, 8, 15, 18, 59, 0));
-  showMainMenu();
+  if (last != 0) {
+    uint16_t end = index - index % perSector + perSector;
+    for (index++; index < end; index++) {
+      if (!readDoseEvent(f, index, e) || e.seq != last + 1) break;
+      last = e.seq;
+    }
+  }
+  eventLog.head = index % EVENT_LOG_RECORDS;
+  eventLog.nextSeq = last + 1;
+  eventLog.ready = true;
+  LOG_INFO(F("Event log: "), last, F(" events, head at "), eventLog.head); // Using F() macro
 }
 
-void loop() {
-  rtctime = rtc.now();
+// Opens EVENT_LOG_FILE, creating it the first time: contiguously
+// preallocated and written out to its full size once, so later writes never
+// grow it and touch neither the FAT nor the directory entry.
+bool openEventLog(File &f) {
+  if (!acquireSD()) return false;
+  f = SD.open(EVENT_LOG_FILE, O_RDWR | O_CREAT);
+  if (!f) {
+    reportSDError(F("openEventLog"));
+    return false;
+  }
+  if (f.size() == EVENT_LOG_BYTES) {
+    if (!eventLog.ready) locateEventLogHead(f);
+    return true;
+  }
+
+  LOG_INFO(F("Event log: creating "), EVENT_LOG_BYTES, F(" byte ring")); // Using F() macro
+  bool ok = f.truncate(0);
+  if (ok && !f.preAllocate(EVENT_LOG_BYTES)) {
+    LOG_WARN(F("Event log: no contiguous space, file will be fragmented")); // Using F() macro
+  }
+  DoseEvent blank;
+  memset(&blank, 0, sizeof(blank));  // fails the crc, so reads as empty
+  for (uint16_t i = 0; ok && i < EVENT_LOG_RECORDS; i++) {
+    ok = f.write(&blank, sizeof(blank)) == sizeof(blank);
+  }
+  if (!ok || !f.sync()) {
+    f.close();
+    reportSDError(F("openEventLog"));
+    return false;
+  }
+  eventLog.head = 0;
+  eventLog.nextSeq = 1;
+  eventLog.ready = true;
+  return true;
+}
+
+// Writes the buffered events at the head. They are contiguous in the file,
+// so this is one sector write (two when crossing a sector or the ring end)
+// for up to EVENT_LOG_BUFFERED events. On failure they stay buffered.
+bool flushEventLog() {
+  if (eventLog.pending == 0) return true;
+  File f;
+  if (!openEventLog(f)) return false;
+
+  bool ok = f.seekSet((uint32_t)eventLog.head * sizeof(DoseEvent));
+  uint16_t head = eventLog.head;
+  uint32_t seq = eventLog.nextSeq;
+  for (uint8_t i = 0; ok && i < eventLog.pending; i++) {
+    DoseEvent &e = eventLog.buffer[i];
+    e.seq = seq++;
+    e.crc = crc16(&e, offsetof(DoseEvent, crc));
+    ok = f.write(&e, sizeof(e)) == sizeof(e);
+    if (++head == EVENT_LOG_RECORDS) {
+      head = 0;
+      ok = ok && f.seekSet(0);
+    }
+  }
+  ok = ok && f.sync();
+  f.close();
+  if (!ok) {
+    reportSDError(F("flushEventLog"));
+    eventLog.ready = false;  // find the head again before the retry
+    eventLog.firstPending = millis();
+    return false;
+  }
+  eventLog.head = head;
+  eventLog.nextSeq = seq;
+  eventLog.pending = 0;
+  return true;
+}
 
-  if (digitalRead(DROP_BTN) == LOW) {
-    delay(50);
-    if (digitalRead(DROP_BTN) == LOW) {
-      if (setupMode) {
-        handleTubeSetupButton();
-      } else if (showNotification) {
-        handleDispensing();
+void startEventLogDump() {
+  if (eventLogDump.active) return;
+  flushEventLog();  // so the reply includes them
+  eventLogDump.active = true;
+  eventLogDump.sent = 0;
+  eventLogDump.seq = 0;
+  eventLogDump.pos = eventLog.head;
+  eventLogDump.left = openEventLog(eventLogFile) ? EVENT_LOG_RECORDS : 0;
+}
+
+// Sends the #LOG# reply, as FRAME_LOG_DATA frames of three records and a
+// FRAME_LOG_END, while whole frames fit in the TX ring. Reads at most a
+// sector's worth of records per call so empty stretches don't stall the loop.
+void serviceEventLog() {
+  if (eventLogDump.active) {
+    uint8_t reads = 0;
+    while (Serial1.availableForWrite() >= FRAME_MAX_PAYLOAD + 6 && reads < SD_SECTOR_SIZE / sizeof(DoseEvent)) {
+      uint8_t payload[FRAME_MAX_PAYLOAD];
+      uint8_t len = 0;
+      while (eventLogDump.left > 0 && len + sizeof(DoseEvent) <= FRAME_MAX_PAYLOAD) {
+        DoseEvent e;
+        if (readDoseEvent(eventLogFile, eventLogDump.pos, e)) {
+          memcpy(payload + len, &e, sizeof(e));
+          len += sizeof(e);
+        }
+        eventLogDump.pos = (eventLogDump.pos + 1) % EVENT_LOG_RECORDS;
+        eventLogDump.left--;
+        reads++;
+      }
+      if (len > 0) {
+        sendFrame(FRAME_LOG_DATA, eventLogDump.seq++, payload, len);
+        eventLogDump.sent += len / sizeof(DoseEvent);
+      }
+      if (eventLogDump.left == 0) {
+        uint8_t end[6];
+        memcpy(end, &eventLogDump.sent, 2);
+        memcpy(end + 2, &eventLog.nextSeq, 4);
+        sendFrame(FRAME_LOG_END, eventLogDump.seq++, end, sizeof(end));
+        if (eventLogFile) eventLogFile.close();
+        eventLogDump.active = false;
+        break;
       }
-      delay(500);
     }
+    return;
   }
 
-  static unsigned long lastUpdate = 0;
-  const unsigned long refreshInterval = 2000;
+  if (eventLog.pending > 0 && millis() - eventLog.firstPending >= EVENT_LOG_FLUSH_MS) {
+    flushEventLog();
+  }
+}
+
+#if PROFILE_ENABLED
+// #STATS# reply, one line per step: a header, then per section a summary
+// and a line of histogram buckets (4 hex digits each, bucket 0 first),
+// then the memory watermarks (MemoryStats, in bytes) and #END#. All times
+// are in us, percentiles are bucket upper bounds.
+//   #STATS# up=<s> rx_peak=<n>/<ring> rx_full=<n> frames=<n>
+//   <name> n=<count> p50=<us> p99=<us> max=<us>
+//   <name> h <buckets>
+//   mem static=<n> heap=<n> stack=<n> free=<n> headroom=<n>
+//   task <name>=<overruns> ...   (tasks that missed their deadline)
+#define STATS_REPORT_LINES (4 + 2 * PROFILE_SECTIONS)
+
+const char profileSectionNames[PROFILE_SECTIONS][7] PROGMEM = {
+  "loop", "rtc", "ingest", "disp", "ui", "sd"
+};
+
+int8_t statsReportLine = -1;  // next line to send, -1 = idle
+
+bool statsReportActive() {
+  return statsReportLine >= 0;
+}
+
+void startStatsReport() {
+  statsReportLine = 0;
+}
+
+// Upper bound of the pct-th percentile, never above the recorded maximum.
+uint32_t profilePercentile(const ProfileSection &s, uint8_t pct) {
+  uint32_t total = 0;
+  for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) total += s.buckets[b];
+  uint32_t rank = (total * pct + 99) / 100;
+
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < PROFILE_BUCKETS - 1; b++) {
+    seen += s.buckets[b];
+    if (seen >= rank) {
+      uint32_t upper = (uint32_t)1 << (PROFILE_BUCKET0_SHIFT + b);
+      return upper < s.maxUs ? upper : s.maxUs;
+    }
+  }
+  return s.maxUs;
+}
+
+uint8_t formatTaskOverruns(char *line, uint8_t size);  // with the task table
+
+uint8_t formatStatsLine(int8_t index, char *line, uint8_t size) {
+  int n;
+  if (index == 0) {
+    n = snprintf_P(line, size, PSTR("#STATS# up=%lu rx_peak=%u/%u rx_full=%u frames=%lu"),
+                   millis() / 1000, profileCounters.rxPeak, SERIAL_RX_BUFFER_SIZE - 1,
+                   profileCounters.rxOverruns, (unsigned long)profileCounters.framesDrawn);
+  } else if (index == STATS_REPORT_LINES - 1) {
+    n = snprintf_P(line, size, PSTR("#END#"));
+  } else if (index == STATS_REPORT_LINES - 2) {
+    n = formatTaskOverruns(line, size);
+  } else if (index == STATS_REPORT_LINES - 3) {
+    n = snprintf_P(line, size, PSTR("mem static=%u heap=%u stack=%u free=%u headroom=%u"),
+                   memoryStats.staticBytes, memoryStats.heapBytes, memoryStats.stackPeak,
+                   memoryStats.freeBytes, memoryStats.headroom);
+  } else {
+    const ProfileSection &s = profileSections[(index - 1) / 2];
+    char name[7];
+    strcpy_P(name, profileSectionNames[(index - 1) / 2]);
+    if (index & 1) {
+      n = snprintf_P(line, size, PSTR("%s n=%lu p50=%lu p99=%lu max=%lu"), name,
+                     (unsigned long)s.count, (unsigned long)profilePercentile(s, 50),
+                     (unsigned long)profilePercentile(s, 99), (unsigned long)s.maxUs);
+    } else {
+      n = snprintf_P(line, size, PSTR("%s h "), name);
+      for (uint8_t b = 0; b < PROFILE_BUCKETS && n + 4 < size; b++) {
+        n += snprintf_P(line + n, size - n, PSTR("%04x"), s.buckets[b]);
+      }
+    }
+  }
+  return n < size ? n : size - 1;
+}
 
-  static int byteCounter = 0;
-  static char tempBuffer[TEMP_BUFFER_SIZE + 1] = "";
-  static int bufferPos = 0;
+// Sends the pending #STATS# lines while whole lines fit in the TX ring, so
+// answering a query never blocks the loop it is measuring.
+void serviceStatsReport() {
+  while (statsReportLine >= 0 && Serial1.availableForWrite() >= STATS_LINE_MAX) {
+    char line[STATS_LINE_MAX + 1];
+    uint8_t n = formatStatsLine(statsReportLine, line, STATS_LINE_MAX - 1);
+    line[n++] = '\r';
+    line[n++] = '\n';
+    Serial1.write((const uint8_t *)line, n);
+    statsReportLine = statsReportLine + 1 < STATS_REPORT_LINES ? statsReportLine + 1 : -1;
+  }
+}
+#else
+inline void startStatsReport() {}
+inline void serviceStatsReport() {}
+inline bool statsReportActive() { return false; }
+#endif
+
+// #INV# reply, also sent unprompted when the stock or the outlook changes:
+//   #INV# stock=<n|->,... days=<n|->,... low=<tubes|->
+// one field per tube, '-' = unknown; low lists the tubes (1-4) at or under
+// LOW_STOCK_DAYS so a refill trip can take them all at once.
+#define INVENTORY_LINE_MAX 80
+
+void startInventoryReport() {
+  inventory.reportPending = true;
+}
+
+void serviceInventoryReport() {
+  if (!inventory.reportPending || statsReportActive()) return;  // never inside a #STATS# reply
+
+  char line[INVENTORY_LINE_MAX];
+  int n = snprintf_P(line, sizeof(line), PSTR("#INV# stock="));
+  for (uint8_t t = 0; t < 4; t++) {
+    if (inventory.stock[t] == INVENTORY_UNKNOWN) n += snprintf_P(line + n, sizeof(line) - n, PSTR("%s-"), t ? "," : "");
+    else n += snprintf_P(line + n, sizeof(line) - n, PSTR("%s%u"), t ? "," : "", inventory.stock[t]);
+  }
+  n += snprintf_P(line + n, sizeof(line) - n, PSTR(" days="));
+  for (uint8_t t = 0; t < 4; t++) {
+    int16_t days = tubeDaysLeft(t);
+    if (days < 0) n += snprintf_P(line + n, sizeof(line) - n, PSTR("%s-"), t ? "," : "");
+    else n += snprintf_P(line + n, sizeof(line) - n, PSTR("%s%d"), t ? "," : "", days);
+  }
+  n += snprintf_P(line + n, sizeof(line) - n, PSTR(" low="));
+  if (!inventory.lowMask) n += snprintf_P(line + n, sizeof(line) - n, PSTR("-"));
+  for (uint8_t t = 0, first = 1; t < 4; t++) {
+    if (!(inventory.lowMask & (1 << t))) continue;
+    n += snprintf_P(line + n, sizeof(line) - n, PSTR("%s%u"), first ? "" : ",", t + 1);
+    first = 0;
+  }
+  n += snprintf_P(line + n, sizeof(line) - n, PSTR("\r\n"));
+
+  // A long line may wait on a full ring briefly; never on more than that
+  if (Serial1.availableForWrite() < (n < STATS_LINE_MAX ? n : STATS_LINE_MAX)) return;
+  Serial1.write((const uint8_t *)line, n);
+  inventory.reportPending = false;
+}
+
+// Drains the Serial1 RX ring (filled by the core's USART interrupt, sized by
+// SERIAL_RX_BUFFER_SIZE). Framed uploads go through feedFrame(); legacy
+// #START#/#END# payload goes through the marker matchers straight into the
+// sector buffer. No String objects and no rescanning.
+void handleSerialIngest() {
+  PROFILE_SCOPE(PROFILE_INGEST);
+  profileRxLevel(Serial1.available());
 
   while (Serial1.available()) {
-    char c = Serial1.read();
-    Serial.print(c);
-    if (bufferPos < TEMP_BUFFER_SIZE) {
-      tempBuffer[bufferPos++] = c;
-      tempBuffer[bufferPos] = '\0';
+    uint8_t c = Serial1.read();
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+    logOut.print((char)c);
+#endif
+    if (frameParser.state != FRAME_WAIT_SOF && millis() - lastByteTime > FRAME_GAP_MS) {
+      frameParser.state = FRAME_WAIT_SOF;  // sender gave up mid-frame
     }
-    
-    byteCounter++;
     lastByteTime = millis();
 
-    if (!receiving) {
-      char* startPos = strstr(tempBuffer, "#START#");
-      if (startPos != nullptr) {
-        receiving = true;
-        receiveStartTime = millis();
-        
-        int startOffset = startPos - tempBuffer + 7;
-        int remainingLen = bufferPos - startOffset;
-        if (remainingLen > 0) {
-          memmove(tempBuffer, tempBuffer + startOffset, remainingLen);
-          bufferPos = remainingLen;
-          tempBuffer[bufferPos] = '\0';
-        } else {
-          bufferPos = 0;
-          tempBuffer[0] = '\0';
-        }
+    uint8_t released;
+    bool consumed;
 
-        if (!startStreamingSave()) {
-          Serial.println(F("Failed to start streaming save")); // Using F() macro
-          receiving = false;
-          bufferPos = 0;
-          continue;
-        }
-        Serial.println(F("Started receiving JSON data...")); // Using F() macro
-      } else if (bufferPos >= TEMP_BUFFER_SIZE - 8) {
-        memmove(tempBuffer, tempBuffer + TEMP_BUFFER_SIZE - 16, 16);
-        bufferPos = 16;
-        tempBuffer[bufferPos] = '\0';
+    if (receiving && !framedUpload.active) {
+      bool ended = feedMarker(endMarker, c, released, consumed);
+      for (uint8_t i = 0; i < released; i++) {
+        appendPayloadByte(endMarker.pattern[i]);
       }
-    } else {
-      char* endPos = strstr(tempBuffer, "#END#");
-      if (endPos != nullptr) {
-        int finalLen = endPos - tempBuffer;
-        if (finalLen > 0) {
-          tempBuffer[finalLen] = '\0';
-          String finalChunk = String(tempBuffer);
-          writeStreamingChunk(finalChunk);
-        }
-
-        bool saved = finishStreamingSave();
-        Serial.println(F("\nReceived complete JSON!")); // Using F() macro
-        Serial1.write('A');
-
-        if (saved) {
-          delay(2000);
-          bool loaded = false;
-          for (int attempt = 1; attempt <= 3; attempt++) {
-            loaded = loadScheduleData();
-            if (loaded) {
-              Serial.print(F("Schedule loaded successfully after BT transfer (try ")); // Using F() macro
-              Serial.print(attempt);
-              Serial.println(F(").")); // Using F() macro
-              currentTubeSetup = 0;
-              setupMode = false;
-              triggerSetupAfterBT = true;
-              break;
-            } else {
-              Serial.print(F("Schedule load failed after BT transfer (try ")); // Using F() macro
-              Serial.print(attempt);
-              Serial.println(F("). Retrying...")); // Using F() macro
-              delay(500);
-            }
-          }
-          filestat = loaded;
-          delay(2000);
-        } else {
-          filestat = false;
-          Serial.println(F("Failed to save JSON to SD.")); // Using F() macro
-        }
+      if (!consumed) {
+        appendPayloadByte(c);
+      }
+      if (ended) {
+        completeUpload();
+      }
+      continue;
+    }
 
-        int endOffset = (endPos - tempBuffer) + 5;
-        int remainingLen = bufferPos - endOffset;
-        if (remainingLen > 0) {
-          memmove(tempBuffer, tempBuffer + endOffset, remainingLen);
-          bufferPos = remainingLen;
-          tempBuffer[bufferPos] = '\0';
-        } else {
-          bufferPos = 0;
-          tempBuffer[0] = '\0';
-        }
-        
-        receiving = false;
-        Serial.println(F("Complete")); // Using F() macro
-        delay(300);
-        // Serial1.write('MA');
-      } else {
-        if (bufferPos >= TEMP_BUFFER_SIZE - 8) {
-          String chunkToWrite = String(tempBuffer).substring(0, TEMP_BUFFER_SIZE / 2);
-          writeStreamingChunk(chunkToWrite);
-          
-          int keepLen = bufferPos - (TEMP_BUFFER_SIZE / 2);
-          memmove(tempBuffer, tempBuffer + (TEMP_BUFFER_SIZE / 2), keepLen);
-          bufferPos = keepLen;
-          tempBuffer[bufferPos] = '\0';
-        }
+    if (frameParser.state != FRAME_WAIT_SOF || c == FRAME_SOF) {
+      FrameResult result = feedFrame(frameParser, c);
+      if (result == FRAME_COMPLETE) {
+        handleFrame(frameParser);
+      } else if (result == FRAME_CORRUPT && framedUpload.active) {
+        sendUploadAck();  // prompt a resend instead of waiting for the sender's timeout
       }
+      continue;
     }
 
-    if (byteCounter >= 32) {
-      // Serial1.write('A');
-      byteCounter = 0;
+    if (!receiving && feedMarker(statsMarker, c, released, consumed)) {
+      startStatsReport();
+    }
+    if (!receiving && feedMarker(logMarker, c, released, consumed)) {
+      startEventLogDump();
+    }
+    if (!receiving && feedMarker(inventoryMarker, c, released, consumed)) {
+      startInventoryReport();
+    }
+    if (!receiving && feedMarker(startMarker, c, released, consumed)) {
+      beginUpload();
     }
   }
 
   if (receiving) {
-    if (millis() - lastByteTime > 5000) {
-      Serial.println(F("Timeout: no new data, aborting streaming save.")); // Using F() macro
-      if (streamingActive) {
-        streamingFile.close();
-        streamingActive = false;
-        sdBusy = false;
-      }
-      bufferPos = 0;
-      tempBuffer[0] = '\0';
-      receiving = false;
-    } else if (millis() - receiveStartTime > 20000) {
-      Serial.println(F("Timeout: transmission too long, aborting streaming save.")); // Using F() macro
-      if (streamingActive) {
-        streamingFile.close();
-        streamingActive = false;
-        sdBusy = false;
-      }
-      bufferPos = 0;
-      tempBuffer[0] = '\0';
-      receiving = false;
+    if (millis() - lastByteTime > UPLOAD_IDLE_TIMEOUT_MS) {
+      LOG_WARN(F("Timeout: no new data, aborting streaming save.")); // Using F() macro
+      abortUpload();
+    } else if (!framedUpload.active && millis() - receiveStartTime > UPLOAD_LEGACY_TIMEOUT_MS) {
+      LOG_WARN(F("Timeout: transmission too long, aborting streaming save.")); // Using F() macro
+      abortUpload();
     }
   }
+}
+
+void onRtcAlarm() {
+  rtcAlarmFlag = true;
+}
+
+void saveCalibration() {
+  CalibrationRecord record;
+  record.magic = CALIBRATION_MAGIC;
+  record.version = CALIBRATION_VERSION;
+  record.count = 4;
+  for (int i = 0; i < 4; i++) {
+    record.tubes[i] = tubeMappings[i].cal;
+  }
+  record.crc = crc16(&record, offsetof(CalibrationRecord, crc));
+  EEPROM.put(CALIBRATION_EEPROM_ADDR, record);  // only rewrites changed bytes
+}
+
+// Loads per-tube servo positions and FSR scale from EEPROM. A blank or
+// corrupt record is replaced by the compiled-in defaults so it can be
+// edited in place later.
+void loadCalibration() {
+  CalibrationRecord record;
+  EEPROM.get(CALIBRATION_EEPROM_ADDR, record);
+
+  if (record.magic != CALIBRATION_MAGIC || record.version != CALIBRATION_VERSION ||
+      record.count != 4 || record.crc != crc16(&record, offsetof(CalibrationRecord, crc))) {
+    LOG_WARN(F("Calibration: no valid EEPROM record, writing defaults")); // Using F() macro
+    saveCalibration();
+    return;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    tubeMappings[i].cal = record.tubes[i];
+  }
+  LOG_INFO(F("Calibration loaded from EEPROM")); // Using F() macro
+}
+
+void initRtcAlarms() {
+  rtc.disable32K();
+  rtc.writeSqwPinMode(DS3231_OFF);  // INT/SQW pin signals alarms
+  rtc.clearAlarm(1);
+  rtc.clearAlarm(2);
+  rtc.setAlarm2(DateTime(2000, 1, 1, 0, 0, 0), DS3231_A2_PerMinute);
+
+  pinMode(RTC_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(RTC_INT_PIN), onRtcAlarm, FALLING);
+}
+
+// Programs alarm 1 for the first dose after the current minute.
+void scheduleNextDoseAlarm() {
+  doseAlarmStale = false;
+  if (groupedCount == 0) {
+    rtc.disableAlarm(1);
+    return;
+  }
+
+  int next = lowerBoundGroup(currentMinuteOfDay() + 1);
+  if (next >= groupedCount) next = 0;
+  uint16_t minutes = groupedSchedules[next].minutes;
+  rtc.setAlarm1(DateTime(2000, 1, 1, minutes / 60, minutes % 60, 0), DS3231_A1_Hour);
+}
+
+void readRtc() {
+  rtctime = rtc.now();
+  lastRtcRead = millis();
+  uiRefreshPending = true;
+}
+
+// Handles a pending RTC alarm. The poll fallback keeps the clock running
+// if the INT line is not wired or an alarm edge was missed.
+void serviceRtc() {
+  PROFILE_SCOPE(PROFILE_RTC);
+  if (!rtcReady) return;
+
+  if (rtcAlarmFlag || millis() - lastRtcRead >= RTC_FALLBACK_POLL_MS) {
+    rtcAlarmFlag = false;
+    readRtc();
+    if (rtc.alarmFired(1)) {
+      rtc.clearAlarm(1);
+      doseAlarmStale = true;
+    }
+    if (rtc.alarmFired(2)) {
+      rtc.clearAlarm(2);
+    }
+  }
+
+  if (doseAlarmStale) {
+    scheduleNextDoseAlarm();
+  }
+}
+
+// DROP button. Pin 30 (PC7) has no pin-change interrupt on the 2560, so
+// TIMER0_COMPA_vect samples it instead: Timer0 already runs millis(), and
+// its otherwise unused compare A fires once per 1.024 ms overflow period.
+// An edge is queued once the new level has held for BUTTON_DEBOUNCE_MS,
+// stamped with when it first appeared; serviceDropButton() turns the edges
+// into presses, long presses and double presses.
+#define BUTTON_DEBOUNCE_MS 20
+#define BUTTON_LONG_MS 1000   // held this long: snooze the reminder
+#define BUTTON_DOUBLE_MS 350  // second release within this: skip the dose
+#define BUTTON_QUEUE_SIZE 8   // power of two
+
+static_assert((BUTTON_QUEUE_SIZE & (BUTTON_QUEUE_SIZE - 1)) == 0, "BUTTON_QUEUE_SIZE must be a power of two");
+
+struct ButtonEdge {
+  unsigned long time;
+  bool down;
+};
+
+// Single producer (the ISR) and single consumer (the button task): the ISR
+// fills an entry before publishing it by moving head, the task reads it
+// before moving tail, so neither side needs interrupts off.
+ButtonEdge buttonQueue[BUTTON_QUEUE_SIZE];
+volatile uint8_t buttonHead = 0;
+volatile uint8_t buttonTail = 0;
+
+volatile uint8_t *buttonPort = nullptr;
+uint8_t buttonMask = 0;
+bool buttonLevel = false;          // debounced, true = pressed
+bool buttonChanging = false;       // raw level differs from buttonLevel
+unsigned long buttonChangeAt = 0;  // when it started to differ
+
+void startButtonSampling() {
+  buttonPort = portInputRegister(digitalPinToPort(DROP_BTN));
+  buttonMask = digitalPinToBitMask(DROP_BTN);
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+}
+
+ISR(TIMER0_COMPA_vect) {
+  bool down = !(*buttonPort & buttonMask);
+  if (down == buttonLevel) {
+    buttonChanging = false;
+    return;
+  }
+  unsigned long now = millis();
+  if (!buttonChanging) {
+    buttonChanging = true;
+    buttonChangeAt = now;
+    return;
+  }
+  if (now - buttonChangeAt < BUTTON_DEBOUNCE_MS) return;
+
+  uint8_t next = (buttonHead + 1) & (BUTTON_QUEUE_SIZE - 1);
+  if (next == buttonTail) return;  // full; retried on the next sample
+  buttonQueue[buttonHead] = {buttonChangeAt, down};
+  buttonHead = next;
+  buttonLevel = down;
+  buttonChanging = false;
+}
+
+enum ButtonGesture : uint8_t {
+  BUTTON_NONE,
+  BUTTON_PRESS,  // released; reported after BUTTON_DOUBLE_MS when gestures are on
+  BUTTON_LONG,   // still held after BUTTON_LONG_MS; its release is ignored
+  BUTTON_DOUBLE
+};
+
+struct ButtonRecognizer {
+  bool down;
+  bool longSent;  // this press was reported as BUTTON_LONG
+  uint8_t clicks; // releases waiting out the double-press window
+  unsigned long pressAt;
+  unsigned long releaseAt;
+};
+
+ButtonRecognizer dropButton = {false, false, 0, 0, 0};
+
+// Next gesture from the edge queue. Without gestures a release is a press
+// straight away, so tube setup does not wait out the double-press window.
+ButtonGesture nextButtonGesture(bool gestures) {
+  while (buttonTail != buttonHead) {
+    ButtonEdge edge = buttonQueue[buttonTail];
+    buttonTail = (buttonTail + 1) & (BUTTON_QUEUE_SIZE - 1);
+    if (edge.down) {
+      dropButton.down = true;
+      dropButton.longSent = false;
+      dropButton.pressAt = edge.time;
+      continue;
+    }
+    if (!dropButton.down) continue;
+    dropButton.down = false;
+    if (dropButton.longSent) continue;
+    if (!gestures) return BUTTON_PRESS;
+    dropButton.releaseAt = edge.time;
+    if (++dropButton.clicks == 2) {
+      dropButton.clicks = 0;
+      return BUTTON_DOUBLE;
+    }
+  }
+
+  if (!gestures) {
+    dropButton.clicks = 0;
+    return BUTTON_NONE;
+  }
+  if (dropButton.down && !dropButton.longSent && millis() - dropButton.pressAt >= BUTTON_LONG_MS) {
+    dropButton.longSent = true;
+    dropButton.clicks = 0;
+    return BUTTON_LONG;
+  }
+  if (dropButton.clicks == 1 && !dropButton.down && millis() - dropButton.releaseAt >= BUTTON_DOUBLE_MS) {
+    dropButton.clicks = 0;
+    return BUTTON_PRESS;
+  }
+  return BUTTON_NONE;
+}
+
+// Logs outcome for every dose in the reminder on screen and takes it down.
+void closeReminder(uint8_t outcome) {
+  const GroupedMedication &group = groupedSchedules[notifiedGroup];
+  for (int i = 0; i < group.count; i++) {
+    recordDoseEvent(tubeMappings[schedules[group.members[i]].tube].servoIndex, outcome, 0, 0);
+  }
+  doseHandledMinute = group.minutes;
+  snoozedGroup = -1;
+  showNotification = false;
+}
+
+void snoozeDose() {
+  if (notifiedGroup < 0) return;
+  LOG_INFO(F("Dose snoozed for "), SNOOZE_MS / 60000, F(" min")); // Using F() macro
+  int group = notifiedGroup;
+  closeReminder(DOSE_SNOOZED);
+  snoozedGroup = group;
+  snoozeStart = millis();
+}
+
+void skipDose() {
+  if (notifiedGroup < 0) return;
+  LOG_INFO(F("Dose skipped")); // Using F() macro
+  closeReminder(DOSE_SKIPPED);
+}
+
+void serviceDropButton() {
+  bool reminder = showNotification && !setupMode && !isDispensing();
+  ButtonGesture gesture = nextButtonGesture(reminder);
 
-  if (!receiving && millis() - lastUpdate >= refreshInterval) {
+  // A snoozed dose comes back through showMainMenu(), which the idle
+  // screen only runs on a refresh
+  if (!showNotification && !setupMode && !receiving && snoozedGroup >= 0 &&
+      millis() - snoozeStart >= SNOOZE_MS) {
+    uiRefreshPending = true;
+  }
+  if (gesture == BUTTON_NONE) return;
+
+  if (setupMode) {
+    if (gesture == BUTTON_PRESS) handleTubeSetupButton();
+  } else if (reminder) {
+    if (gesture == BUTTON_PRESS) handleDispensing();
+    else if (gesture == BUTTON_LONG) snoozeDose();
+    else skipDose();
+  }
+  uiRefreshPending = true;
+}
+
+// The idle menu only changes when the minute ticks or data changes;
+// animated screens still refresh periodically.
+void serviceUi() {
+  static unsigned long lastUpdate = 0;
+  if (uiHoldSince != 0) {
+    if (millis() - uiHoldSince < UI_HOLD_MS) return;
+    uiHoldSince = 0;
+  }
+  bool uiAnimated = receiving || setupMode || showNotification || isDispensing() || triggerSetupAfterBT;
+  if (uiRefreshPending || (uiAnimated && millis() - lastUpdate >= UI_ACTIVE_REFRESH_MS)) {
     showMainMenu();
     lastUpdate = millis();
+    uiRefreshPending = false;
+  }
+}
+
+void serviceReports() {
+  serviceInventoryReport();
+  serviceStatsReport();
+}
+
+// Cooperative scheduler. Every task runs to completion without blocking,
+// at most once per periodMs (0 = every pass), in table order. Serial1
+// ingest is not in the table: it runs before every task that finds bytes
+// waiting, so the RX ring never waits on more than one task. A run longer
+// than deadlineUs (0 = unchecked) is counted in taskOverruns[] and shown
+// by #STATS#. The watchdog is kicked once per pass, so a task that hangs
+// resets the board instead of stalling the dispenser.
+#ifndef WATCHDOG_TIMEOUT
+// Longest legitimate pass: a full redraw plus an SD flush, or a card mount
+// (kicked on entry, see mountSD()) that uses all of SdFat's 2 s init timeout
+#define WATCHDOG_TIMEOUT WDTO_4S
+#endif
+
+struct Task {
+  void (*run)();
+  uint16_t periodMs;
+  uint16_t deadlineUs;
+  char name[6];
+};
+
+const Task taskTable[] PROGMEM = {
+  {serviceBoot, 0, 0, "boot"},  // SD mount and schedule reload, once
+  {serviceRtc, 0, 2000, "rtc"},
+  {serviceDropButton, 10, 500, "btn"},
+  {updateDispensing, 0, 1000, "disp"},
+  {serviceServos, 0, 200, "servo"},
+  {serviceUi, 0, 60000, "ui"},
+  {serviceScheduleCache, 0, 1000, "cache"},
+  {serviceEventLog, 0, 30000, "event"},
+  {serviceInventory, 0, 1000, "stock"},
+  {serviceReports, 0, 3000, "rep"},
+  {serviceMemory, MEMORY_CHECK_MS, 5000, "mem"},
+};
+
+#define TASK_COUNT (sizeof(taskTable) / sizeof(taskTable[0]))
+
+unsigned long taskLastRun[TASK_COUNT];
+uint16_t taskOverruns[TASK_COUNT];
+
+void runTasks() {
+  handleSerialIngest();
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    Task task;
+    memcpy_P(&task, &taskTable[i], sizeof(task));
+    if (task.periodMs && taskLastRun[i] && millis() - taskLastRun[i] < task.periodMs) continue;
+    taskLastRun[i] = millis() | 1;
+
+    unsigned long start = micros();
+    task.run();
+    if (task.deadlineUs && micros() - start > task.deadlineUs && taskOverruns[i] < 0xFFFF) {
+      taskOverruns[i]++;
+    }
+    if (Serial1.available()) handleSerialIngest();
+  }
+}
+
+// "task <name>=<n> ..." for the tasks that have overrun, or "task -".
+uint8_t formatTaskOverruns(char *line, uint8_t size) {
+  int n = snprintf_P(line, size, PSTR("task"));
+  for (uint8_t i = 0; i < TASK_COUNT && n < size; i++) {
+    if (!taskOverruns[i]) continue;
+    char name[6];
+    strcpy_P(name, taskTable[i].name);
+    n += snprintf_P(line + n, size - n, PSTR(" %s=%u"), name, taskOverruns[i]);
+  }
+  if (n == 4) n += snprintf_P(line + n, size - n, PSTR(" -"));
+  return n < size ? n : size - 1;
+}
+
+// Idles the CPU until the next interrupt. SLEEP_MODE_IDLE keeps the
+// USART, timers and external interrupts running, so Serial1 bytes, millis()
+// and the RTC alarm all wake it. PWR_DOWN would stop the USART clock and
+// drop upload bytes, and the DROP button pin has no wake-capable interrupt.
+void sleepUntilEvent() {
+  if (receiving || isDispensing() || Serial1.available()) return;
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  noInterrupts();
+  if (!rtcAlarmFlag) {
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+  }
+  interrupts();
+}
+
+void setup() {
+  Serial.begin(9600);
+  Serial1.begin(115200);
+  initMarker(startMarker);
+  initMarker(statsMarker);
+  initMarker(logMarker);
+  initMarker(inventoryMarker);
+  initMarker(endMarker);
+
+  pinMode(SD_CS, OUTPUT);
+  pinMode(TFT_CS, OUTPUT);
+  pinMode(DROP_BTN, INPUT_PULLUP);
+  startButtonSampling();
+  pinMode(MOTOR_1, OUTPUT);
+  pinMode(MOTOR_2, OUTPUT);
+  pinMode(MOTOR_3, OUTPUT);
+  pinMode(MOTOR_4, OUTPUT);
+  if (watchdogReset()) {
+    LOG_WARN(F("Restarted by the watchdog")); // Using F() macro
+  }
+  loadCalibration();
+  loadInventory();
+
+  // Alarm-ready first: the cached schedule and the RTC need neither the
+  // card nor the display, whose init alone takes ~180 ms of delays.
+  filestat = loadScheduleCache();
+  if (filestat) groupMedicationsByTime();
+
+  if (!rtc.begin()) {
+    LOG_ERROR(F("RTC not found!")); // Using F() macro
+  } else {
+    rtcReady = true;
+  }
+  if (rtcReady && rtc.lostPower()) {
+    // The oscillator stopped, so the count is meaningless; the build time
+    // is the best guess available until the clock is set.
+    LOG_WARN(F("RTC lost power, set to the build time")); // Using F() macro
+    rtc.adjust(DateTime(__DATE__, __TIME__));
+  }
+  if (rtcReady) {
+    initRtcAlarms();
+    readRtc();
+    scheduleNextDoseAlarm();
   }
+
+  // Position is unknown at power-up, so jump to standby; serviceServos()
+  // detaches them once they have settled.
+  for (int i = 0; i < 4; i++) {
+    tubeMappings[i].servo->attach(tubeMappings[i].servoPin);
+    tubeMappings[i].servo->write(tubeMappings[i].cal.standbyPos);
+  }
+
+  SPI.begin();
+  digitalWrite(SD_CS, HIGH);
+  digitalWrite(TFT_CS, HIGH);
+  tft.init(240, 280);
+  tft.setRotation(3);
+
+  // Without a cached schedule the intro stays up until serviceBoot() has
+  // read the card.
+  if (!filestat) {
+    animatedIntro();
+  } else {
+    showMainMenu();
+    uiRefreshPending = false;
+  }
+  wdt_enable(WATCHDOG_TIMEOUT);
+}
+
+void loop() {
+  unsigned long loopStart = micros();
+  wdt_reset();
+  runTasks();
+  profileRecord(PROFILE_LOOP, micros() - loopStart);
+  sleepUntilEvent();
 }
@@ -9,7 +9,11 @@ import time
 from tkinter import Canvas
 import math
 import json
+import struct
+import random
+import copy
 import tkinter as tk
+import datetime
 
 try:
     from bleak import BleakScanner, BleakClient
@@ -21,6 +25,543 @@ except Exception as e:
     print(f"BLE initialization error: {e}")
     BLEAK_AVAILABLE = False
 
+# Packed schedule image read by the firmware (loadScheduleImage() in
+# main.cpp): header, string pool, records. The pool holds each distinct
+# medication/dosage text once, NUL terminated, starting with ""; records
+# mirror MedicationTime: minutes since midnight, amount, medication and
+# dosage pool offsets, tube index. Multi-byte fields are little-endian.
+SCHEDULE_IMAGE_MAGIC = 0x4253444D  # "MDSB"
+SCHEDULE_IMAGE_VERSION = 2
+SCHEDULE_HEADER = struct.Struct("<IBBHIIHHHH")
+SCHEDULE_RECORD = struct.Struct("<HhBBB")
+STRING_POOL_SIZE = 256
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, matching crc16() in the firmware"""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def time_to_minutes(value):
+    """Convert "HH:MM" to minutes since midnight, or None if invalid"""
+    try:
+        hours, minutes = (int(part) for part in value.split(":"))
+    except (AttributeError, ValueError):
+        return None
+    if not (0 <= hours <= 23 and 0 <= minutes <= 59):
+        return None
+    return hours * 60 + minutes
+
+
+def fixed_str(value, size):
+    """Encode a string into a NUL-terminated fixed-size field"""
+    return str(value).encode("utf-8")[:size - 1]
+
+
+def build_schedule_image(medications, source_length=0, generation=0):
+    """Pack medications into the firmware's binary schedule image"""
+    pool = bytearray(b"\0")
+    offsets = {b"": 0}
+
+    def intern(text):
+        """Pool offset of text, or None once the pool is full"""
+        if text not in offsets:
+            if len(pool) + len(text) + 1 > STRING_POOL_SIZE:
+                return None
+            offsets[text] = len(pool)
+            pool.extend(text + b"\0")
+        return offsets[text]
+
+    # Doses the firmware would drop (unknown tube, bad time, no room for
+    # the text) are left out the same way.
+    records = b""
+    count = 0
+    for med in medications:
+        tube = tube_index(med.get("tube"))
+        medication = intern(fixed_str(med.get("type", ""), 24))
+        if tube is None or medication is None:
+            continue
+        for schedule in med.get("time_to_take", []):
+            minutes = time_to_minutes(schedule.get("time"))
+            dosage = intern(fixed_str(schedule.get("dosage", ""), 16))
+            if minutes is None or dosage is None:
+                continue
+            records += SCHEDULE_RECORD.pack(minutes, int(med.get("amount", 0)), medication, dosage, tube)
+            count += 1
+
+    header = SCHEDULE_HEADER.pack(SCHEDULE_IMAGE_MAGIC, SCHEDULE_IMAGE_VERSION,
+                                  SCHEDULE_RECORD.size, count, generation,
+                                  source_length, crc16_ccitt(bytes(pool) + records),
+                                  len(pool), 0, 0)
+    header = header[:-2] + struct.pack("<H", crc16_ccitt(header[:-2]))
+    return header + bytes(pool) + records
+
+
+def write_schedule_image(json_path, medications):
+    """Write <name>.bin next to a schedule JSON so the card can skip parsing"""
+    image_path = os.path.splitext(json_path)[0] + ".bin"
+    image = build_schedule_image(medications, os.path.getsize(json_path))
+    with open(image_path, "wb") as f:
+        f.write(image)
+    return image_path
+
+# Framed upload protocol spoken by handleFrame() in main.cpp. A frame is
+#   0xA5, type, seq, len, payload[len], crc16 (LE) over type..payload
+FRAME_SOF = 0xA5
+FRAME_BEGIN = 0x01
+FRAME_DATA = 0x02
+FRAME_END = 0x03
+FRAME_PATCH = 0x04
+FRAME_BEGIN_ACK = 0x81
+FRAME_ACK = 0x82
+FRAME_END_ACK = 0x83
+FRAME_PATCH_ACK = 0x84
+FRAME_LOG_DATA = 0x85
+FRAME_LOG_END = 0x86
+UPLOAD_ENCODING_RAW = 0
+UPLOAD_ENCODING_LZ = 1
+UPLOAD_STATUS = {
+    0: "ok",
+    1: "SD save failed",
+    2: "content check failed",
+    3: "schedule did not parse",
+    4: "patch does not match the stored schedule",
+    5: "no room for the edit",
+}
+
+def build_frame(frame_type, seq, payload=b""):
+    """Encode one protocol frame"""
+    head = bytes([frame_type, seq & 0xFF, len(payload)])
+    crc = crc16_ccitt(head + payload)
+    return bytes([FRAME_SOF]) + head + payload + struct.pack("<H", crc)
+
+class FrameReader:
+    """Reassemble device frames from arbitrarily split notification chunks"""
+
+    def __init__(self):
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        """Add received bytes, return the list of complete (type, seq, payload)"""
+        self.buffer.extend(data)
+        frames = []
+        while True:
+            start = self.buffer.find(bytes([FRAME_SOF]))
+            if start < 0:
+                self.buffer.clear()
+                return frames
+            del self.buffer[:start]
+            if len(self.buffer) < 4:
+                return frames
+            length = self.buffer[3]
+            if len(self.buffer) < 6 + length:
+                return frames
+            body = bytes(self.buffer[1:4 + length])
+            (crc,) = struct.unpack_from("<H", self.buffer, 4 + length)
+            if crc == crc16_ccitt(body):
+                frames.append((body[0], body[1], body[3:]))
+                del self.buffer[:6 + length]
+            else:
+                del self.buffer[:1]  # resync on the next SOF
+
+# LZSS matching lzFeed() in main.cpp: a flag byte (LSB first, 1 = literal)
+# before every eight items; a match is a LE u16 of
+# (distance - 1) | (length - LZ_MIN_MATCH) << 9. The window is the
+# device's 512 byte SD sector buffer.
+LZ_WINDOW = 512
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = LZ_MIN_MATCH + 127
+
+def lz_compress(data):
+    """Greedy LZSS encode of data for UPLOAD_ENCODING_LZ"""
+    out = bytearray()
+    chains = {}  # 3-byte prefix -> recent positions, newest last
+    flags_at = None
+    item = 8
+    pos = 0
+    while pos < len(data):
+        if item == 8:
+            flags_at = len(out)
+            out.append(0)
+            item = 0
+
+        best_len, best_dist = 0, 0
+        prefix = data[pos:pos + LZ_MIN_MATCH]
+        for start in reversed(chains.get(prefix, ())):
+            dist = pos - start
+            if dist > LZ_WINDOW:
+                break
+            length = LZ_MIN_MATCH
+            limit = min(LZ_MAX_MATCH, len(data) - pos)
+            while length < limit and data[start + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_dist = length, dist
+                if length == limit:
+                    break
+
+        if best_len >= LZ_MIN_MATCH:
+            out += struct.pack("<H", (best_dist - 1) | (best_len - LZ_MIN_MATCH) << 9)
+            step = best_len
+        else:
+            out[flags_at] |= 1 << item
+            out.append(data[pos])
+            step = 1
+
+        for i in range(pos, min(pos + step, len(data) - LZ_MIN_MATCH + 1)):
+            chains.setdefault(data[i:i + LZ_MIN_MATCH], []).append(i)
+        pos += step
+        item += 1
+    return bytes(out)
+
+class UploadError(Exception):
+    """Upload failed in a way a resumed attempt will not fix"""
+
+async def expect_frame(frames, timeout, frame_types, seq=None):
+    """Wait for a device frame of one of frame_types (and seq, if given)"""
+    loop = asyncio.get_running_loop()
+    deadline = loop.time() + timeout
+    while True:
+        remaining = deadline - loop.time()
+        if remaining <= 0:
+            raise asyncio.TimeoutError
+        ftype, fseq, payload = await asyncio.wait_for(frames.get(), remaining)
+        if ftype in frame_types and (seq is None or fseq == seq):
+            return ftype, payload
+
+async def request_frame(write, frames, frame, frame_types, seq=None, timeout=1.0, attempts=5):
+    """Send frame until the device answers with one of frame_types"""
+    for _ in range(attempts):
+        await write(frame)
+        try:
+            return await expect_frame(frames, timeout, frame_types, seq)
+        except asyncio.TimeoutError:
+            continue
+    raise TimeoutError("no reply from dispenser")
+
+async def framed_upload(write, frames, data, progress=None, ack_timeout=1.0, max_timeouts=5,
+                        encoding=UPLOAD_ENCODING_RAW):
+    """Send data with the go-back-N framed protocol.
+
+    data is sent as is; with UPLOAD_ENCODING_LZ it must already be
+    lz_compress()ed and the device stores the decoded file.
+
+    write is an async callable taking bytes, frames an asyncio.Queue of
+    decoded device frames. Raises TimeoutError if the link stalls (the
+    device keeps what it has, so calling again resumes) and UploadError
+    if the device rejects the upload.
+    """
+    async def expect(*frame_types):
+        return await expect_frame(frames, ack_timeout, frame_types)
+
+    async def request(frame, *frame_types):
+        return await request_frame(write, frames, frame, frame_types,
+                                   timeout=ack_timeout, attempts=max_timeouts)
+
+    begin = build_frame(FRAME_BEGIN, 0, struct.pack("<IHB", len(data), crc16_ccitt(data), encoding))
+    ftype, reply = await request(begin, FRAME_BEGIN_ACK, FRAME_END_ACK)
+    if ftype == FRAME_END_ACK or len(reply) != 6:
+        status = reply[0] if reply else 1
+        raise UploadError(UPLOAD_STATUS.get(status, f"status {status}"))
+    offset, window, max_payload = struct.unpack("<IBB", reply)
+
+    chunks = [data[i:i + max_payload] for i in range(offset, len(data), max_payload)]
+    base = 0          # first unacknowledged chunk
+    next_chunk = 0    # next chunk to send
+    rewound = False   # one go-back per loss, not one per duplicate ack
+    timeouts = 0
+
+    while base < len(chunks):
+        while next_chunk < len(chunks) and next_chunk < base + window:
+            await write(build_frame(FRAME_DATA, next_chunk, chunks[next_chunk]))
+            next_chunk += 1
+
+        try:
+            _, payload = await expect(FRAME_ACK)
+        except asyncio.TimeoutError:
+            timeouts += 1
+            if timeouts >= max_timeouts:
+                raise TimeoutError("dispenser stopped acknowledging")
+            next_chunk = base
+            continue
+        timeouts = 0
+
+        (received,) = struct.unpack("<I", payload)
+        acked = len(chunks) if received >= len(data) else (received - offset) // max_payload
+        if acked > base:
+            base = acked
+            rewound = False
+            if progress:
+                progress(received, len(data))
+        elif next_chunk > base and not rewound:
+            next_chunk = base
+            rewound = True
+
+    _, reply = await request(build_frame(FRAME_END, 0), FRAME_END_ACK)
+    status = reply[0] if reply else 1
+    if status != 0:
+        raise UploadError(UPLOAD_STATUS.get(status, f"status {status}"))
+
+# Single-dose schedule edits (FRAME_PATCH, see decodeSchedulePatch() in
+# main.cpp). A dose is addressed by tube index and minute, packed like the
+# firmware's DOSE_KEY as tube << 11 | minutes.
+PATCH_ADD_DOSE = 1
+PATCH_REMOVE_DOSE = 2
+PATCH_MODIFY_DOSE = 3
+PATCH_REMOVE_TUBE = 4
+PATCH_LIMIT = 8  # more edits than this go as a full upload
+
+def tube_index(name):
+    """"tube1".."tube4" -> 0..3, or None"""
+    if isinstance(name, str) and name.startswith("tube") and name[4:].isdigit():
+        index = int(name[4:]) - 1
+        if 0 <= index < 4:
+            return index
+    return None
+
+def schedule_doses(medications):
+    """Flatten a schedule into {dose key: (medication, amount, dosage)}.
+
+    Returns None if it cannot be expressed as patches (unknown tube names,
+    bad times or the same tube twice at one minute).
+    """
+    doses = {}
+    for med in medications:
+        tube = tube_index(med.get("tube"))
+        if tube is None:
+            return None
+        for schedule in med.get("time_to_take", []):
+            minutes = time_to_minutes(schedule.get("time"))
+            if minutes is None:
+                return None
+            key = tube << 11 | minutes
+            if key in doses:
+                return None
+            doses[key] = (fixed_str(med.get("type", ""), 24),
+                          int(med.get("amount", 0)),
+                          fixed_str(schedule.get("dosage", ""), 16))
+    return doses
+
+def encode_dose(key, dose):
+    medication, amount, dosage = dose
+    return (struct.pack("<Hh", key, amount) + bytes([len(medication)]) + medication +
+            bytes([len(dosage)]) + dosage)
+
+def schedule_patches(old, new):
+    """PATCH payloads turning schedule old into new, or None if not possible.
+
+    Removals go first so the device never has to hold both versions of a
+    dose time at once.
+    """
+    old_doses, new_doses = schedule_doses(old), schedule_doses(new)
+    if old_doses is None or new_doses is None:
+        return None
+
+    patches = []
+    old_tubes = {key >> 11 for key in old_doses}
+    new_tubes = {key >> 11 for key in new_doses}
+    for tube in sorted(old_tubes - new_tubes):
+        patches.append(struct.pack("<BH", PATCH_REMOVE_TUBE, tube << 11))
+    for key in sorted(old_doses):
+        if key >> 11 in new_tubes and key not in new_doses:
+            patches.append(struct.pack("<BH", PATCH_REMOVE_DOSE, key))
+    for key in sorted(new_doses):
+        if key in old_doses and old_doses[key] != new_doses[key]:
+            patches.append(struct.pack("<BH", PATCH_MODIFY_DOSE, key) + encode_dose(key, new_doses[key]))
+    for key in sorted(new_doses):
+        if key not in old_doses:
+            patches.append(bytes([PATCH_ADD_DOSE]) + encode_dose(key, new_doses[key]))
+    return patches
+
+async def send_patches(write, frames, patches, progress=None, seq=None):
+    """Apply patches one PATCH frame at a time; raises UploadError on refusal"""
+    seq = random.randrange(256) if seq is None else seq
+    for i, payload in enumerate(patches):
+        seq = (seq + 1) & 0xFF
+        _, reply = await request_frame(write, frames, build_frame(FRAME_PATCH, seq, payload),
+                                       (FRAME_PATCH_ACK,), seq=seq)
+        status = reply[0] if reply else 1
+        if status != 0:
+            raise UploadError(UPLOAD_STATUS.get(status, f"status {status}"))
+        if progress:
+            progress(i + 1, len(patches))
+
+# Profiler report, requested with #STATS# (serviceStatsReport() in
+# main.cpp). Times are microseconds and percentiles are histogram bucket
+# upper bounds; bucket k counts runs under 32 << k us, the last one all
+# longer runs.
+STATS_QUERY = b"#STATS#"
+STATS_END = b"#END#"
+STATS_BARS = " ▁▂▃▄▅▆▇█"
+
+def parse_stats_report(text):
+    """Split a #STATS# reply into (counters, {section: fields and buckets})"""
+    counters, sections = {}, {}
+    for line in text.splitlines():
+        fields = line.split()
+        if not fields or fields[0] == "#END#":
+            continue
+        if fields[0] == "#STATS#":
+            counters = dict(field.split("=", 1) for field in fields[1:] if "=" in field)
+        elif len(fields) == 3 and fields[1] == "h":
+            hist = fields[2]
+            sections.setdefault(fields[0], {})["buckets"] = [
+                int(hist[i:i + 4], 16) for i in range(0, len(hist) - 3, 4)]
+        else:
+            sections.setdefault(fields[0], {}).update(
+                (key, int(value)) for key, value in
+                (field.split("=", 1) for field in fields[1:] if "=" in field))
+    return counters, sections
+
+def format_stats_report(counters, sections):
+    """Readable summary with one histogram sparkline per section"""
+    lines = [f"Uptime {counters.get('up', '?')} s, {counters.get('frames', '?')} frames drawn",
+             f"Serial1 RX peak {counters.get('rx_peak', '?')} bytes, "
+             f"ring full {counters.get('rx_full', '?')} times",
+             ""]
+    memory = sections.pop("mem", None)
+    if memory:
+        lines.insert(2, f"RAM: {memory.get('static', '?')} static, {memory.get('heap', '?')} heap, "
+                        f"stack peak {memory.get('stack', '?')}, {memory.get('headroom', '?')} never touched")
+    overruns = sections.pop("task", None)
+    if overruns is not None:
+        lines.insert(-1, "Task deadline overruns: " +
+                     (", ".join(f"{name} {count}" for name, count in overruns.items()) or "none"))
+    for name, fields in sections.items():
+        buckets = fields.get("buckets", [])
+        top = max(buckets, default=0)
+        bars = "".join(STATS_BARS[-(-count * (len(STATS_BARS) - 1) // top)] if top else " "
+                       for count in buckets)
+        lines.append(f"{name:<7} n={fields.get('n', 0):<8} p50≤{fields.get('p50', 0)}us "
+                     f"p99≤{fields.get('p99', 0)}us max={fields.get('max', 0)}us  |{bars}|")
+    return "\n".join(lines)
+
+async def request_stats(write, replies, timeout=3.0):
+    """Send #STATS# and collect the text reply up to #END#"""
+    await write(STATS_QUERY)
+    reply = bytearray()
+    loop = asyncio.get_running_loop()
+    deadline = loop.time() + timeout
+    while STATS_END not in reply:
+        remaining = deadline - loop.time()
+        if remaining <= 0:
+            raise UploadError("no #STATS# reply")
+        try:
+            reply += await asyncio.wait_for(replies.get(), remaining)
+        except asyncio.TimeoutError:
+            continue
+    start = max(reply.find(STATS_QUERY), 0)
+    end = reply.find(STATS_END) + len(STATS_END)
+    return reply[start:end].decode("ascii", "replace")
+
+# Dose event log, requested with #LOG# (serviceEventLog() in main.cpp).
+# The reply is FRAME_LOG_DATA frames of 16 byte DoseEvent records, oldest
+# first, then FRAME_LOG_END with the record count and the next seq.
+LOG_QUERY = b"#LOG#"
+DOSE_EVENT = "<IIhHBBH"  # seq, time, weight (1/100 g), ms, tube, outcome, crc
+DOSE_OUTCOME = {0: "dispensed", 1: "timeout", 2: "skipped", 3: "snoozed"}
+
+def parse_event_records(payload):
+    """FRAME_LOG_DATA payload -> list of event dicts"""
+    events = []
+    for offset in range(0, len(payload) - struct.calcsize(DOSE_EVENT) + 1, struct.calcsize(DOSE_EVENT)):
+        seq, stamp, weight, ms, tube, outcome, _ = struct.unpack_from(DOSE_EVENT, payload, offset)
+        events.append({"seq": seq, "time": stamp, "grams": weight / 100, "ms": ms,
+                       "tube": f"tube{tube + 1}", "outcome": DOSE_OUTCOME.get(outcome, f"outcome {outcome}")})
+    return events
+
+def format_event_time(stamp):
+    """RTC unixtime (local wall clock, no zone) as text"""
+    if not stamp:
+        return "no clock"
+    return datetime.datetime.fromtimestamp(stamp, datetime.timezone.utc).strftime("%Y-%m-%d %H:%M:%S")
+
+def format_event_log(events, recent=15):
+    """Totals per tube and the most recent events"""
+    lines = [f"{len(events)} events"]
+    for tube in sorted({event["tube"] for event in events}):
+        mine = [event for event in events if event["tube"] == tube]
+        count = {outcome: sum(event["outcome"] == outcome for event in mine) for outcome in DOSE_OUTCOME.values()}
+        doses = len(mine) - count["snoozed"]  # a snoozed dose is logged again when it is taken or skipped
+        lines.append(f"{tube}: {doses} doses, {count['timeout']} timed out, {count['skipped']} skipped, "
+                     f"{count['snoozed']} snoozes")
+    lines.append("")
+    for event in events[-recent:]:
+        lines.append(f"{format_event_time(event['time'])}  {event['tube']}  {event['outcome']:<9} "
+                     f"{event['grams']:+.2f} g in {event['ms']} ms")
+    return "\n".join(lines)
+
+def write_event_log_csv(path, events):
+    with open(path, "w") as f:
+        f.write("seq,time,tube,outcome,grams,ms\n")
+        for event in events:
+            f.write(f"{event['seq']},{format_event_time(event['time'])},{event['tube']},"
+                    f"{event['outcome']},{event['grams']:.2f},{event['ms']}\n")
+
+async def request_event_log(write, frames, timeout=5.0):
+    """Send #LOG# and collect the events up to FRAME_LOG_END"""
+    await write(LOG_QUERY)
+    events = []
+    while True:
+        try:
+            frame_type, _, payload = await asyncio.wait_for(frames.get(), timeout)
+        except asyncio.TimeoutError:
+            raise UploadError("no #LOG# reply")
+        if frame_type == FRAME_LOG_DATA:
+            events += parse_event_records(payload)
+        elif frame_type == FRAME_LOG_END:
+            (count,) = struct.unpack_from("<H", payload)
+            if count != len(events):
+                raise UploadError(f"event log incomplete: {len(events)} of {count} records")
+            return sorted(events, key=lambda event: event["seq"])
+
+# Pill stock per tube, requested with #INV# and also sent by the dispenser
+# whenever it changes (serviceInventoryReport() in main.cpp):
+#   #INV# stock=<n|->,... days=<n|->,... low=<tubes|->
+INVENTORY_QUERY = b"#INV#"
+
+def parse_inventory(line):
+    """#INV# line -> (stock, days, low tubes); unknown values are None"""
+    fields = dict(field.split("=", 1) for field in line.split()[1:] if "=" in field)
+    values = lambda key: [None if v == "-" else int(v) for v in fields.get(key, "").split(",") if v]
+    low = fields.get("low", "-")
+    return values("stock"), values("days"), [] if low == "-" else [int(t) for t in low.split(",")]
+
+def format_inventory(stock, days, low):
+    lines = []
+    for tube, (count, left) in enumerate(zip(stock, days), 1):
+        if count is None:
+            lines.append(f"tube{tube}: not loaded through tube setup")
+        else:
+            lines.append(f"tube{tube}: {count} left" + (f", {left} days" if left is not None else ", not scheduled"))
+    if low:
+        lines.append("Refill soon: " + ", ".join(f"tube{tube}" for tube in low))
+    return "\n".join(lines)
+
+async def request_inventory(write, replies, timeout=3.0):
+    """Send #INV# and return the first complete #INV# line"""
+    await write(INVENTORY_QUERY)
+    reply = bytearray()
+    loop = asyncio.get_running_loop()
+    deadline = loop.time() + timeout
+    while True:
+        start = reply.find(INVENTORY_QUERY)
+        end = reply.find(b"\r\n", start) if start >= 0 else -1
+        if end >= 0:
+            return reply[start:end].decode("ascii", "replace")
+        remaining = deadline - loop.time()
+        if remaining <= 0:
+            raise UploadError("no #INV# reply")
+        try:
+            reply += await asyncio.wait_for(replies.get(), remaining)
+        except asyncio.TimeoutError:
+            continue
+
 class ResponsiveAutoPillDispenserApp:
     def __init__(self):
         # Initialize main window with responsive settings
@@ -38,6 +579,7 @@ class ResponsiveAutoPillDispenserApp:
         self.is_sending = False
         self.qr_data = ""
         self.medication_data = []
+        self.device_schedules = {}  # address -> schedule the device last accepted
         
         self.manual_medications = []
         self.current_med_schedules = []
@@ -251,6 +793,22 @@ class ResponsiveAutoPillDispenserApp:
             command=self.refresh_devices
         )
         self.refresh_btn.pack(side="right")
+
+        self.stats_btn = ttk.Button(
+            device_header_frame,
+            text="📊 Stats",
+            bootstyle="info-outline",
+            command=self.show_device_stats
+        )
+        self.stats_btn.pack(side="right", padx=(0, 5))
+
+        self.log_btn = ttk.Button(
+            device_header_frame,
+            text="📜 History",
+            bootstyle="info-outline",
+            command=self.show_event_log
+        )
+        self.log_btn.pack(side="right", padx=(0, 5))
         
         # Create device list frame
         list_frame = ttk.Frame(conn_frame)
@@ -750,6 +1308,9 @@ class ResponsiveAutoPillDispenserApp:
             self.medication_data = data
             self.file_var.set(path)
             filename = os.path.basename(path)
+
+            # Precompiled image for cards loaded directly from this folder
+            image_path = write_schedule_image(path, data)
             
             # Calculate stats
             total_medications = len(data)
@@ -763,7 +1324,8 @@ class ResponsiveAutoPillDispenserApp:
             # Display preview
             self.display_medication_preview(data)
             
-            self.show_notification(f"Loaded {total_medications} medications from {total_tubes} tubes", "success")
+            self.show_notification(f"Loaded {total_medications} medications from {total_tubes} tubes "
+                                   f"(image: {os.path.basename(image_path)})", "success")
             
         except Exception as e:
             self.show_notification(f"Error loading file: {str(e)}", "error")
@@ -862,7 +1424,7 @@ class ResponsiveAutoPillDispenserApp:
         def submit_task():
             try:
                 if mode == "json":
-                    data = "#START#" + json.dumps(self.medication_data, indent=2) + "#END#"
+                    data = json.dumps(self.medication_data, separators=(",", ":"))
                 else:
                     data = self.qr_data
                     
@@ -889,8 +1451,14 @@ class ResponsiveAutoPillDispenserApp:
                 if not device_address:
                     raise Exception(f"Device address not found for {device_name}")
                 
-                # Run BLE transmission in async context
-                asyncio.run(self.send_ble_data(device_address, data_bytes, CHUNK_SIZE, CHUNK_DELAY, total_chunks))
+                # Run BLE transmission in async context. Schedules use the
+                # framed protocol; QR payloads keep the legacy marker stream.
+                if mode == "json":
+                    schedule = copy.deepcopy(self.medication_data)
+                    asyncio.run(self.send_framed_data(device_address, data_bytes, schedule))
+                    self.device_schedules[device_address] = schedule
+                else:
+                    asyncio.run(self.send_ble_data(device_address, data_bytes, CHUNK_SIZE, CHUNK_DELAY, total_chunks))
                 
                 self.app.after(0, lambda: [
                     self.show_notification("Successfully submitted to dispenser!", "success"),
@@ -952,6 +1520,183 @@ class ResponsiveAutoPillDispenserApp:
         except Exception as e:
             raise Exception(f"BLE transmission failed: {str(e)}")
 
+    async def send_framed_data(self, device_address, data_bytes, schedule=None, chunk_size=20, attempts=3):
+        """Send a schedule with the acknowledged framed protocol, resuming after drops.
+
+        If the device already holds an earlier schedule from this session and
+        only a few doses differ, just those edits are sent as patches; a
+        refused patch falls back to the full upload.
+        """
+        def show_progress(sent, total):
+            text = f"📦 Sent {sent}/{total} bytes"
+            self.app.after(0, lambda t=text: self.chunk_progress_label.configure(text=t))
+
+        def show_patch_progress(done, total):
+            text = f"📦 Applied edit {done}/{total}"
+            self.app.after(0, lambda t=text: self.chunk_progress_label.configure(text=t))
+
+        # The dispenser decodes LZ as it streams to the card; not resumable,
+        # so tiny schedules where it does not pay off go raw.
+        payload, encoding = lz_compress(data_bytes), UPLOAD_ENCODING_LZ
+        if len(payload) >= len(data_bytes):
+            payload, encoding = data_bytes, UPLOAD_ENCODING_RAW
+
+        patches = None
+        previous = self.device_schedules.get(device_address)
+        if schedule is not None and previous is not None:
+            patches = schedule_patches(previous, schedule)
+            if patches is not None and len(patches) > PATCH_LIMIT:
+                patches = None
+
+        if device_address.startswith("SIM:") or device_address == "00:00:00:00:00":
+            for sent in range(0, len(payload), 48):
+                show_progress(sent, len(payload))
+                await asyncio.sleep(0.05)
+            show_progress(len(payload), len(payload))
+            return
+
+        CHARACTERISTIC_UUID = "87654321-4321-4321-4321-cba987654321"
+
+        for attempt in range(attempts):
+            try:
+                async with BleakClient(device_address, timeout=10.0) as client:
+                    if not client.is_connected:
+                        raise Exception("Failed to connect to BLE device")
+
+                    frames = asyncio.Queue()
+                    reader = FrameReader()
+
+                    def on_notify(_, data):
+                        for frame in reader.feed(data):
+                            frames.put_nowait(frame)
+
+                    async def write(frame):
+                        for i in range(0, len(frame), chunk_size):
+                            await client.write_gatt_char(CHARACTERISTIC_UUID, frame[i:i + chunk_size])
+
+                    await client.start_notify(CHARACTERISTIC_UUID, on_notify)
+                    if patches is not None:
+                        try:
+                            await send_patches(write, frames, patches, progress=show_patch_progress)
+                            return
+                        except UploadError:
+                            # Device schedule differs from ours or is full: resend it whole
+                            patches = None
+                    await framed_upload(write, frames, payload, progress=show_progress, encoding=encoding)
+                    return
+            except UploadError as e:
+                raise Exception(f"Dispenser rejected upload: {e}")
+            except Exception as e:
+                if attempt == attempts - 1:
+                    raise Exception(f"BLE transmission failed: {str(e)}")
+                # A raw upload resumes from the prefix the dispenser kept; LZ restarts
+                text = f"📶 Link lost, resuming ({attempt + 2}/{attempts})..."
+                self.app.after(0, lambda t=text: self.chunk_progress_label.configure(text=t))
+                await asyncio.sleep(1)
+
+    async def fetch_device_stats(self, device_address):
+        """Query the firmware profiler and pill stock over the BLE serial link"""
+        CHARACTERISTIC_UUID = "87654321-4321-4321-4321-cba987654321"
+
+        async with BleakClient(device_address, timeout=10.0) as client:
+            if not client.is_connected:
+                raise Exception("Failed to connect to BLE device")
+
+            replies = asyncio.Queue()
+
+            async def write(data):
+                await client.write_gatt_char(CHARACTERISTIC_UUID, data)
+
+            await client.start_notify(CHARACTERISTIC_UUID, lambda _, data: replies.put_nowait(bytes(data)))
+            stats = await request_stats(write, replies)
+            while not replies.empty():
+                replies.get_nowait()
+            return stats, await request_inventory(write, replies)
+
+    def show_device_stats(self):
+        """Show the dispenser's pill stock, loop timing and serial/SD/UI counters"""
+        if not getattr(self, 'selected_ble_device', None):
+            messagebox.showerror("Error", "Please select a BLE device from the list first!")
+            return
+
+        address = self.selected_ble_device['address']
+        name = self.selected_ble_device['name']
+        if address.startswith("SIM:") or address.startswith("00:00:00:00:00"):
+            self.show_notification("Stats are not available for a simulated device", "warning")
+            return
+
+        self.stats_btn.configure(text="📊 Reading...", state="disabled")
+
+        def stats_task():
+            try:
+                text, inventory = asyncio.run(self.fetch_device_stats(address))
+                summary = (format_inventory(*parse_inventory(inventory)) + "\n\n" +
+                           format_stats_report(*parse_stats_report(text)))
+                self.app.after(0, lambda: messagebox.showinfo(f"{name} stats", summary))
+            except Exception as e:
+                self.app.after(0, lambda err=e: self.show_notification(f"Stats failed: {err}", "error"))
+            finally:
+                self.app.after(0, lambda: self.stats_btn.configure(text="📊 Stats", state="normal"))
+
+        threading.Thread(target=stats_task, daemon=True).start()
+
+    async def fetch_event_log(self, device_address):
+        """Pull the dispenser's dose event log over the BLE serial link"""
+        CHARACTERISTIC_UUID = "87654321-4321-4321-4321-cba987654321"
+
+        async with BleakClient(device_address, timeout=10.0) as client:
+            if not client.is_connected:
+                raise Exception("Failed to connect to BLE device")
+
+            frames = asyncio.Queue()
+            reader = FrameReader()
+
+            def on_notify(_, data):
+                for frame in reader.feed(data):
+                    frames.put_nowait(frame)
+
+            async def write(data):
+                await client.write_gatt_char(CHARACTERISTIC_UUID, data)
+
+            await client.start_notify(CHARACTERISTIC_UUID, on_notify)
+            return await request_event_log(write, frames)
+
+    def show_event_log(self):
+        """Show the recorded doses and offer to save them as CSV"""
+        if not getattr(self, 'selected_ble_device', None):
+            messagebox.showerror("Error", "Please select a BLE device from the list first!")
+            return
+
+        address = self.selected_ble_device['address']
+        name = self.selected_ble_device['name']
+        if address.startswith("SIM:") or address.startswith("00:00:00:00:00"):
+            self.show_notification("History is not available for a simulated device", "warning")
+            return
+
+        self.log_btn.configure(text="📜 Reading...", state="disabled")
+
+        def save(events):
+            if not events or not messagebox.askyesno(f"{name} history",
+                                                     format_event_log(events) + "\n\nSave as CSV?"):
+                return
+            path = filedialog.asksaveasfilename(defaultextension=".csv", filetypes=[("CSV", "*.csv")])
+            if path:
+                write_event_log_csv(path, events)
+
+        def log_task():
+            try:
+                events = asyncio.run(self.fetch_event_log(address))
+                if events:
+                    self.app.after(0, lambda: save(events))
+                else:
+                    self.app.after(0, lambda: self.show_notification("No doses recorded yet", "info"))
+            except Exception as e:
+                self.app.after(0, lambda err=e: self.show_notification(f"History failed: {err}", "error"))
+            finally:
+                self.app.after(0, lambda: self.log_btn.configure(text="📜 History", state="normal"))
+
+        threading.Thread(target=log_task, daemon=True).start()
+
     def get_ble_devices(self):
         """Get available BLE devices with improved error handling"""
         if not BLEAK_AVAILABLE:
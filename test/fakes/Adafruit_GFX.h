@@ -0,0 +1,78 @@
+// Display fakes count pixels instead of drawing them: 'pixels' is what
+// would have gone over SPI to the panel.
+#pragma once
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+public:
+  int16_t cursorX = 0, cursorY = 0;
+  uint8_t textSize = 1;
+  unsigned long pixels = 0;
+
+  size_t write(uint8_t) override {
+    pixels += 35UL * textSize * textSize;  // 5x7 glyph
+    cursorX += 6 * textSize;
+    return 1;
+  }
+  using Print::write;
+
+  void fillScreen(uint16_t) { pixels += 320UL * 240; }
+  void fillRect(int16_t, int16_t, int16_t w, int16_t h, uint16_t) { pixels += (unsigned long)w * h; }
+  void drawRect(int16_t, int16_t, int16_t w, int16_t h, uint16_t) { pixels += 2UL * (w + h); }
+  void fillRoundRect(int16_t, int16_t, int16_t w, int16_t h, int16_t, uint16_t) { pixels += (unsigned long)w * h; }
+  void drawRoundRect(int16_t, int16_t, int16_t w, int16_t h, int16_t, uint16_t) { pixels += 2UL * (w + h); }
+  void drawFastHLine(int16_t, int16_t, int16_t w, uint16_t) { pixels += w; }
+  void drawFastVLine(int16_t, int16_t, int16_t h, uint16_t) { pixels += h; }
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t) {
+    pixels += max(abs(x1 - x0), abs(y1 - y0)) + 1;
+  }
+  void fillCircle(int16_t, int16_t, int16_t r, uint16_t) { pixels += 4UL * r * r; }
+  void drawPixel(int16_t, int16_t, uint16_t) { pixels++; }
+  void drawChar(int16_t, int16_t, unsigned char, uint16_t, uint16_t, uint8_t size) { pixels += 35UL * size * size; }
+
+  void setCursor(int16_t x, int16_t y) {
+    cursorX = x;
+    cursorY = y;
+  }
+  void setTextSize(uint8_t size) { textSize = size; }
+  void setTextColor(uint16_t) {}
+  void setTextColor(uint16_t, uint16_t) {}
+  void setTextWrap(bool) {}
+  void setRotation(uint8_t) {}
+  int16_t getCursorX() const { return cursorX; }
+  int16_t getCursorY() const { return cursorY; }
+  int16_t width() const { return 320; }
+  int16_t height() const { return 240; }
+};
+
+// One-bit canvas with the library's layout: rows of (w + 7) / 8 bytes,
+// leftmost pixel in the top bit. drawChar() renders the classic font from
+// the stand-in in glcdfont.c, which only this header includes, as the real
+// font is only reachable through Adafruit_GFX.cpp.
+#include "glcdfont.c"
+
+class GFXcanvas1 : public Adafruit_GFX {
+public:
+  GFXcanvas1(uint16_t w, uint16_t h) : w(w), h(h), buffer(new uint8_t[(w + 7) / 8 * h]()) {}
+  ~GFXcanvas1() { delete[] buffer; }
+  uint8_t *getBuffer() const { return buffer; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) {
+    if (x < 0 || y < 0 || x >= w || y >= h) return;
+    uint8_t &b = buffer[y * ((w + 7) / 8) + x / 8];
+    if (color) b |= 0x80 >> (x & 7);
+    else b &= ~(0x80 >> (x & 7));
+  }
+  void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t) {
+    if (c >= 176) c++;  // GFX without cp437()
+    for (int8_t i = 0; i < 6; i++) {
+      uint8_t line = i < 5 ? pgm_read_byte(&font[c * 5 + i]) : 0;
+      for (int8_t j = 0; j < 8; j++, line >>= 1) drawPixel(x + i, y + j, line & 1 ? color : bg);
+    }
+  }
+
+private:
+  int16_t w, h;
+  uint8_t *buffer;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Adafruit_GFX.h"
+
+#define ST77XX_BLACK 0x0000
+#define ST77XX_WHITE 0xFFFF
+#define ST77XX_RED 0xF800
+#define ST77XX_GREEN 0x07E0
+#define ST77XX_BLUE 0x001F
+#define ST77XX_CYAN 0x07FF
+#define ST77XX_MAGENTA 0xF81F
+#define ST77XX_YELLOW 0xFFE0
+#define ST77XX_ORANGE 0xFC00
+
+class Adafruit_ST7789 : public Adafruit_GFX {
+public:
+  unsigned long windows = 0;  // setAddrWindow() calls, one command each
+
+  Adafruit_ST7789(int8_t, int8_t, int8_t) {}
+  void init(uint16_t, uint16_t, uint8_t = 0) {}
+  uint16_t color565(uint8_t r, uint8_t g, uint8_t b) { return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3); }
+
+  void startWrite() {}
+  void endWrite() {}
+  void setAddrWindow(uint16_t, uint16_t, uint16_t, uint16_t) { windows++; }
+  void writePixels(uint16_t *, uint32_t n, bool = true, bool = false) { pixels += n; }
+  void writeColor(uint16_t, uint32_t n) { pixels += n; }
+  void writePixel(int16_t, int16_t, uint16_t) { pixels++; }
+  void writeFillRect(int16_t, int16_t, int16_t w, int16_t h, uint16_t) { pixels += (unsigned long)w * h; }
+};
@@ -0,0 +1,213 @@
+// Host stand-in for the Arduino core, just enough of it for src/main.cpp
+// to build under [env:native]. Time only moves when the program calls
+// delay() or a test advances fakeMicros, so runs are deterministic.
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+#define A4 58
+#define PI 3.14159265358979
+#define DEC 10
+#define HEX 16
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// Flash is ordinary memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void *const *)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strcmp_P strcmp
+#define snprintf_P snprintf
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define FPSTR(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+#define noInterrupts()
+#define interrupts()
+#define cli()
+#define sei()
+#define bitRead(v, b) (((v) >> (b)) & 1)
+#define _BV(b) (1 << (b))
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+template <class T>
+T constrain(T x, T lo, T hi) { return x < lo ? lo : (x > hi ? hi : x); }
+
+inline unsigned long fakeMicros = 0;
+
+inline unsigned long millis() { return fakeMicros / 1000; }
+inline unsigned long micros() { return fakeMicros; }
+inline void delay(unsigned long ms) { fakeMicros += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { fakeMicros += us; }
+
+// Pins read back whatever a test put in fakePins; inputs idle high
+// (pull-ups), analog inputs read fakeAnalog.
+inline uint8_t fakePins[70];
+inline int fakeAnalog = 300;
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP) fakePins[pin] = HIGH;
+}
+inline void digitalWrite(uint8_t pin, uint8_t value) { fakePins[pin] = value; }
+inline int digitalRead(uint8_t pin) { return fakePins[pin]; }
+inline int analogRead(uint8_t) { return fakeAnalog; }
+
+inline void (*fakeIsr[8])(void);
+
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : (p) == 3 ? 1 : -1)
+inline void attachInterrupt(uint8_t n, void (*isr)(void), int) { fakeIsr[n] = isr; }
+inline void detachInterrupt(uint8_t n) { fakeIsr[n] = nullptr; }
+
+// ADC and port registers used by the FSR sampler and the DROP button
+// sampler. ISR(ADC_vect) becomes a plain function a test can call after
+// setting ADC; input ports read back fakePins.
+inline volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0, OCR0A, TIMSK0, fakePort;
+inline volatile uint16_t ADC;
+
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define MUX5 3
+#define OCIE0A 1
+#define ISR(vector) extern "C" void vector()
+#define digitalPinToPort(p) (p)
+#define portOutputRegister(p) (&fakePort)
+#define portInputRegister(p) (&fakePins[p])
+#define digitalPinToBitMask(p) ((uint8_t)1)
+
+class String {
+public:
+  std::string s;
+  String(const char *c = "") : s(c) {}
+  String(const std::string &x) : s(x) {}
+  unsigned length() const { return s.size(); }
+  char operator[](unsigned i) const { return s[i]; }
+  String substring(unsigned a, unsigned b) const { return String(s.substr(a, b - a)); }
+  String &operator+=(char c) { s += c; return *this; }
+  const char *c_str() const { return s.c_str(); }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n) {
+    size_t r = 0;
+    while (n--) r += write(*buf++);
+    return r;
+  }
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t write(const char *s, size_t n) { return write((const uint8_t *)s, n); }
+  virtual int availableForWrite() { return 64; }
+  virtual void flush() {}
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+  size_t print(const String &s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) {
+    char t[24];
+    snprintf(t, sizeof(t), base == HEX ? "%lx" : "%ld", v);
+    return write(t);
+  }
+  size_t print(unsigned long v, int base = DEC) {
+    char t[24];
+    snprintf(t, sizeof(t), base == HEX ? "%lx" : "%lu", v);
+    return write(t);
+  }
+  size_t print(double v, int digits = 2) {
+    char t[32];
+    snprintf(t, sizeof(t), "%.*f", digits, v);
+    return write(t);
+  }
+  size_t println() { return write("\r\n"); }
+  template <class T>
+  size_t println(T v) { return print(v) + println(); }
+  template <class T>
+  size_t println(T v, int base) { return print(v, base) + println(); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  size_t readBytes(char *buf, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+      int c = read();
+      if (c < 0) break;
+      buf[i++] = c;
+    }
+    return i;
+  }
+  size_t readBytes(uint8_t *buf, size_t n) { return readBytes((char *)buf, n); }
+};
+
+// UART with an unbounded RX queue a test fills and a TX log it inspects.
+class HardwareSerial : public Stream {
+public:
+  std::deque<uint8_t> rx;
+  std::vector<uint8_t> tx;
+  void begin(unsigned long) {}
+  int available() override { return rx.size(); }
+  int read() override {
+    if (rx.empty()) return -1;
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+  int peek() override { return rx.empty() ? -1 : rx.front(); }
+  size_t write(uint8_t c) override {
+    tx.push_back(c);
+    return 1;
+  }
+  using Print::write;
+  operator bool() { return true; }
+};
+
+inline HardwareSerial Serial, Serial1, Serial2, Serial3;
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Arduino.h"
+
+// 4 KB like the ATmega2560, erased (0xFF) at start.
+struct FakeEEPROM {
+  uint8_t mem[4096];
+
+  FakeEEPROM() { memset(mem, 0xFF, sizeof(mem)); }
+  uint8_t read(int addr) { return mem[addr]; }
+  void write(int addr, uint8_t value) { mem[addr] = value; }
+  void update(int addr, uint8_t value) { mem[addr] = value; }
+  uint16_t length() { return sizeof(mem); }
+  uint8_t &operator[](int addr) { return mem[addr]; }
+  template <class T>
+  T &get(int addr, T &t) {
+    memcpy(&t, mem + addr, sizeof(t));
+    return t;
+  }
+  template <class T>
+  const T &put(int addr, const T &t) {
+    memcpy(mem + addr, &t, sizeof(t));
+    return t;
+  }
+};
+
+inline FakeEEPROM EEPROM;
+
+// <avr/eeprom.h>: writes complete instantly here.
+inline bool eeprom_is_ready() { return true; }
@@ -0,0 +1,46 @@
+// DS3231 fake: the clock is whatever the last adjust() set, alarms never
+// fire on their own.
+#pragma once
+
+#include "Arduino.h"
+
+class DateTime {
+public:
+  DateTime(uint32_t t = 0) : y(2000), mo(1), d(1), h(t / 3600 % 24), mi(t / 60 % 60), s(t % 60) {}
+  DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t min = 0, uint8_t sec = 0)
+      : y(year), mo(month), d(day), h(hour), mi(min), s(sec) {}
+  DateTime(const char *, const char *) : DateTime(2025, 1, 1) {}
+
+  uint16_t year() const { return y; }
+  uint8_t month() const { return mo; }
+  uint8_t day() const { return d; }
+  uint8_t hour() const { return h; }
+  uint8_t minute() const { return mi; }
+  uint8_t second() const { return s; }
+  uint32_t unixtime() const { return h * 3600UL + mi * 60UL + s; }
+
+private:
+  uint16_t y;
+  uint8_t mo, d, h, mi, s;
+};
+
+enum Ds3231Alarm1Mode { DS3231_A1_PerSecond, DS3231_A1_Second, DS3231_A1_Minute, DS3231_A1_Hour, DS3231_A1_Date, DS3231_A1_Day };
+enum Ds3231Alarm2Mode { DS3231_A2_PerMinute, DS3231_A2_Minute, DS3231_A2_Hour, DS3231_A2_Date, DS3231_A2_Day };
+enum Ds3231SqwPinMode { DS3231_OFF, DS3231_SquareWave1Hz };
+
+class RTC_DS3231 {
+public:
+  DateTime time;
+
+  bool begin() { return true; }
+  void adjust(const DateTime &t) { time = t; }
+  DateTime now() { return time; }
+  bool lostPower() { return false; }
+  bool setAlarm1(const DateTime &, Ds3231Alarm1Mode) { return true; }
+  bool setAlarm2(const DateTime &, Ds3231Alarm2Mode) { return true; }
+  void disableAlarm(uint8_t) {}
+  void clearAlarm(uint8_t) {}
+  bool alarmFired(uint8_t) { return false; }
+  void writeSqwPinMode(Ds3231SqwPinMode) {}
+  void disable32K() {}
+};
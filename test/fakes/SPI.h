@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+struct SPISettings {
+  SPISettings(uint32_t = 0, uint8_t = 0, uint8_t = 0) {}
+};
+
+class SPIClass {
+public:
+  void begin() {}
+  void beginTransaction(SPISettings) {}
+  void endTransaction() {}
+  uint8_t transfer(uint8_t) { return 0; }
+};
+
+inline SPIClass SPI;
@@ -0,0 +1,159 @@
+// In-memory SdFat. Files live in fakeFs by name; fakeFsStats counts the
+// card traffic the benchmarks report.
+#pragma once
+
+#include <map>
+#include <memory>
+
+#include "Arduino.h"
+
+#define O_READ 0x01
+#define O_RDONLY 0x01
+#define O_WRITE 0x02
+#define O_WRONLY 0x02
+#define O_RDWR 0x03
+#define O_CREAT 0x10
+#define O_TRUNC 0x20
+#define O_APPEND 0x40
+#define FILE_READ O_READ
+#define FILE_WRITE (O_RDWR | O_CREAT | O_APPEND)
+#define SD_SCK_MHZ(m) ((m) * 1000000UL)
+#define SHARED_SPI 0
+#define DEDICATED_SPI 1
+
+struct SdSpiConfig {
+  SdSpiConfig(uint8_t csPin, uint8_t = 0, uint32_t = 0) : cs(csPin) {}
+  uint8_t cs;
+};
+
+struct FakeFsStats {
+  unsigned long writeCalls;
+  unsigned long bytesWritten;
+  unsigned long bytesRead;
+  unsigned long syncs;
+  unsigned long opens;
+  unsigned long begins;
+};
+
+typedef std::shared_ptr<std::vector<uint8_t>> FakeFileData;
+typedef std::map<std::string, FakeFileData> FakeFsMap;
+
+inline FakeFsStats fakeFsStats;
+inline FakeFsMap fakeFs;
+
+class File : public Stream {
+public:
+  FakeFileData d;
+  uint32_t pos = 0;
+  bool isOpen_ = false;
+  bool writable = false;
+
+  operator bool() const { return isOpen_; }
+  bool isOpen() const { return isOpen_; }
+
+  int available() override { return isOpen_ ? (int)(d->size() - pos) : 0; }
+  int read() override {
+    if (!isOpen_ || pos >= d->size()) return -1;
+    fakeFsStats.bytesRead++;
+    return (*d)[pos++];
+  }
+  int read(void *buf, size_t n) {
+    if (!isOpen_) return -1;
+    size_t k = 0;
+    uint8_t *out = (uint8_t *)buf;
+    while (k < n && pos < d->size()) out[k++] = (*d)[pos++];
+    fakeFsStats.bytesRead += k;
+    return k;
+  }
+  int peek() override { return (!isOpen_ || pos >= d->size()) ? -1 : (*d)[pos]; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t n) override {
+    if (!isOpen_ || !writable) return 0;
+    fakeFsStats.writeCalls++;
+    fakeFsStats.bytesWritten += n;
+    if (d->size() < pos + n) d->resize(pos + n);
+    memcpy(d->data() + pos, buf, n);
+    pos += n;
+    return n;
+  }
+  size_t write(const void *buf, size_t n) { return write((const uint8_t *)buf, n); }
+  using Print::write;
+
+  bool sync() {
+    fakeFsStats.syncs++;
+    return isOpen_;
+  }
+  void flush() override { sync(); }
+  bool close() {
+    isOpen_ = false;
+    return true;
+  }
+
+  uint32_t size() const { return d ? d->size() : 0; }
+  uint32_t fileSize() const { return size(); }
+  bool seek(uint32_t p) { return seekSet(p); }
+  bool seekSet(uint32_t p) {
+    if (!isOpen_ || p > d->size()) return false;
+    pos = p;
+    return true;
+  }
+  uint32_t position() const { return pos; }
+  uint32_t curPosition() const { return pos; }
+  bool truncate(uint32_t n) {
+    d->resize(n);
+    if (pos > n) pos = n;
+    return true;
+  }
+  bool truncate() { return truncate(pos); }
+  bool preAllocate(uint32_t n) {
+    if (d->size() < n) d->resize(n, 0);
+    return true;
+  }
+  bool isContiguous() const { return true; }
+  int getWriteError() const { return 0; }
+  void clearWriteError() {}
+};
+
+class SdFat {
+public:
+  bool mounted = false;
+
+  bool begin(uint8_t) { return mount(); }
+  bool begin(SdSpiConfig) { return mount(); }
+  void end() { mounted = false; }
+
+  bool exists(const char *name) { return fakeFs.count(name) > 0; }
+  bool remove(const char *name) { return fakeFs.erase(name) > 0; }
+  bool rename(const char *from, const char *to) {
+    if (!fakeFs.count(from) || fakeFs.count(to)) return false;
+    fakeFs[to] = fakeFs[from];
+    fakeFs.erase(from);
+    return true;
+  }
+
+  File open(const char *name, int mode = FILE_READ) {
+    File f;
+    if (!fakeFs.count(name)) {
+      if (!(mode & O_CREAT)) return f;
+      fakeFs[name] = std::make_shared<std::vector<uint8_t>>();
+    }
+    fakeFsStats.opens++;
+    f.d = fakeFs[name];
+    if (mode & O_TRUNC) f.d->clear();
+    f.isOpen_ = true;
+    f.writable = (mode & O_WRITE) != 0;
+    if (mode & O_APPEND) f.pos = f.d->size();
+    return f;
+  }
+
+  uint8_t sdErrorCode() { return 0; }
+  uint8_t sdErrorData() { return 0; }
+
+private:
+  bool mount() {
+    fakeFsStats.begins++;
+    mounted = true;
+    return true;
+  }
+};
@@ -0,0 +1,30 @@
+// Stands in for lib/Servo: moveTo() profiles advance one unit per moving()
+// poll instead of per 20 ms refresh.
+#pragma once
+
+#include "Arduino.h"
+
+class Servo {
+public:
+  uint8_t attach(int) { return attach(0, 0, 0); }
+  uint8_t attach(int, int, int) {
+    isAttached = true;
+    return 0;
+  }
+  void detach() { isAttached = false; }
+  bool attached() { return isAttached; }
+  void write(int value) { position = target = value; }
+  void writeMicroseconds(int value) { position = target = value; }
+  int read() { return position; }
+  int readMicroseconds() { return position; }
+  void moveTo(int value, unsigned, unsigned) { target = value; }
+  bool moving() {
+    if (position != target) position += position < target ? 1 : -1;
+    return position != target;
+  }
+
+private:
+  int position = 90;
+  int target = 90;
+  bool isAttached = false;
+};
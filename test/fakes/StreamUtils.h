@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Pass-through: the fake File is already in memory.
+class ReadBufferingStream : public Stream {
+public:
+  ReadBufferingStream(Stream &upstream, size_t) : upstream(upstream) {}
+  int available() override { return upstream.available(); }
+  int read() override { return upstream.read(); }
+  int peek() override { return upstream.peek(); }
+  size_t write(uint8_t) override { return 0; }
+  using Print::write;
+
+private:
+  Stream &upstream;
+};
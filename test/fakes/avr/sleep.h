@@ -0,0 +1,9 @@
+#pragma once
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+inline void set_sleep_mode(int) {}
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() {}
@@ -0,0 +1,9 @@
+#pragma once
+
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+
+inline void wdt_enable(int) {}
+inline void wdt_disable() {}
+inline void wdt_reset() {}
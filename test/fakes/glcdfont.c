@@ -0,0 +1,268 @@
+// Stand-in for Adafruit GFX's classic 5x7 font: same shape (256 glyphs of
+// 5 column bytes), pseudo-random bits. Pixel counts depend only on the
+// shape, and drawTextRun() run lengths on the bit patterns it reads back
+// through GFXcanvas1, so TFT numbers are comparable between native runs
+// but not exactly the hardware's.
+#ifndef FONT5X7_H
+#define FONT5X7_H
+
+static const unsigned char font[] PROGMEM = {
+    0x41, 0xFC, 0x0E, 0x47, 0x06,
+    0x2B, 0x8D, 0x63, 0x16, 0x63,
+    0x37, 0xB8, 0x8F, 0xC6, 0xBF,
+    0x4E, 0x5B, 0x5E, 0xC8, 0xAD,
+    0x5B, 0xCB, 0x81, 0x51, 0x38,
+    0x32, 0xB8, 0xF0, 0x9C, 0x07,
+    0x0C, 0xBD, 0xB3, 0x99, 0xBE,
+    0x65, 0xDC, 0xC2, 0x3E, 0x43,
+    0x29, 0x0F, 0x07, 0x6D, 0xC7,
+    0x76, 0xF0, 0x54, 0xC9, 0xE0,
+    0x48, 0x39, 0xE7, 0xEB, 0x60,
+    0xA5, 0x97, 0xC5, 0x63, 0x8D,
+    0x48, 0x74, 0x39, 0x59, 0x7C,
+    0x2E, 0x03, 0x66, 0xE4, 0x0A,
+    0xBE, 0x95, 0x55, 0xCF, 0x72,
+    0x7E, 0x0B, 0xB9, 0x4E, 0x09,
+    0x96, 0xDA, 0xBD, 0xD7, 0xF4,
+    0x1B, 0xE5, 0xED, 0xE9, 0x32,
+    0xB2, 0x62, 0x80, 0x19, 0xAB,
+    0x71, 0xEB, 0x48, 0xA4, 0x22,
+    0x46, 0x53, 0x85, 0x71, 0x2E,
+    0x01, 0xC3, 0xE4, 0x65, 0xA7,
+    0xFD, 0xC4, 0x8F, 0x60, 0x2F,
+    0x99, 0xE9, 0x44, 0x38, 0xFA,
+    0x35, 0x21, 0xC2, 0xEC, 0xE6,
+    0x87, 0x82, 0xAC, 0x1B, 0xAC,
+    0xF0, 0x08, 0x29, 0xF2, 0x30,
+    0x0D, 0x68, 0xA5, 0x0B, 0x7B,
+    0x04, 0x14, 0xED, 0xEC, 0xC2,
+    0x95, 0x97, 0x43, 0x43, 0xDF,
+    0x60, 0x03, 0xDF, 0x2B, 0xDA,
+    0xE6, 0x66, 0x5F, 0x39, 0x11,
+    0x08, 0x92, 0x69, 0xC0, 0xFB,
+    0x70, 0xE9, 0x11, 0x62, 0x84,
+    0x24, 0xD0, 0xC9, 0xCC, 0x63,
+    0x8F, 0x2A, 0xA2, 0x7E, 0x74,
+    0x4D, 0x7E, 0x71, 0x0C, 0xAD,
+    0x6F, 0x75, 0xE9, 0x39, 0x2A,
+    0x96, 0x2A, 0x66, 0x55, 0x1A,
+    0x56, 0x39, 0x9F, 0xD7, 0x5A,
+    0x32, 0x05, 0x98, 0xFC, 0xB3,
+    0x19, 0xAC, 0xB2, 0x20, 0xD5,
+    0x40, 0x28, 0xB7, 0x6C, 0x69,
+    0x97, 0x58, 0x62, 0xE0, 0x1C,
+    0x68, 0x63, 0x2D, 0x37, 0x9B,
+    0xA4, 0xE4, 0x4B, 0x59, 0x1F,
+    0xDB, 0x47, 0x62, 0x4A, 0x3A,
+    0x9A, 0x29, 0xDB, 0xC2, 0x47,
+    0x94, 0x42, 0xC8, 0xC7, 0xD3,
+    0x23, 0x75, 0x56, 0x41, 0xCE,
+    0xF0, 0x88, 0x77, 0x34, 0x91,
+    0xA4, 0x7F, 0x37, 0x0F, 0x70,
+    0x4F, 0xC0, 0xC3, 0x09, 0x0E,
+    0x19, 0x71, 0x7F, 0x39, 0x6F,
+    0x5C, 0xEC, 0x90, 0x15, 0x44,
+    0x89, 0xC5, 0xCF, 0x6B, 0x0D,
+    0x82, 0xD1, 0xA1, 0x9E, 0x8C,
+    0x8B, 0x2D, 0x87, 0x01, 0xC7,
+    0x04, 0x1D, 0xD2, 0x80, 0x77,
+    0x05, 0xA6, 0x0F, 0x74, 0xCB,
+    0xAE, 0xBD, 0x37, 0x82, 0xCE,
+    0x9F, 0x7E, 0xF8, 0xF4, 0xE7,
+    0xD1, 0x10, 0xB0, 0x07, 0x89,
+    0x66, 0x80, 0x88, 0x73, 0xFA,
+    0x35, 0xEE, 0x79, 0x6C, 0x8D,
+    0xF5, 0xFD, 0x93, 0x5B, 0xBF,
+    0xFF, 0x98, 0xEE, 0x0C, 0x79,
+    0x63, 0x0F, 0x53, 0xFC, 0x5D,
+    0x48, 0x74, 0x24, 0x1A, 0x28,
+    0xA1, 0x6C, 0x29, 0x82, 0x08,
+    0x1C, 0x30, 0xF0, 0x8A, 0xBB,
+    0xCC, 0x7B, 0xE0, 0x25, 0x37,
+    0x22, 0x59, 0x86, 0x6A, 0xE3,
+    0x7F, 0xE2, 0xA0, 0x78, 0x86,
+    0x91, 0xE1, 0x70, 0x78, 0x92,
+    0xCA, 0xD8, 0x60, 0xD3, 0x87,
+    0x29, 0x1E, 0x73, 0x29, 0x58,
+    0x96, 0x78, 0x33, 0x58, 0x68,
+    0x3A, 0x47, 0xF8, 0xBB, 0x53,
+    0x19, 0x93, 0x06, 0xF1, 0x52,
+    0x3F, 0xD9, 0xCC, 0x77, 0x38,
+    0x20, 0xD8, 0x15, 0x92, 0x8E,
+    0x05, 0x79, 0x13, 0x3A, 0xD4,
+    0xB8, 0xA6, 0x92, 0x48, 0xB4,
+    0x8B, 0x7F, 0x03, 0x8D, 0xAF,
+    0x4A, 0x94, 0x24, 0x00, 0x37,
+    0x27, 0x62, 0xCF, 0x3F, 0xA4,
+    0xA7, 0xEB, 0x4C, 0x40, 0xB0,
+    0xE2, 0xD9, 0x73, 0xAB, 0x26,
+    0x5F, 0xB4, 0xE2, 0xA7, 0x8B,
+    0x3D, 0x6B, 0x1E, 0x85, 0x19,
+    0x1E, 0x6E, 0xD0, 0x7D, 0xC7,
+    0xF9, 0x41, 0x50, 0xA8, 0xC2,
+    0x54, 0x00, 0xB2, 0x24, 0x18,
+    0x63, 0xF1, 0xFF, 0x26, 0x25,
+    0x93, 0xE8, 0xF3, 0xCC, 0x87,
+    0x5E, 0xE2, 0x40, 0x45, 0xC6,
+    0x92, 0x15, 0x60, 0x36, 0xD0,
+    0xC2, 0xB4, 0x48, 0xFD, 0xE2,
+    0xAF, 0xAB, 0x5E, 0x61, 0xD1,
+    0x77, 0x2F, 0xF8, 0xF2, 0xD7,
+    0x2E, 0x11, 0xD4, 0xDE, 0x10,
+    0x86, 0x24, 0xE6, 0xD6, 0x1A,
+    0x12, 0x25, 0x04, 0x49, 0x20,
+    0xFC, 0x24, 0x5B, 0x15, 0xC5,
+    0x4D, 0xEB, 0x91, 0x58, 0xB9,
+    0x00, 0xDC, 0xD8, 0xE9, 0x7F,
+    0x42, 0xD9, 0xAE, 0x2E, 0x12,
+    0xD0, 0x53, 0xCB, 0x06, 0x20,
+    0xCE, 0xAD, 0xBA, 0x01, 0x9C,
+    0xD9, 0x8F, 0x1E, 0xDC, 0x15,
+    0xA7, 0x8D, 0x89, 0x56, 0x84,
+    0x01, 0x91, 0x3B, 0xEC, 0xFA,
+    0x5B, 0x28, 0x5E, 0x7C, 0xE1,
+    0xED, 0x1C, 0x6E, 0xCC, 0x53,
+    0x38, 0x61, 0x14, 0x19, 0x23,
+    0xFB, 0x27, 0xEA, 0xFE, 0xB2,
+    0xE4, 0xC3, 0x2B, 0xA3, 0xB1,
+    0xEF, 0xB2, 0x00, 0xCC, 0xA7,
+    0xF7, 0x5E, 0x80, 0x6D, 0x9C,
+    0xBE, 0x88, 0x77, 0x56, 0xCB,
+    0x8D, 0xF6, 0xCD, 0x8C, 0x50,
+    0xAE, 0x20, 0x57, 0xC3, 0xE5,
+    0xF5, 0x70, 0xE4, 0x48, 0xA4,
+    0x9B, 0x53, 0xBC, 0xEF, 0xEB,
+    0x0B, 0xC7, 0x00, 0x95, 0xD2,
+    0xBC, 0x21, 0x13, 0x75, 0x89,
+    0x0D, 0xA5, 0xBF, 0xF3, 0xE3,
+    0x73, 0x9C, 0xDD, 0x5C, 0x82,
+    0x5C, 0x1B, 0xB3, 0xAC, 0x80,
+    0xDC, 0x6A, 0xDD, 0x4E, 0xAF,
+    0xFB, 0x4A, 0x87, 0xDC, 0x8A,
+    0x59, 0xA4, 0x5B, 0xF2, 0x93,
+    0x3E, 0xB6, 0xB0, 0x9D, 0xC9,
+    0x28, 0x1E, 0xFC, 0x8C, 0xCC,
+    0xC8, 0xE1, 0xEF, 0xD2, 0x9E,
+    0x01, 0xAC, 0x82, 0xE8, 0xF8,
+    0x5F, 0x11, 0xB5, 0x1E, 0x91,
+    0x88, 0x25, 0x6E, 0xB6, 0xA4,
+    0xF9, 0x7C, 0x01, 0xA2, 0x07,
+    0x0B, 0x42, 0xC4, 0xC5, 0x91,
+    0xB3, 0x41, 0x70, 0xA0, 0xF3,
+    0xF4, 0xAC, 0x42, 0x79, 0xED,
+    0x45, 0xFC, 0xE0, 0x01, 0xBF,
+    0x7D, 0x88, 0x0E, 0xF1, 0x7B,
+    0x65, 0x60, 0x33, 0x83, 0x07,
+    0xCD, 0x8B, 0x14, 0xCD, 0x53,
+    0xB3, 0x23, 0xEC, 0xFE, 0xBF,
+    0x55, 0x6D, 0x63, 0x12, 0x89,
+    0xDB, 0xF6, 0xA2, 0xEF, 0xFE,
+    0x26, 0x4F, 0x8C, 0x26, 0xF1,
+    0x47, 0x7C, 0x64, 0x8D, 0x58,
+    0x24, 0x41, 0x49, 0x78, 0x19,
+    0x4A, 0x14, 0x71, 0x91, 0x21,
+    0xB8, 0x06, 0x04, 0xED, 0x53,
+    0xD7, 0x8A, 0xD3, 0x8C, 0x5D,
+    0xAD, 0xE3, 0xE2, 0xC9, 0x67,
+    0xE0, 0xCD, 0xB4, 0x04, 0x67,
+    0xB5, 0x30, 0x17, 0x2E, 0x3C,
+    0xE9, 0x76, 0x2A, 0x98, 0x8D,
+    0x3A, 0x18, 0xD8, 0x3C, 0x57,
+    0x5C, 0x1D, 0x05, 0x22, 0x73,
+    0x38, 0xC3, 0x03, 0x92, 0x7C,
+    0x9E, 0x09, 0x91, 0x47, 0xBF,
+    0x15, 0x82, 0xBB, 0xBD, 0x25,
+    0x2B, 0x54, 0xB4, 0xEE, 0xDD,
+    0x48, 0x0D, 0x7C, 0x65, 0x50,
+    0x43, 0x25, 0xF9, 0xA1, 0xC6,
+    0xB3, 0x85, 0x4E, 0x1B, 0x4C,
+    0x65, 0xEA, 0x43, 0xFC, 0x87,
+    0xBE, 0x69, 0xDA, 0x38, 0x33,
+    0x2E, 0x09, 0x73, 0x6A, 0x1C,
+    0xCA, 0x50, 0x77, 0x0A, 0xC7,
+    0xD8, 0xBC, 0x63, 0x97, 0xDC,
+    0x41, 0x51, 0x22, 0xAB, 0xC2,
+    0x63, 0x9D, 0x52, 0xBC, 0x3E,
+    0xFA, 0xE7, 0xB6, 0xA0, 0x6F,
+    0x88, 0xB3, 0x66, 0xC9, 0x07,
+    0x06, 0xDF, 0x97, 0x40, 0xBE,
+    0x2F, 0x97, 0x0A, 0x71, 0x34,
+    0xFC, 0xDA, 0x6F, 0xF6, 0xD5,
+    0x78, 0x39, 0xF6, 0x3E, 0x8E,
+    0x59, 0xE9, 0xAB, 0x01, 0x15,
+    0x78, 0x79, 0xE6, 0x70, 0x1D,
+    0x9D, 0x81, 0x7C, 0x50, 0x6E,
+    0xC3, 0x56, 0x41, 0x2B, 0x7B,
+    0x5C, 0xDB, 0xB0, 0x4E, 0x12,
+    0xA3, 0xCE, 0x1F, 0xD3, 0xC3,
+    0x8F, 0xAB, 0xD9, 0xC4, 0x25,
+    0x49, 0xDF, 0x72, 0x8D, 0xB2,
+    0xE0, 0x77, 0x4C, 0x18, 0xC5,
+    0xCE, 0x07, 0x10, 0x98, 0xE4,
+    0xFC, 0x90, 0xC9, 0x4A, 0xA2,
+    0xE7, 0x72, 0x3A, 0x56, 0xAE,
+    0xF0, 0xA0, 0x49, 0xA7, 0x81,
+    0xA6, 0xE7, 0x2B, 0xE4, 0x31,
+    0x6C, 0x87, 0xFE, 0x8B, 0x38,
+    0xA3, 0x90, 0xE6, 0xFF, 0x63,
+    0x32, 0x8F, 0x95, 0xB4, 0xDA,
+    0x55, 0x05, 0x5D, 0xCD, 0xEE,
+    0x6C, 0x0A, 0xA8, 0xF4, 0xC4,
+    0xA3, 0x2C, 0x16, 0xFB, 0xF1,
+    0xFD, 0x21, 0xF9, 0xBE, 0xAE,
+    0xA3, 0x22, 0x15, 0x19, 0x9C,
+    0x01, 0x4A, 0xFB, 0x73, 0x93,
+    0x53, 0x9D, 0xE6, 0xA1, 0x9E,
+    0xDB, 0xFB, 0x54, 0xC1, 0xA8,
+    0x13, 0x1F, 0x0B, 0xF8, 0x6E,
+    0x93, 0x96, 0x4A, 0xE7, 0x2F,
+    0x0D, 0xD8, 0x8B, 0x04, 0x2A,
+    0xB4, 0x8B, 0x50, 0x98, 0x3D,
+    0xA5, 0x59, 0x95, 0x46, 0xE0,
+    0xAB, 0x72, 0xD2, 0x6E, 0x78,
+    0x03, 0xB4, 0xFA, 0x22, 0x6B,
+    0xE0, 0xA0, 0x07, 0x52, 0x7F,
+    0x88, 0x3A, 0xC3, 0xF1, 0x8A,
+    0x76, 0x2A, 0xBF, 0xBC, 0x45,
+    0xBF, 0x3C, 0x83, 0xBE, 0x25,
+    0x4A, 0x4C, 0x67, 0x68, 0x12,
+    0x22, 0xF2, 0xDD, 0x10, 0x24,
+    0xBE, 0x42, 0x84, 0xA2, 0xEF,
+    0x39, 0x3D, 0xE8, 0xD5, 0x06,
+    0x33, 0x90, 0x29, 0x9C, 0x2C,
+    0x17, 0x46, 0x03, 0x23, 0xBF,
+    0x33, 0x1D, 0xB7, 0xDE, 0x64,
+    0x30, 0x52, 0x9F, 0x3D, 0x1D,
+    0xEE, 0x08, 0xD3, 0xCF, 0x5C,
+    0xE9, 0xFD, 0xD0, 0x39, 0x20,
+    0xA4, 0x73, 0x03, 0xFD, 0xAC,
+    0x76, 0x3E, 0xE6, 0xE0, 0xCB,
+    0x6D, 0xA0, 0xF5, 0xDF, 0xF5,
+    0x24, 0xB7, 0xD7, 0x2F, 0x27,
+    0x21, 0x4D, 0x06, 0x3B, 0xFA,
+    0xFD, 0xD4, 0x3F, 0xBA, 0x70,
+    0x4E, 0x42, 0x07, 0xBA, 0x58,
+    0xA6, 0xDC, 0x32, 0x54, 0x48,
+    0xEA, 0x9B, 0x3D, 0x20, 0x33,
+    0x30, 0x87, 0x14, 0x34, 0x45,
+    0x39, 0x39, 0x50, 0x3F, 0x28,
+    0x65, 0xC5, 0x6D, 0x32, 0xB5,
+    0xDE, 0xDF, 0x33, 0xAD, 0x08,
+    0xE6, 0x4F, 0xF4, 0x21, 0xA7,
+    0xA6, 0x9C, 0xDC, 0x4A, 0xAD,
+    0x70, 0x5F, 0x95, 0x0C, 0x36,
+    0xE9, 0x66, 0xB3, 0x29, 0xCC,
+    0x4F, 0xEE, 0x57, 0x94, 0xD8,
+    0x8C, 0xC2, 0x01, 0xD5, 0x3E,
+    0x6B, 0x6C, 0x3D, 0xAC, 0x9E,
+    0xCB, 0x57, 0x50, 0xDB, 0x9D,
+    0x8C, 0x4B, 0x9B, 0xDC, 0xC0,
+    0x0A, 0x6E, 0x5D, 0xCB, 0xEB,
+    0x0A, 0x64, 0xA2, 0x6D, 0xB5,
+    0xD2, 0x06, 0x3F, 0x2F, 0x3A,
+    0xA7, 0x47, 0xF5, 0x92, 0x63,
+    0x54, 0x97, 0x24, 0x10, 0x1F,
+    0xE0, 0xF0, 0xAA, 0x2E, 0x53
+};
+
+#endif
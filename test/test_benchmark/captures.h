@@ -0,0 +1,89 @@
+// Recorded upload streams replayed by the benchmarks.
+#pragma once
+
+#include <stdint.h>
+
+// src/data.json as uploaded by older senders (indent=2).
+static const char dataJson[] = R"json([
+    {
+        "tube": "tube1",
+        "type": "Paracetamol",
+        "amount": 120,
+        "time_to_take": [
+            {
+                "time": "20:00",
+                "dosage": "1 tablet"
+            },
+            {
+                "time": "12:00",
+                "dosage": "1 tablet"
+            }
+        ]
+    },
+    {
+        "tube": "tube2",
+        "type": "Vitamin C",
+        "amount": 60,
+        "time_to_take": [
+            {
+                "time": "09:00",
+                "dosage": "2 tablets"
+            },
+            {
+                "time": "21:00",
+                "dosage": "1 tablet"
+            }
+        ]
+    },
+    {
+        "tube": "tube3",
+        "type": "Ibuprofen",
+        "amount": 90,
+        "time_to_take": [
+            {
+                "time": "07:30",
+                "dosage": "1 tablet"
+            },
+            {
+                "time": "18:00",
+                "dosage": "1 tablet"
+            }
+        ]
+    },
+    {
+        "tube": "tube4",
+        "type": "Ibuprofen21",
+        "amount": 90,
+        "time_to_take": [
+            {
+                "time": "07:30",
+                "dosage": "1 tablet"
+            }
+        ]
+    }
+])json";
+
+// Host-to-device bytes of test.py's framed_upload() sending the same
+// schedule minified and LZ-encoded, in 20 byte BLE writes. Regenerate by
+// logging the frames test.py passes to write() when the schedule changes.
+static const uint8_t framedLzUpload[] = {
+    0xA5, 0x01, 0x00, 0x07, 0xB6, 0x00, 0x00, 0x00, 0x5D, 0x14, 0x01, 0x3C,
+    0xD9, 0xA5, 0x02, 0x00, 0x30, 0xFF, 0x5B, 0x7B, 0x22, 0x74, 0x75, 0x62,
+    0x65, 0x22, 0xFD, 0x3A, 0x06, 0x04, 0x31, 0x22, 0x2C, 0x22, 0x74, 0x79,
+    0xFD, 0x70, 0x0E, 0x02, 0x50, 0x61, 0x72, 0x61, 0x63, 0x65, 0x9F, 0x74,
+    0x61, 0x6D, 0x6F, 0x6C, 0x14, 0x00, 0x06, 0x00, 0x75, 0x7F, 0x6E, 0x74,
+    0x22, 0x3A, 0x31, 0x32, 0x30, 0xEF, 0xB0, 0xA5, 0x02, 0x01, 0x30, 0x21,
+    0x00, 0xFF, 0x69, 0x6D, 0x65, 0x5F, 0x74, 0x6F, 0x5F, 0x74, 0xC3, 0x61,
+    0x6B, 0x29, 0x00, 0x41, 0x02, 0x10, 0x00, 0x32, 0x00, 0x32, 0x30, 0xF7,
+    0x3A, 0x30, 0x30, 0x2C, 0x00, 0x64, 0x6F, 0x73, 0x61, 0xFD, 0x67, 0x10,
+    0x02, 0x31, 0x20, 0x74, 0x61, 0x62, 0x6C, 0xDF, 0x65, 0x74, 0x22, 0x50,
+    0xA9, 0xA5, 0x02, 0x02, 0x30, 0x7D, 0x2C, 0x24, 0x0C, 0x31, 0x32, 0xD2,
+    0x24, 0x2C, 0x5D, 0x26, 0x04, 0x8D, 0x0E, 0x32, 0x8D, 0x0E, 0x56, 0x69,
+    0x5E, 0x89, 0x00, 0x69, 0x6E, 0x20, 0x43, 0x8B, 0x10, 0x36, 0x8A, 0x30,
+    0xAB, 0x30, 0x39, 0x65, 0x18, 0x32, 0x65, 0x08, 0x73, 0x8B, 0x12, 0x32,
+    0xF5, 0x31, 0x8B, 0x4C, 0x33, 0xA8, 0x7F, 0xA5, 0x02, 0x03, 0x26, 0x8B,
+    0x0E, 0x49, 0x62, 0x75, 0x70, 0x5F, 0x72, 0x6F, 0x66, 0x65, 0x6E, 0x8B,
+    0x10, 0x39, 0x8B, 0x32, 0x57, 0x37, 0x3A, 0x33, 0x16, 0x3F, 0x38, 0x8A,
+    0x4C, 0x34, 0x8A, 0x20, 0x39, 0x32, 0xB9, 0x03, 0x8C, 0x78, 0x5D, 0x7D,
+    0x5D, 0x84, 0x3A, 0xA5, 0x03, 0x00, 0x00, 0xCC, 0x95
+};
@@ -0,0 +1,313 @@
+// Benchmarks for the schedule, ingest and render paths, run on the host
+// with `pio test -e native`. Every case prints one line
+//
+//   name  ops  ns/op  cycles/op  sd_w  sd_r  syncs  tft_px  windows  stack
+//
+// with the card and display traffic and the peak stack of a single op, and
+// fails when traffic or stack goes over the budget next to the case.
+// Times (and host TSC cycles, where there is one) are only printed: they
+// depend on the machine, the traffic numbers do not. Stack is the host's,
+// libc's printf family included, so its budgets only catch gross growth
+// such as a buffer moving onto the stack.
+
+// Standard headers first: the Arduino core defines min() and max() macros.
+#include <pthread.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#endif
+
+#include <Adafruit_ST7789.h>
+#include <Arduino.h>
+#include <RTClib.h>
+#include <SdFat.h>
+#include <unity.h>
+
+#include "captures.h"
+
+// src/main.cpp has no header
+extern Adafruit_ST7789 tft;
+extern DateTime rtctime;
+extern int scheduleCount;
+extern int groupedCount;
+extern int ungroupedCount;
+extern bool filestat;
+extern bool receiving;
+void setup();
+bool initSD();
+bool loadScheduleData();
+void groupMedicationsByTime();
+int findNextMedication();
+void showMainMenu();
+void invalidateUi();
+void handleSerialIngest();
+
+#define BENCH_STACK_SIZE (256 * 1024)
+#define BENCH_STACK_PAINT 0xA5
+#define BLE_CHUNK 20
+
+struct BenchResult {
+  unsigned long ops;
+  double nsPerOp;
+  double cyclesPerOp;
+  unsigned long sdWritten;
+  unsigned long sdRead;
+  unsigned long sdSyncs;
+  unsigned long tftPixels;
+  unsigned long tftWindows;
+  size_t stackBytes;
+};
+
+struct StackProbe {
+  const std::function<void()> *op;
+};
+
+void *runOnProbeStack(void *arg) {
+  (*static_cast<StackProbe *>(arg)->op)();
+  return nullptr;
+}
+
+// Runs op once on a painted thread stack and returns how much of it was
+// touched, thread start-up included (see stackBaseline).
+size_t measureStack(const std::function<void()> &op) {
+  static uint8_t *stack = nullptr;
+  if (!stack) stack = static_cast<uint8_t *>(aligned_alloc(4096, BENCH_STACK_SIZE));
+  memset(stack, BENCH_STACK_PAINT, BENCH_STACK_SIZE);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+  StackProbe probe = {&op};
+  pthread_t thread;
+  pthread_create(&thread, &attr, runOnProbeStack, &probe);
+  pthread_join(thread, nullptr);
+  pthread_attr_destroy(&attr);
+
+  size_t untouched = 0;  // the stack grows down from the top
+  while (untouched < BENCH_STACK_SIZE && stack[untouched] == BENCH_STACK_PAINT) untouched++;
+  return BENCH_STACK_SIZE - untouched;
+}
+
+size_t stackBaseline() {
+  static size_t baseline = measureStack([] {});
+  return baseline;
+}
+
+// prepare() restores the state op needs and is not measured. The first op
+// runs on the probe stack and provides the traffic numbers; the rest are
+// timed.
+BenchResult bench(const char *name, unsigned long ops, const std::function<void()> &prepare,
+                  const std::function<void()> &op) {
+  BenchResult r;
+  memset(&r, 0, sizeof(r));
+  r.ops = ops;
+
+  prepare();
+  memset(&fakeFsStats, 0, sizeof(fakeFsStats));
+  tft.pixels = 0;
+  tft.windows = 0;
+  size_t stack = measureStack(op);
+  r.stackBytes = stack > stackBaseline() ? stack - stackBaseline() : 0;
+  r.sdWritten = fakeFsStats.bytesWritten;
+  r.sdRead = fakeFsStats.bytesRead;
+  r.sdSyncs = fakeFsStats.syncs;
+  r.tftPixels = tft.pixels;
+  r.tftWindows = tft.windows;
+
+  double ns = 0, cycles = 0;
+  for (unsigned long i = 0; i < ops; i++) {
+    prepare();
+    auto start = std::chrono::steady_clock::now();
+#ifdef BENCH_HAVE_TSC
+    unsigned long long tsc = __rdtsc();
+#endif
+    op();
+#ifdef BENCH_HAVE_TSC
+    cycles += __rdtsc() - tsc;
+#endif
+    ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+  r.nsPerOp = ns / ops;
+  r.cyclesPerOp = cycles / ops;
+
+  printf("BENCH %-22s %6lu %10.0f %10.0f %6lu %6lu %3lu %7lu %5lu %6zu\n", name, r.ops, r.nsPerOp,
+         r.cyclesPerOp, r.sdWritten, r.sdRead, r.sdSyncs, r.tftPixels, r.tftWindows, r.stackBytes);
+  return r;
+}
+
+// Card contents
+
+FakeFileData fileOf(const std::string &text) {
+  return std::make_shared<std::vector<uint8_t>>(text.begin(), text.end());
+}
+
+// A legacy card holding only data.json.
+void resetCard(const std::string &json) {
+  fakeFs.clear();
+  fakeFs["data.json"] = fileOf(json);
+  initSD();
+}
+
+// More medications and doses than schedules[] holds, with long strings,
+// unknown keys and nested values the parser has to skip.
+std::string syntheticRegimen(int medications, int dosesPerMedication) {
+  std::string json = "[";
+  char buf[160];
+  for (int m = 0; m < medications; m++) {
+    snprintf(buf, sizeof(buf),
+             "%s{\"tube\":\"tube%d\",\"type\":\"Medication with a long name %d\",\"amount\":%d,"
+             "\"notes\":{\"prescriber\":\"Dr. Example\",\"refills\":[1,2,3]},\"time_to_take\":[",
+             m ? "," : "", m % 4 + 1, m, 10 + m);
+    json += buf;
+    for (int d = 0; d < dosesPerMedication; d++) {
+      snprintf(buf, sizeof(buf), "%s{\"time\":\"%02d:%02d\",\"dosage\":\"%d tablets with food\",\"with_food\":true}",
+               d ? "," : "", (m + d * 3) % 24, (m * 7) % 60, d % 3 + 1);
+      json += buf;
+    }
+    json += "]}";
+  }
+  return json + "]";
+}
+
+// Feeds a recorded stream in BLE-sized writes, draining after each like
+// loop() does.
+void replay(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i += BLE_CHUNK) {
+    size_t n = len - i < BLE_CHUNK ? len - i : BLE_CHUNK;
+    Serial1.rx.insert(Serial1.rx.end(), data + i, data + i + n);
+    handleSerialIngest();
+    delay(5);
+  }
+  Serial1.tx.clear();
+  Serial.tx.clear();
+}
+
+// Cases
+
+void setUp() {}
+void tearDown() {}
+
+void test_load_schedule_json() {
+  BenchResult r = bench("load_json", 200, [] {
+    resetCard(dataJson);
+  }, [] { loadScheduleData(); });
+  TEST_ASSERT_EQUAL(7, scheduleCount);
+  TEST_ASSERT_LESS_OR_EQUAL(strlen(dataJson) + 64, r.sdRead);  // one pass over the file
+  TEST_ASSERT_LESS_OR_EQUAL(512, r.sdWritten);                 // the image cache only
+  TEST_ASSERT_LESS_OR_EQUAL(4096, r.stackBytes);
+}
+
+void test_load_schedule_image() {
+  BenchResult r = bench("load_image", 1000, [] {
+    scheduleCount = 0;
+  }, [] { loadScheduleData(); });
+  TEST_ASSERT_EQUAL(7, scheduleCount);
+  TEST_ASSERT_EQUAL(0, r.sdWritten);
+  TEST_ASSERT_LESS_OR_EQUAL(512, r.sdRead);
+  TEST_ASSERT_LESS_OR_EQUAL(4096, r.stackBytes);
+}
+
+void test_load_schedule_large() {
+  static std::string regimen = syntheticRegimen(40, 8);
+  BenchResult r = bench("load_json_large", 50, [] {
+    resetCard(regimen);
+  }, [] { loadScheduleData(); });
+  TEST_ASSERT_EQUAL(32, scheduleCount);  // MAX_SCHEDULES, the rest dropped
+  // 32 distinct times for MAX_GROUPED groups: the rest are counted, not lost
+  TEST_ASSERT_EQUAL(24, groupedCount);
+  TEST_ASSERT_EQUAL(8, ungroupedCount);
+  TEST_ASSERT_LESS_OR_EQUAL(regimen.size() + 64, r.sdRead);
+  TEST_ASSERT_LESS_OR_EQUAL(4096, r.stackBytes);
+}
+
+void test_group_medications() {
+  // The sample schedule; the large one above leaves doses ungrouped
+  resetCard(dataJson);
+  loadScheduleData();
+  BenchResult r = bench("group_by_time", 20000, [] {}, [] { groupMedicationsByTime(); });
+  TEST_ASSERT_TRUE(groupedCount > 0);
+  TEST_ASSERT_LESS_OR_EQUAL(1024, r.stackBytes);
+}
+
+void test_find_next_medication() {
+  static int minute = 0;
+  BenchResult r = bench("find_next", 100000, [] {
+    minute = (minute + 37) % (24 * 60);
+    rtctime = DateTime(2025, 1, 1, minute / 60, minute % 60, 0);
+  }, [] { findNextMedication(); });
+  TEST_ASSERT_EQUAL(0, r.sdRead);
+  TEST_ASSERT_LESS_OR_EQUAL(512, r.stackBytes);
+}
+
+void test_ingest_legacy() {
+  static std::string stream = std::string("#START#") + dataJson + "#END#";
+  BenchResult r = bench("ingest_legacy", 100, [] {
+    resetCard(dataJson);
+    loadScheduleData();
+  }, [] { replay((const uint8_t *)stream.data(), stream.size()); });
+  TEST_ASSERT_FALSE(receiving);
+  TEST_ASSERT_TRUE(filestat);
+  // The file in whole sectors plus the slot pointer and the image cache
+  TEST_ASSERT_LESS_OR_EQUAL(strlen(dataJson) + 1024, r.sdWritten);
+  TEST_ASSERT_LESS_OR_EQUAL(4, r.sdSyncs);
+  TEST_ASSERT_LESS_OR_EQUAL(6144, r.stackBytes);
+}
+
+void test_ingest_framed_lz() {
+  BenchResult r = bench("ingest_framed_lz", 100, [] {
+    resetCard(dataJson);
+    loadScheduleData();
+  }, [] { replay(framedLzUpload, sizeof(framedLzUpload)); });
+  TEST_ASSERT_FALSE(receiving);
+  TEST_ASSERT_TRUE(filestat);
+  TEST_ASSERT_EQUAL(7, scheduleCount);
+  TEST_ASSERT_LESS_OR_EQUAL(2048, r.sdWritten);
+  TEST_ASSERT_LESS_OR_EQUAL(4, r.sdSyncs);
+  TEST_ASSERT_LESS_OR_EQUAL(6144, r.stackBytes);
+}
+
+void test_ui_full_redraw() {
+  BenchResult r = bench("ui_full_redraw", 200, [] {
+    resetCard(dataJson);
+    filestat = loadScheduleData();
+    rtctime = DateTime(2025, 1, 1, 10, 0, 0);
+    invalidateUi();
+  }, [] { showMainMenu(); });
+  // Background, header and the schedule cards: about three screens' worth
+  TEST_ASSERT_LESS_OR_EQUAL(260000, r.tftPixels);
+  TEST_ASSERT_LESS_OR_EQUAL(24, r.tftWindows);
+  TEST_ASSERT_LESS_OR_EQUAL(4096, r.stackBytes);
+}
+
+void test_ui_idle_refresh() {
+  BenchResult r = bench("ui_idle_refresh", 10000, [] {}, [] { showMainMenu(); });
+  TEST_ASSERT_EQUAL(0, r.tftPixels);  // nothing changed, nothing is sent
+  TEST_ASSERT_EQUAL(0, r.sdRead);
+  TEST_ASSERT_LESS_OR_EQUAL(2048, r.stackBytes);
+}
+
+int main(int, char **) {
+  resetCard(dataJson);
+  setup();
+  Serial.tx.clear();
+  printf("BENCH %-22s %6s %10s %10s %6s %6s %3s %7s %5s %6s\n", "case", "ops", "ns/op", "cycles/op",
+         "sd_w", "sd_r", "syn", "tft_px", "win", "stack");
+
+  UNITY_BEGIN();
+  RUN_TEST(test_load_schedule_json);
+  RUN_TEST(test_load_schedule_image);
+  RUN_TEST(test_load_schedule_large);
+  RUN_TEST(test_group_medications);
+  RUN_TEST(test_find_next_medication);
+  RUN_TEST(test_ui_full_redraw);
+  RUN_TEST(test_ui_idle_refresh);
+  // Last: a completed upload queues tube setup, which takes over the screen
+  RUN_TEST(test_ingest_legacy);
+  RUN_TEST(test_ingest_framed_lz);
+  return UNITY_END();
+}